@@ -0,0 +1,556 @@
+// Renders procedurally generated scenarios headless for a fixed number of frames and reports their frame rate, CPU
+// and GPU frame times, and startup breakdown as JSON. Results are compared against a baseline, the exit code is 1 when
+// a scenario fails to run and 2 when a result regressed past its threshold.
+//
+// Baselines are plain text, one metric per line, as written by --save-baseline:
+//     <scenario> <metric> <value> [max regression]
+// The max regression is a fraction of the value and defaults to --threshold. Lines for scenarios that weren't run are
+// ignored, and metrics can be deleted from the file to stop checking them.
+
+#include <vector>
+#include <string>
+#include <cmath>
+#include <cstdlib>
+#include <chrono>
+#include <fstream>
+#include <sstream>
+#include <algorithm>
+
+#include <fmt/format.h>
+#include <magic_enum.hpp>
+#include <vulkan/vulkan_core.h>
+
+#include "renderer.hpp"
+#include "profiling.hpp"
+
+struct bench_scenario
+{
+    std::string name;
+    uint32_t draw_count = 1;
+    uint32_t triangle_count = 1; // Across all draws, at least one per draw
+    uint32_t pipeline_count = 1; // Draws cycle through them so consecutive draws rebind
+    uint32_t width = 800;
+    uint32_t height = 600;
+};
+
+// Sized to run in a few seconds each on lavapipe
+static const std::vector<bench_scenario> default_scenarios{
+    {"single_triangle", 1, 1, 1, 800, 600},
+    {"many_draws", 4096, 4096, 1, 800, 600},
+    {"many_triangles", 16, 262144, 1, 800, 600},
+    {"many_pipelines", 1024, 16384, 32, 800, 600},
+    {"high_resolution", 64, 4096, 1, 2560, 1440},
+};
+
+struct bench_options
+{
+    uint64_t warmup_frames = 60;
+    uint64_t measured_frames = 300;
+    uint32_t frames_in_flight = 2;
+    uint32_t draws_per_recording_slice = init_settings{}.draws_per_recording_slice; // 0 records every draw on one thread
+    std::string scenario_file;
+    std::vector<std::string> scenario_filter; // Empty runs all of them
+    std::string output_path = "renderer_bench.json"; // Kept out of stdout, which carries the renderer's logs
+    std::string baseline_path;
+    std::string save_baseline_path;
+    double threshold = 0.1;
+};
+
+struct metric_regression
+{
+    std::string metric;
+    double baseline = 0.0;
+    double value = 0.0;
+};
+
+struct bench_result
+{
+    bench_scenario scenario;
+    double fps = 0.0;
+    timing_summary cpu_frame{};
+    timing_summary gpu_frame{}; // No samples when the queue can't write timestamps
+    double transient_mib = 0.0; // Peak memory of the render graph's transient images
+    std::vector<startup_timing> startup;
+    std::vector<metric_regression> regressions;
+};
+
+// Metrics written to saved baselines
+static constexpr const char *baseline_metrics[] = {"fps", "cpu_p50_ms", "cpu_p95_ms", "gpu_p50_ms", "gpu_p95_ms", "transient_mib"};
+
+uint64_t elapsed_ns(std::chrono::steady_clock::time_point start_time)
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start_time).count();
+}
+
+bool parse_arguments(int argc, char **argv, bench_options &options)
+{
+    for (int i = 1; i < argc; i++)
+    {
+        std::string arg = argv[i];
+        if (arg == "--warmup-frames" && i + 1 < argc)
+        {
+            options.warmup_frames = std::strtoull(argv[++i], nullptr, 10);
+        }
+        else if (arg == "--frames" && i + 1 < argc)
+        {
+            options.measured_frames = std::strtoull(argv[++i], nullptr, 10);
+        }
+        else if (arg == "--frames-in-flight" && i + 1 < argc)
+        {
+            options.frames_in_flight = static_cast<uint32_t>(std::strtoul(argv[++i], nullptr, 10));
+        }
+        else if (arg == "--draws-per-slice" && i + 1 < argc)
+        {
+            options.draws_per_recording_slice = static_cast<uint32_t>(std::strtoul(argv[++i], nullptr, 10));
+        }
+        else if (arg == "--scenarios" && i + 1 < argc)
+        {
+            options.scenario_file = argv[++i];
+        }
+        else if (arg == "--scenario" && i + 1 < argc)
+        {
+            options.scenario_filter.push_back(argv[++i]);
+        }
+        else if (arg == "--output" && i + 1 < argc)
+        {
+            options.output_path = argv[++i];
+        }
+        else if (arg == "--baseline" && i + 1 < argc)
+        {
+            options.baseline_path = argv[++i];
+        }
+        else if (arg == "--save-baseline" && i + 1 < argc)
+        {
+            options.save_baseline_path = argv[++i];
+        }
+        else if (arg == "--threshold" && i + 1 < argc)
+        {
+            options.threshold = std::strtod(argv[++i], nullptr);
+        }
+        else
+        {
+            fmt::print("Unknown argument {}\n", arg);
+            return false;
+        }
+    }
+    if (options.measured_frames == 0)
+    {
+        fmt::print("--frames must be at least 1\n");
+        return false;
+    }
+    return true;
+}
+
+// One scenario per line: <name> <draws> <triangles> <pipelines> <width> <height>, # starts a comment
+bool load_scenarios(std::string const &path, std::vector<bench_scenario> &out_scenarios)
+{
+    std::ifstream file(path);
+    if (!file)
+    {
+        fmt::print("Failed to open scenario file {}\n", path);
+        return false;
+    }
+    std::string line;
+    for (uint32_t line_number = 1; std::getline(file, line); line_number++)
+    {
+        line = line.substr(0, line.find('#'));
+        std::istringstream fields(line);
+        bench_scenario scenario{};
+        if (!(fields >> scenario.name))
+        {
+            continue;
+        }
+        if (!(fields >> scenario.draw_count >> scenario.triangle_count >> scenario.pipeline_count >> scenario.width >> scenario.height))
+        {
+            fmt::print("{}:{}: expected <name> <draws> <triangles> <pipelines> <width> <height>\n", path, line_number);
+            return false;
+        }
+        out_scenarios.push_back(scenario);
+    }
+    return true;
+}
+
+bool validate_scenario(bench_scenario const &scenario)
+{
+    if (scenario.draw_count == 0 || scenario.pipeline_count == 0 || scenario.width == 0 || scenario.height == 0)
+    {
+        fmt::print("Scenario {} needs at least one draw and pipeline and a non-empty resolution\n", scenario.name);
+        return false;
+    }
+    if (scenario.triangle_count < scenario.draw_count)
+    {
+        fmt::print("Scenario {} has fewer triangles than draws\n", scenario.name);
+        return false;
+    }
+    return true;
+}
+
+// Every triangle gets its own cell of a grid covering the screen and fills half of it, so the fragment load depends
+// only on the resolution while the vertex load follows the triangle count
+VkResult create_scenario_meshes(renderer &rend, bench_scenario const &scenario, std::vector<mesh> &out_meshes)
+{
+    uint32_t grid_size = static_cast<uint32_t>(std::ceil(std::sqrt(static_cast<double>(scenario.triangle_count))));
+    float cell_size = 2.f / grid_size;
+    uint32_t next_triangle = 0;
+    std::vector<mesh_vertex> vertices;
+    std::vector<uint32_t> indices;
+    for (uint32_t draw = 0; draw < scenario.draw_count; draw++)
+    {
+        uint32_t triangle_count = scenario.triangle_count / scenario.draw_count + (draw < scenario.triangle_count % scenario.draw_count ? 1 : 0);
+        float red = static_cast<float>(draw % 7) / 6.f;
+        float green = static_cast<float>(draw % 5) / 4.f;
+        vertices.clear();
+        indices.clear();
+        for (uint32_t i = 0; i < triangle_count; i++, next_triangle++)
+        {
+            float x = -1.f + static_cast<float>(next_triangle % grid_size) * cell_size;
+            float y = -1.f + static_cast<float>(next_triangle / grid_size) * cell_size;
+            uint32_t first_vertex = static_cast<uint32_t>(vertices.size());
+            vertices.push_back({.position = {x, y, 0.f, 1.f}, .color = {red, green, 1.f, 1.f}});
+            vertices.push_back({.position = {x + cell_size, y, 0.f, 1.f}, .color = {red, green, 0.f, 1.f}});
+            vertices.push_back({.position = {x, y + cell_size, 0.f, 1.f}, .color = {red, 0.f, 1.f, 1.f}});
+            indices.insert(indices.end(), {first_vertex, first_vertex + 1, first_vertex + 2});
+        }
+        mesh draw_mesh{};
+        VkResult err = add_mesh(rend.allocator, rend.uploads, rend.meshes, vertices, indices, draw_mesh);
+        if (err != VK_SUCCESS)
+        {
+            fmt::print("Failed to add the meshes of scenario {} with error code {}\n", scenario.name, magic_enum::enum_name(err));
+            return err;
+        }
+        out_meshes.push_back(draw_mesh);
+    }
+    return VK_SUCCESS;
+}
+
+VkResult render_frame(renderer &rend, timing_history *cpu_frame_history)
+{
+    VkResult err = render(rend);
+    if (err != VK_SUCCESS)
+    {
+        fmt::print("Rendering frame {} failed with error code {}\n", rend.frame_count, magic_enum::enum_name(err));
+        return err;
+    }
+    rend.frame_count++;
+    if (cpu_frame_history != nullptr)
+    {
+        // Without the waits for the GPU, which would make a GPU bound scenario look CPU bound
+        add_timing_sample(*cpu_frame_history, UINT32_MAX, rend.frame_cpu_ns / 1e6);
+    }
+    return VK_SUCCESS;
+}
+
+// Waits for every frame rendered so far and reads back their GPU timings
+VkResult finish_frames(renderer &rend)
+{
+    VkResult err = wait_for_frame_value(rend, rend.frame_count, UINT64_MAX);
+    if (err != VK_SUCCESS)
+    {
+        fmt::print("Waiting for frame {} failed with error code {}\n", rend.frame_count, magic_enum::enum_name(err));
+        return err;
+    }
+    flush_gpu_profiler(rend.profiler);
+    return VK_SUCCESS;
+}
+
+bool run_scenario(bench_options const &options, bench_scenario const &scenario, std::string &device_name, bench_result &result)
+{
+    result.scenario = scenario;
+
+    init_settings settings{};
+    settings.headless = true;
+    settings.window_width = static_cast<int>(scenario.width);
+    settings.window_height = static_cast<int>(scenario.height);
+    settings.frames_in_flight = options.frames_in_flight;
+    settings.draws_per_recording_slice = options.draws_per_recording_slice;
+    settings.hot_reload_shaders = false;
+    settings.gpu_profiling = true;
+    uint64_t mesh_bytes = uint64_t{scenario.triangle_count} * 3 * (sizeof(mesh_vertex) + sizeof(uint32_t)) + uint64_t{scenario.draw_count} * 16;
+    settings.mesh_pool_size = std::max(settings.mesh_pool_size, mesh_bytes + (uint64_t{1} << 20));
+
+    renderer rend{};
+    if (init_renderer(settings, rend) != 0)
+    {
+        fmt::print("Failed to initialize the renderer for scenario {}\n", scenario.name);
+        return false;
+    }
+    result.startup = rend.startup_timings;
+    VkPhysicalDeviceProperties physical_device_properties{};
+    vkGetPhysicalDeviceProperties(rend.physical_device, &physical_device_properties);
+    device_name = physical_device_properties.deviceName;
+
+    auto stage_start = std::chrono::steady_clock::now();
+    std::vector<mesh> meshes;
+    std::vector<pipeline_handle> pipelines;
+    // One shader specialized differently per pipeline, so each is compiled on its own instead of hitting the cache
+    std::vector<pipeline_create_details> pipeline_details;
+    for (uint32_t i = 0; i < scenario.pipeline_count; i++)
+    {
+        pipeline_details.push_back(pipeline_create_details{pipeline_type::graphics, "single_triangle", i});
+    }
+    bool ok = create_scenario_meshes(rend, scenario, meshes) == VK_SUCCESS && create_ready_pipelines(rend, pipeline_details, pipelines) == VK_SUCCESS;
+    if (ok)
+    {
+        rend.draws.clear();
+        for (uint32_t i = 0; i < scenario.draw_count; i++)
+        {
+            rend.draws.push_back(scene_draw{pipelines.at(i % scenario.pipeline_count), meshes.at(i)});
+        }
+        result.startup.push_back(startup_timing{"scenario", elapsed_ns(stage_start)});
+
+        // Includes submitting the scenario's uploads
+        stage_start = std::chrono::steady_clock::now();
+        ok = render_frame(rend, nullptr) == VK_SUCCESS && finish_frames(rend) == VK_SUCCESS;
+        result.startup.push_back(startup_timing{"first frame", elapsed_ns(stage_start)});
+    }
+
+    for (uint64_t i = 0; ok && i < options.warmup_frames; i++)
+    {
+        ok = render_frame(rend, nullptr) == VK_SUCCESS;
+    }
+    ok = ok && finish_frames(rend) == VK_SUCCESS;
+
+    timing_history cpu_frame_history{};
+    if (ok)
+    {
+        rend.profiler.history.clear();
+        rend.profiler.history_size = static_cast<uint32_t>(std::min<uint64_t>(options.measured_frames, UINT32_MAX));
+        auto measure_start = std::chrono::steady_clock::now();
+        for (uint64_t i = 0; ok && i < options.measured_frames; i++)
+        {
+            ok = render_frame(rend, &cpu_frame_history) == VK_SUCCESS;
+        }
+        // The clock runs until the GPU is done so queued frames aren't counted as free
+        ok = ok && finish_frames(rend) == VK_SUCCESS;
+        result.fps = options.measured_frames / (elapsed_ns(measure_start) / 1e9);
+    }
+    if (ok)
+    {
+        result.cpu_frame = summarize_timings(cpu_frame_history);
+        if (auto it = rend.profiler.history.find("frame"); it != rend.profiler.history.end())
+        {
+            result.gpu_frame = summarize_timings(it->second);
+        }
+        result.transient_mib = rend.transients.peak_bytes / 1048576.0;
+    }
+    shutdown_renderer(rend);
+    return ok;
+}
+
+// Returns false for unknown metrics and for GPU metrics without GPU timings
+bool get_metric(bench_result const &result, std::string_view metric, double &out_value)
+{
+    bool has_gpu = result.gpu_frame.count > 0;
+    if (metric == "fps")
+        out_value = result.fps;
+    else if (metric == "cpu_p50_ms")
+        out_value = result.cpu_frame.p50_ms;
+    else if (metric == "cpu_p95_ms")
+        out_value = result.cpu_frame.p95_ms;
+    else if (metric == "cpu_p99_ms")
+        out_value = result.cpu_frame.p99_ms;
+    else if (metric == "gpu_p50_ms" && has_gpu)
+        out_value = result.gpu_frame.p50_ms;
+    else if (metric == "gpu_p95_ms" && has_gpu)
+        out_value = result.gpu_frame.p95_ms;
+    else if (metric == "gpu_p99_ms" && has_gpu)
+        out_value = result.gpu_frame.p99_ms;
+    else if (metric == "transient_mib")
+        out_value = result.transient_mib;
+    else
+        return false;
+    return true;
+}
+
+bool check_baseline(bench_options const &options, std::vector<bench_result> &results)
+{
+    std::ifstream file(options.baseline_path);
+    if (!file)
+    {
+        fmt::print("Failed to open baseline {}\n", options.baseline_path);
+        return false;
+    }
+    std::string line;
+    for (uint32_t line_number = 1; std::getline(file, line); line_number++)
+    {
+        line = line.substr(0, line.find('#'));
+        std::istringstream fields(line);
+        std::string scenario_name, metric;
+        double baseline = 0.0;
+        if (!(fields >> scenario_name))
+        {
+            continue;
+        }
+        if (!(fields >> metric >> baseline))
+        {
+            fmt::print("{}:{}: expected <scenario> <metric> <value> [max regression]\n", options.baseline_path, line_number);
+            return false;
+        }
+        double threshold = options.threshold;
+        fields >> threshold;
+
+        auto result = std::find_if(results.begin(), results.end(), [&](bench_result const &r) { return r.scenario.name == scenario_name; });
+        double value = 0.0;
+        if (result == results.end())
+        {
+            continue;
+        }
+        if (!get_metric(*result, metric, value))
+        {
+            fmt::print("{}:{}: scenario {} has no metric {}, skipping it\n", options.baseline_path, line_number, scenario_name, metric);
+            continue;
+        }
+        // Frame rate regresses downwards, times upwards
+        bool regressed = metric == "fps" ? value < baseline * (1.0 - threshold) : value > baseline * (1.0 + threshold);
+        if (regressed)
+        {
+            result->regressions.push_back(metric_regression{metric, baseline, value});
+        }
+    }
+    return true;
+}
+
+bool save_baseline(std::string const &path, std::vector<bench_result> const &results)
+{
+    std::ofstream file(path, std::ios::trunc);
+    if (!file)
+    {
+        fmt::print("Failed to write baseline {}\n", path);
+        return false;
+    }
+    file << "# <scenario> <metric> <value> [max regression]\n";
+    for (auto const &result : results)
+    {
+        for (const char *metric : baseline_metrics)
+        {
+            double value = 0.0;
+            if (get_metric(result, metric, value))
+            {
+                file << fmt::format("{} {} {:.6g}\n", result.scenario.name, metric, value);
+            }
+        }
+    }
+    return true;
+}
+
+std::string format_timing_json(timing_summary const &summary)
+{
+    if (summary.count == 0)
+    {
+        return "null";
+    }
+    return fmt::format("{{\"min\":{:.4f},\"avg\":{:.4f},\"p50\":{:.4f},\"p95\":{:.4f},\"p99\":{:.4f},\"max\":{:.4f},\"samples\":{}}}", summary.min_ms,
+                       summary.avg_ms, summary.p50_ms, summary.p95_ms, summary.p99_ms, summary.max_ms, summary.count);
+}
+
+std::string format_results_json(bench_options const &options, std::string_view device_name, std::vector<bench_result> const &results)
+{
+    std::string json = fmt::format("{{\n  \"device\": \"{}\",\n  \"warmup_frames\": {},\n  \"measured_frames\": {},\n  \"frames_in_flight\": {},\n"
+                                   "  \"draws_per_slice\": {},\n  \"scenarios\": [",
+                                   escape_json(device_name), options.warmup_frames, options.measured_frames, options.frames_in_flight,
+                                   options.draws_per_recording_slice);
+    for (size_t i = 0; i < results.size(); i++)
+    {
+        auto const &result = results[i];
+        auto const &scenario = result.scenario;
+        std::string startup;
+        uint64_t startup_total_ns = 0;
+        for (auto const &timing : result.startup)
+        {
+            startup += fmt::format("\"{}\":{:.3f},", escape_json(timing.stage), timing.ns / 1e6);
+            startup_total_ns += timing.ns;
+        }
+        startup += fmt::format("\"total\":{:.3f}", startup_total_ns / 1e6);
+        std::string regressions;
+        for (auto const &regression : result.regressions)
+        {
+            regressions += fmt::format("{}{{\"metric\":\"{}\",\"baseline\":{:.6g},\"value\":{:.6g}}}", regressions.empty() ? "" : ",",
+                                       escape_json(regression.metric), regression.baseline, regression.value);
+        }
+        json += fmt::format("{}\n    {{\n      \"name\": \"{}\",\n      \"draws\": {},\n      \"triangles\": {},\n      \"pipelines\": {},\n"
+                            "      \"width\": {},\n      \"height\": {},\n      \"fps\": {:.2f},\n      \"cpu_frame_ms\": {},\n"
+                            "      \"gpu_frame_ms\": {},\n      \"transient_mib\": {:.2f},\n      \"startup_ms\": {{{}}},\n      \"regressions\": [{}]\n    }}",
+                            i == 0 ? "" : ",", escape_json(scenario.name), scenario.draw_count, scenario.triangle_count, scenario.pipeline_count,
+                            scenario.width, scenario.height, result.fps, format_timing_json(result.cpu_frame), format_timing_json(result.gpu_frame),
+                            result.transient_mib, startup, regressions);
+    }
+    json += "\n  ]\n}\n";
+    return json;
+}
+
+int main(int argc, char **argv)
+{
+    bench_options options{};
+    if (!parse_arguments(argc, argv, options))
+    {
+        return 1;
+    }
+    std::vector<bench_scenario> scenarios;
+    if (options.scenario_file.empty())
+    {
+        scenarios = default_scenarios;
+    }
+    else if (!load_scenarios(options.scenario_file, scenarios))
+    {
+        return 1;
+    }
+    if (!options.scenario_filter.empty())
+    {
+        std::erase_if(scenarios, [&options](bench_scenario const &scenario) {
+            return std::find(options.scenario_filter.begin(), options.scenario_filter.end(), scenario.name) == options.scenario_filter.end();
+        });
+    }
+    if (scenarios.empty())
+    {
+        fmt::print("No scenarios to run\n");
+        return 1;
+    }
+
+    std::string device_name;
+    std::vector<bench_result> results;
+    for (auto const &scenario : scenarios)
+    {
+        if (!validate_scenario(scenario))
+        {
+            return 1;
+        }
+        fmt::print("Running scenario {}\n", scenario.name);
+        bench_result result{};
+        if (!run_scenario(options, scenario, device_name, result))
+        {
+            fmt::print("Scenario {} failed\n", scenario.name);
+            return 1;
+        }
+        results.push_back(std::move(result));
+    }
+
+    if (!options.baseline_path.empty() && !check_baseline(options, results))
+    {
+        return 1;
+    }
+    if (!options.save_baseline_path.empty() && !save_baseline(options.save_baseline_path, results))
+    {
+        return 1;
+    }
+
+    std::string json = format_results_json(options, device_name, results);
+    std::ofstream file(options.output_path, std::ios::trunc);
+    file << json;
+    if (!file)
+    {
+        fmt::print("Failed to write results to {}\n", options.output_path);
+        return 1;
+    }
+    fmt::print("Wrote results to {}\n", options.output_path);
+
+    uint32_t regression_count = 0;
+    for (auto const &result : results)
+    {
+        for (auto const &regression : result.regressions)
+        {
+            fmt::print("Regression in {}: {} is {:.6g}, baseline {:.6g}\n", result.scenario.name, regression.metric, regression.value, regression.baseline);
+            regression_count++;
+        }
+    }
+    return regression_count > 0 ? 2 : 0;
+}
@@ -0,0 +1,62 @@
+# Compiles every shader in SHADER_DIRECTORY with slangc at build time and links the SPIR-V into TARGET as constexpr
+# arrays, see source/embedded_shaders.hpp. slangc writes a depfile so edits to imported modules trigger a rebuild.
+function(embed_shaders TARGET SHADER_DIRECTORY)
+    if (TARGET slang::slangc)
+        set(SLANGC_EXECUTABLE $<TARGET_FILE:slang::slangc>)
+    else()
+        find_program(SLANGC_EXECUTABLE slangc REQUIRED)
+    endif()
+
+    set(generated_directory "${CMAKE_CURRENT_BINARY_DIR}/embedded_shaders")
+    file(GLOB shader_sources CONFIGURE_DEPENDS "${SHADER_DIRECTORY}/*.slang")
+
+    set(embedded_arrays "")
+    set(embedded_entries "")
+    set(generated_sources "")
+    foreach(shader_source IN LISTS shader_sources)
+        get_filename_component(shader_name "${shader_source}" NAME_WE)
+        string(MAKE_C_IDENTIFIER "${shader_name}" shader_identifier)
+        set(spirv_file "${generated_directory}/${shader_name}.spv")
+        set(spirv_include "${generated_directory}/${shader_name}.spv.inc")
+
+        # Must match the flags the runtime compiler uses in shader_compiler.cpp
+        add_custom_command(
+            OUTPUT "${spirv_file}"
+            COMMAND "${SLANGC_EXECUTABLE}" "${shader_source}" -target spirv -profile sm_6_6 -I "${SHADER_DIRECTORY}"
+                    -o "${spirv_file}" -depfile "${spirv_file}.d"
+            DEPENDS "${shader_source}"
+            DEPFILE "${spirv_file}.d"
+            COMMENT "Compiling shader ${shader_name}"
+            VERBATIM
+        )
+        add_custom_command(
+            OUTPUT "${spirv_include}"
+            COMMAND "${CMAKE_COMMAND}" -DINPUT=${spirv_file} -DOUTPUT=${spirv_include} -P "${CMAKE_CURRENT_FUNCTION_LIST_DIR}/embed_spirv.cmake"
+            DEPENDS "${spirv_file}" "${CMAKE_CURRENT_FUNCTION_LIST_DIR}/embed_spirv.cmake"
+            VERBATIM
+        )
+        list(APPEND generated_sources "${spirv_include}")
+        string(APPEND embedded_arrays "constexpr uint32_t ${shader_identifier}_spirv[] = {\n#include \"${shader_name}.spv.inc\"\n};\n")
+        string(APPEND embedded_entries "    embedded_shader{\"${shader_name}\", ${shader_identifier}_spirv},\n")
+    endforeach()
+
+    set(embedded_table "${generated_directory}/embedded_shaders.cpp")
+    file(CONFIGURE OUTPUT "${embedded_table}" CONTENT
+"// Generated by cmake/embed_shaders.cmake
+#include \"embedded_shaders.hpp\"
+
+@embedded_arrays@
+constexpr embedded_shader embedded_shader_table[] = {
+@embedded_entries@};
+
+std::span<const embedded_shader> get_embedded_shaders()
+{
+    return embedded_shader_table;
+}
+" @ONLY)
+    # The table includes the generated arrays, so list them as sources to order the build
+    set_source_files_properties(${generated_sources} PROPERTIES HEADER_FILE_ONLY ON)
+    target_sources(${TARGET} PRIVATE "${embedded_table}" ${generated_sources})
+    target_include_directories(${TARGET} PRIVATE "${generated_directory}" "${CMAKE_CURRENT_SOURCE_DIR}")
+    target_compile_definitions(${TARGET} PUBLIC EMBED_SHADERS)
+endfunction()
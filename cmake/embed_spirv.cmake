@@ -0,0 +1,15 @@
+# Script mode, converts a SPIR-V binary into the body of a uint32_t array initializer
+#   cmake -DINPUT=<file.spv> -DOUTPUT=<file.inc> -P embed_spirv.cmake
+
+file(READ "${INPUT}" spirv_hex HEX)
+string(LENGTH "${spirv_hex}" spirv_hex_length)
+math(EXPR spirv_word_remainder "${spirv_hex_length} % 8")
+if (spirv_hex_length EQUAL 0 OR NOT spirv_word_remainder EQUAL 0)
+    message(FATAL_ERROR "${INPUT} is not a SPIR-V binary")
+endif()
+
+# SPIR-V is little endian, so the bytes of each word are swapped when writing them out as literals
+string(REGEX REPLACE "(..)(..)(..)(..)" "0x\\4\\3\\2\\1, " spirv_words "${spirv_hex}")
+string(REGEX REPLACE "((0x........, ){8})" "\\1\n" spirv_words "${spirv_words}")
+
+file(CONFIGURE OUTPUT "${OUTPUT}" CONTENT "${spirv_words}\n" @ONLY)
@@ -0,0 +1,37 @@
+#include "atomic_file.hpp"
+
+#include <fstream>
+#include <atomic>
+
+#include <unistd.h>
+
+#include <fmt/format.h>
+
+bool write_file_atomically(std::filesystem::path const &path, std::span<const std::byte> contents)
+{
+    static std::atomic<uint32_t> temp_file_counter = 0;
+    std::filesystem::path temp_path = path;
+    temp_path += fmt::format(".{}.{}.tmp", getpid(), temp_file_counter++);
+
+    std::ofstream file(temp_path, std::ios::binary | std::ios::trunc);
+    if (!file.is_open())
+    {
+        return false;
+    }
+    file.write(reinterpret_cast<const char *>(contents.data()), static_cast<std::streamsize>(contents.size()));
+    file.close();
+
+    std::error_code ec;
+    if (file.fail())
+    {
+        std::filesystem::remove(temp_path, ec);
+        return false;
+    }
+    std::filesystem::rename(temp_path, path, ec);
+    if (ec)
+    {
+        std::filesystem::remove(temp_path, ec);
+        return false;
+    }
+    return true;
+}
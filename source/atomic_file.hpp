@@ -0,0 +1,10 @@
+#pragma once
+
+#include <cstddef>
+#include <filesystem>
+#include <span>
+
+// Writes into a file unique to this process and thread, then renames it over path. Renames are atomic, so readers,
+// including other processes sharing the caches, only ever see the old or the new contents. The temporary file is
+// removed again when anything fails.
+bool write_file_atomically(std::filesystem::path const &path, std::span<const std::byte> contents);
@@ -0,0 +1,231 @@
+#include "bindless_heap.hpp"
+
+#include <algorithm>
+
+#include <fmt/format.h>
+#include <magic_enum.hpp>
+
+// Upper bounds on the array sizes, the device limits usually allow far more but every descriptor costs memory
+static constexpr uint32_t max_bindless_images = 16384;
+static constexpr uint32_t max_bindless_samplers = 256;
+static constexpr uint32_t max_bindless_buffers = 16384;
+
+static constexpr VkDescriptorType bindless_descriptor_types[bindless_binding_count] = {
+    VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE,
+    VK_DESCRIPTOR_TYPE_STORAGE_IMAGE,
+    VK_DESCRIPTOR_TYPE_SAMPLER,
+    VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+};
+
+VkResult init_bindless_heap(VkPhysicalDevice physical_device, VkDevice device, bindless_heap &heap)
+{
+    VkPhysicalDeviceVulkan12Properties properties_1_2{
+        .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_2_PROPERTIES,
+    };
+    VkPhysicalDeviceProperties2 properties{
+        .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2,
+        .pNext = &properties_1_2,
+    };
+    vkGetPhysicalDeviceProperties2(physical_device, &properties);
+
+    // The whole set is visible to every stage, so the per stage limits apply to all of it at once
+    heap.capacity[static_cast<uint32_t>(bindless_binding::sampled_images)] = std::min({max_bindless_images,
+        properties_1_2.maxDescriptorSetUpdateAfterBindSampledImages, properties_1_2.maxPerStageDescriptorUpdateAfterBindSampledImages});
+    heap.capacity[static_cast<uint32_t>(bindless_binding::storage_images)] = std::min({max_bindless_images,
+        properties_1_2.maxDescriptorSetUpdateAfterBindStorageImages, properties_1_2.maxPerStageDescriptorUpdateAfterBindStorageImages});
+    heap.capacity[static_cast<uint32_t>(bindless_binding::samplers)] = std::min({max_bindless_samplers,
+        properties_1_2.maxDescriptorSetUpdateAfterBindSamplers, properties_1_2.maxPerStageDescriptorUpdateAfterBindSamplers});
+    heap.capacity[static_cast<uint32_t>(bindless_binding::storage_buffers)] = std::min({max_bindless_buffers,
+        properties_1_2.maxDescriptorSetUpdateAfterBindStorageBuffers, properties_1_2.maxPerStageDescriptorUpdateAfterBindStorageBuffers});
+
+    uint32_t total_descriptors = 0;
+    for (uint32_t capacity : heap.capacity)
+        total_descriptors += capacity;
+    if (total_descriptors > properties_1_2.maxPerStageUpdateAfterBindResources)
+    {
+        // Scale everything down evenly to fit within the overall per stage limit
+        for (uint32_t &capacity : heap.capacity)
+            capacity = static_cast<uint32_t>(static_cast<uint64_t>(capacity) * properties_1_2.maxPerStageUpdateAfterBindResources / total_descriptors);
+    }
+
+    std::vector<VkDescriptorSetLayoutBinding> bindings;
+    std::vector<VkDescriptorBindingFlags> binding_flags;
+    std::vector<VkDescriptorPoolSize> pool_sizes;
+    for (uint32_t i = 0; i < bindless_binding_count; i++)
+    {
+        bindings.push_back(VkDescriptorSetLayoutBinding{
+            .binding = i,
+            .descriptorType = bindless_descriptor_types[i],
+            .descriptorCount = heap.capacity[i],
+            .stageFlags = VK_SHADER_STAGE_ALL,
+        });
+        binding_flags.push_back(VK_DESCRIPTOR_BINDING_UPDATE_AFTER_BIND_BIT | VK_DESCRIPTOR_BINDING_UPDATE_UNUSED_WHILE_PENDING_BIT |
+                                VK_DESCRIPTOR_BINDING_PARTIALLY_BOUND_BIT);
+        pool_sizes.push_back(VkDescriptorPoolSize{
+            .type = bindless_descriptor_types[i],
+            .descriptorCount = heap.capacity[i],
+        });
+    }
+
+    VkDescriptorSetLayoutBindingFlagsCreateInfo binding_flags_create_info{
+        .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_BINDING_FLAGS_CREATE_INFO,
+        .bindingCount = static_cast<uint32_t>(binding_flags.size()),
+        .pBindingFlags = binding_flags.data(),
+    };
+    VkDescriptorSetLayoutCreateInfo descriptor_set_layout_create_info{
+        .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO,
+        .pNext = &binding_flags_create_info,
+        .flags = VK_DESCRIPTOR_SET_LAYOUT_CREATE_UPDATE_AFTER_BIND_POOL_BIT,
+        .bindingCount = static_cast<uint32_t>(bindings.size()),
+        .pBindings = bindings.data(),
+    };
+    VkResult err = vkCreateDescriptorSetLayout(device, &descriptor_set_layout_create_info, nullptr, &heap.layout);
+    if (err != VK_SUCCESS)
+    {
+        fmt::print("Failed to create bindless descriptor set layout with error code {}", magic_enum::enum_name(err));
+        return VK_ERROR_INITIALIZATION_FAILED;
+    }
+
+    VkDescriptorPoolCreateInfo descriptor_pool_create_info{
+        .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO,
+        .flags = VK_DESCRIPTOR_POOL_CREATE_UPDATE_AFTER_BIND_BIT,
+        .maxSets = 1,
+        .poolSizeCount = static_cast<uint32_t>(pool_sizes.size()),
+        .pPoolSizes = pool_sizes.data(),
+    };
+    err = vkCreateDescriptorPool(device, &descriptor_pool_create_info, nullptr, &heap.pool);
+    if (err != VK_SUCCESS)
+    {
+        fmt::print("Failed to create bindless descriptor pool with error code {}", magic_enum::enum_name(err));
+        return VK_ERROR_INITIALIZATION_FAILED;
+    }
+
+    VkDescriptorSetAllocateInfo descriptor_set_allocate_info{
+        .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO,
+        .descriptorPool = heap.pool,
+        .descriptorSetCount = 1,
+        .pSetLayouts = &heap.layout,
+    };
+    err = vkAllocateDescriptorSets(device, &descriptor_set_allocate_info, &heap.set);
+    if (err != VK_SUCCESS)
+    {
+        fmt::print("Failed to allocate bindless descriptor set with error code {}", magic_enum::enum_name(err));
+        return VK_ERROR_INITIALIZATION_FAILED;
+    }
+
+    VkSamplerCreateInfo sampler_create_info{
+        .sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO,
+        .magFilter = VK_FILTER_LINEAR,
+        .minFilter = VK_FILTER_LINEAR,
+        .mipmapMode = VK_SAMPLER_MIPMAP_MODE_LINEAR,
+        .addressModeU = VK_SAMPLER_ADDRESS_MODE_REPEAT,
+        .addressModeV = VK_SAMPLER_ADDRESS_MODE_REPEAT,
+        .addressModeW = VK_SAMPLER_ADDRESS_MODE_REPEAT,
+        .maxLod = VK_LOD_CLAMP_NONE,
+    };
+    err = vkCreateSampler(device, &sampler_create_info, nullptr, &heap.default_sampler);
+    if (err != VK_SUCCESS)
+    {
+        fmt::print("Failed to create default sampler with error code {}", magic_enum::enum_name(err));
+        return VK_ERROR_INITIALIZATION_FAILED;
+    }
+    bindless_add_sampler(device, heap, heap.default_sampler);
+
+    fmt::print("Bindless heap: {} sampled images, {} storage images, {} samplers, {} storage buffers\n", heap.capacity[0], heap.capacity[1],
+               heap.capacity[2], heap.capacity[3]);
+    return VK_SUCCESS;
+}
+
+uint32_t allocate_bindless_index(bindless_heap &heap, bindless_binding binding)
+{
+    uint32_t b = static_cast<uint32_t>(binding);
+    if (!heap.free_indices[b].empty())
+    {
+        uint32_t index = heap.free_indices[b].back();
+        heap.free_indices[b].pop_back();
+        return index;
+    }
+    if (heap.next_index[b] >= heap.capacity[b])
+    {
+        fmt::print("The bindless {} array is full\n", magic_enum::enum_name(binding));
+        return invalid_bindless_index;
+    }
+    return heap.next_index[b]++;
+}
+
+uint32_t write_bindless_descriptor(VkDevice device, bindless_heap &heap, bindless_binding binding, VkDescriptorImageInfo const *image_info,
+                                   VkDescriptorBufferInfo const *buffer_info)
+{
+    // Held across the write too, two writes into the same set may not happen at the same time
+    std::lock_guard lock(heap.mutex);
+    uint32_t index = allocate_bindless_index(heap, binding);
+    if (index == invalid_bindless_index)
+    {
+        return index;
+    }
+    VkWriteDescriptorSet write_descriptor_set{
+        .sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+        .dstSet = heap.set,
+        .dstBinding = static_cast<uint32_t>(binding),
+        .dstArrayElement = index,
+        .descriptorCount = 1,
+        .descriptorType = bindless_descriptor_types[static_cast<uint32_t>(binding)],
+        .pImageInfo = image_info,
+        .pBufferInfo = buffer_info,
+    };
+    vkUpdateDescriptorSets(device, 1, &write_descriptor_set, 0, nullptr);
+    return index;
+}
+
+uint32_t bindless_add_sampled_image(VkDevice device, bindless_heap &heap, VkImageView image_view, VkImageLayout layout)
+{
+    VkDescriptorImageInfo image_info{.imageView = image_view, .imageLayout = layout};
+    return write_bindless_descriptor(device, heap, bindless_binding::sampled_images, &image_info, nullptr);
+}
+
+uint32_t bindless_add_storage_image(VkDevice device, bindless_heap &heap, VkImageView image_view)
+{
+    VkDescriptorImageInfo image_info{.imageView = image_view, .imageLayout = VK_IMAGE_LAYOUT_GENERAL};
+    return write_bindless_descriptor(device, heap, bindless_binding::storage_images, &image_info, nullptr);
+}
+
+uint32_t bindless_add_sampler(VkDevice device, bindless_heap &heap, VkSampler sampler)
+{
+    VkDescriptorImageInfo image_info{.sampler = sampler};
+    return write_bindless_descriptor(device, heap, bindless_binding::samplers, &image_info, nullptr);
+}
+
+uint32_t bindless_add_storage_buffer(VkDevice device, bindless_heap &heap, VkBuffer buffer, VkDeviceSize offset, VkDeviceSize range)
+{
+    VkDescriptorBufferInfo buffer_info{.buffer = buffer, .offset = offset, .range = range};
+    return write_bindless_descriptor(device, heap, bindless_binding::storage_buffers, nullptr, &buffer_info);
+}
+
+void bindless_release(bindless_heap &heap, bindless_binding binding, uint32_t index, uint64_t timeline_value)
+{
+    if (index == invalid_bindless_index)
+    {
+        return;
+    }
+    // Partially bound arrays may keep the stale descriptor, it is only read if a shader still uses the index
+    std::lock_guard lock(heap.mutex);
+    heap.pending_releases.push_back({binding, index, timeline_value});
+}
+
+void bindless_recycle_indices(bindless_heap &heap, uint64_t completed_value)
+{
+    std::lock_guard lock(heap.mutex);
+    std::erase_if(heap.pending_releases, [&heap, completed_value](bindless_heap::pending_release const &release) {
+        if (release.timeline_value > completed_value)
+            return false;
+        heap.free_indices[static_cast<uint32_t>(release.binding)].push_back(release.index);
+        return true;
+    });
+}
+
+void destroy_bindless_heap(VkDevice device, bindless_heap &heap)
+{
+    vkDestroySampler(device, heap.default_sampler, nullptr);
+    vkDestroyDescriptorPool(device, heap.pool, nullptr);
+    vkDestroyDescriptorSetLayout(device, heap.layout, nullptr);
+}
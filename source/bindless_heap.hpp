@@ -0,0 +1,59 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+#include <mutex>
+
+#include <vulkan/vulkan_core.h>
+
+// Binding numbers of the global descriptor set, data/shaders/common/bindless.slang declares the same arrays
+enum class bindless_binding : uint32_t
+{
+    sampled_images = 0,
+    storage_images = 1,
+    samplers = 2,
+    storage_buffers = 3,
+};
+constexpr uint32_t bindless_binding_count = 4;
+
+// Every shader sees the same set 0 holding one large partially bound array per descriptor type. Resources are written
+// into it once when they are created and shaders find them through indices passed in push constants, so nothing is
+// bound or updated per draw. Update after bind lets new resources be added while earlier frames are still in flight.
+struct bindless_heap
+{
+    VkDescriptorSetLayout layout{};
+    VkDescriptorPool pool{};
+    VkDescriptorSet set{};
+    VkSampler default_sampler{}; // Always at index 0 of the sampler array
+
+    std::mutex mutex;
+    uint32_t capacity[bindless_binding_count] = {};
+    uint32_t next_index[bindless_binding_count] = {};
+    std::vector<uint32_t> free_indices[bindless_binding_count];
+
+    struct pending_release
+    {
+        bindless_binding binding;
+        uint32_t index;
+        uint64_t timeline_value;
+    };
+    std::vector<pending_release> pending_releases;
+};
+
+constexpr uint32_t invalid_bindless_index = UINT32_MAX;
+
+VkResult init_bindless_heap(VkPhysicalDevice physical_device, VkDevice device, bindless_heap &heap);
+
+// Each returns the index the resource keeps until it is released, or invalid_bindless_index when the array is full.
+// Safe to call from multiple threads.
+uint32_t bindless_add_sampled_image(VkDevice device, bindless_heap &heap, VkImageView image_view, VkImageLayout layout);
+uint32_t bindless_add_storage_image(VkDevice device, bindless_heap &heap, VkImageView image_view);
+uint32_t bindless_add_sampler(VkDevice device, bindless_heap &heap, VkSampler sampler);
+uint32_t bindless_add_storage_buffer(VkDevice device, bindless_heap &heap, VkBuffer buffer, VkDeviceSize offset, VkDeviceSize range);
+
+// The index is handed out again once the frame timeline reaches timeline_value, normally the value of the frame that
+// last used the resource
+void bindless_release(bindless_heap &heap, bindless_binding binding, uint32_t index, uint64_t timeline_value);
+void bindless_recycle_indices(bindless_heap &heap, uint64_t completed_value);
+
+void destroy_bindless_heap(VkDevice device, bindless_heap &heap);
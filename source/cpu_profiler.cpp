@@ -0,0 +1,177 @@
+#include "cpu_profiler.hpp"
+
+#if defined(CPU_PROFILER)
+
+#include <atomic>
+#include <algorithm>
+#include <array>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include <fmt/format.h>
+
+#include "profiling.hpp"
+
+// Enough for several frames of scopes, collecting once per frame never lets a ring wrap in practice
+static constexpr uint64_t ring_size = 1 << 14;
+static constexpr uint32_t history_window = 1024;
+
+// The fields are relaxed atomics so the collector can read a slot the owner is overwriting without a data race, it
+// throws the torn copy away afterwards
+struct cpu_event
+{
+    std::atomic<const char *> name{nullptr};
+    std::atomic<uint64_t> start_ns{0};
+    std::atomic<uint64_t> end_ns{0};
+};
+
+struct cpu_thread_ring
+{
+    uint32_t tid = 0;
+    std::string name;
+    bool name_written = false;
+    std::array<cpu_event, ring_size> events;
+    std::atomic<uint64_t> written{0}; // Only stored by the owning thread
+    uint64_t read = 0;                // Only touched by the collector
+};
+
+struct cpu_profiler_state
+{
+    // Taken when a thread records its first scope and while collecting, never on the recording path
+    std::mutex mutex;
+    std::vector<std::shared_ptr<cpu_thread_ring>> threads; // Rings outlive their threads until shutdown
+    std::map<std::string, timing_history, std::less<>> history;
+    chrome_trace trace;
+    uint64_t origin_ns = 0;
+    uint64_t dropped_events = 0;
+};
+
+static cpu_profiler_state state;
+
+std::shared_ptr<cpu_thread_ring> register_cpu_thread()
+{
+    auto ring = std::make_shared<cpu_thread_ring>();
+    std::lock_guard lock(state.mutex);
+    ring->tid = static_cast<uint32_t>(state.threads.size()) + 1;
+    ring->name = fmt::format("thread {}", ring->tid);
+    state.threads.push_back(ring);
+    return ring;
+}
+
+cpu_thread_ring &local_cpu_ring()
+{
+    thread_local std::shared_ptr<cpu_thread_ring> ring = register_cpu_thread();
+    return *ring;
+}
+
+void record_cpu_scope(const char *name, uint64_t start_ns, uint64_t end_ns)
+{
+    auto &ring = local_cpu_ring();
+    uint64_t index = ring.written.load(std::memory_order_relaxed);
+    auto &event = ring.events[index & (ring_size - 1)];
+    event.name.store(name, std::memory_order_relaxed);
+    event.start_ns.store(start_ns, std::memory_order_relaxed);
+    event.end_ns.store(end_ns, std::memory_order_relaxed);
+    ring.written.store(index + 1, std::memory_order_release);
+}
+
+void init_cpu_profiler(std::filesystem::path const &trace_path)
+{
+    std::lock_guard lock(state.mutex);
+    state.origin_ns = cpu_profiler_now_ns();
+    if (!trace_path.empty())
+    {
+        open_chrome_trace(state.trace, trace_path, "CPU", 0);
+    }
+}
+
+void set_cpu_profiler_thread_name(std::string_view name)
+{
+    auto &ring = local_cpu_ring();
+    std::lock_guard lock(state.mutex);
+    ring.name = name;
+    ring.name_written = false;
+}
+
+void collect_cpu_profile()
+{
+    struct copied_event
+    {
+        const char *name;
+        uint64_t start_ns;
+        uint64_t end_ns;
+    };
+    std::vector<copied_event> events;
+
+    std::lock_guard lock(state.mutex);
+    for (auto &ring : state.threads)
+    {
+        if (!ring->name_written)
+        {
+            write_trace_thread_name(state.trace, ring->tid, ring->name);
+            ring->name_written = true;
+        }
+
+        uint64_t written = ring->written.load(std::memory_order_acquire);
+        uint64_t first = std::max(ring->read, written > ring_size ? written - ring_size : 0);
+        state.dropped_events += first - ring->read;
+        events.clear();
+        for (uint64_t i = first; i < written; i++)
+        {
+            auto const &event = ring->events[i & (ring_size - 1)];
+            events.push_back({event.name.load(std::memory_order_relaxed), event.start_ns.load(std::memory_order_relaxed),
+                              event.end_ns.load(std::memory_order_relaxed)});
+        }
+        ring->read = written;
+
+        // Slots the owner reached again while they were copied are torn
+        std::atomic_thread_fence(std::memory_order_acquire);
+        uint64_t written_after = ring->written.load(std::memory_order_relaxed);
+        uint64_t valid_from = written_after > ring_size ? written_after - ring_size : 0;
+        for (uint64_t i = first; i < written; i++)
+        {
+            if (i < valid_from)
+            {
+                state.dropped_events++;
+                continue;
+            }
+            auto const &event = events[i - first];
+            double duration_ms = (event.end_ns - event.start_ns) / 1e6;
+            auto it = state.history.find(std::string_view(event.name));
+            if (it == state.history.end())
+            {
+                it = state.history.emplace(event.name, timing_history{}).first;
+            }
+            add_timing_sample(it->second, history_window, duration_ms);
+            double start_us = (static_cast<double>(event.start_ns) - static_cast<double>(state.origin_ns)) / 1e3;
+            write_trace_event(state.trace, event.name, "cpu", ring->tid, start_us, duration_ms * 1e3);
+        }
+    }
+}
+
+void print_cpu_profiler_stats()
+{
+    std::lock_guard lock(state.mutex);
+    fmt::print("CPU scopes in ms, percentiles over at most the last {} samples:\n", history_window);
+    for (auto const &[name, history] : state.history)
+    {
+        fmt::print("  {:<24} {}\n", name, format_timing_summary(history));
+    }
+    if (state.dropped_events > 0)
+    {
+        fmt::print("  {} events dropped by full rings\n", state.dropped_events);
+    }
+}
+
+void shutdown_cpu_profiler()
+{
+    collect_cpu_profile();
+    std::lock_guard lock(state.mutex);
+    close_chrome_trace(state.trace);
+    state.threads.clear();
+}
+
+#endif
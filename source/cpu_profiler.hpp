@@ -0,0 +1,77 @@
+#pragma once
+
+#include <cstdint>
+#include <string_view>
+#include <filesystem>
+
+// Scoped timers for the CPU side of the render loop. A scope records its name and start and end times into a ring
+// buffer owned by the calling thread, which only that thread writes to, so recording takes no locks.
+// collect_cpu_profile drains every thread's ring into per-name timings and an optional Chrome trace, once per frame
+// keeps the rings from wrapping. Builds without CPU_PROFILER, set by the ENABLE_CPU_PROFILER CMake option, compile all
+// of it away. Names must be string literals since only the pointer is kept.
+
+#if defined(CPU_PROFILER)
+
+#include <chrono>
+
+inline uint64_t cpu_profiler_now_ns()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+void record_cpu_scope(const char *name, uint64_t start_ns, uint64_t end_ns);
+
+struct cpu_scope
+{
+    const char *name;
+    uint64_t start_ns;
+
+    explicit cpu_scope(const char *name) : name(name), start_ns(cpu_profiler_now_ns()) {}
+    ~cpu_scope() { end(); }
+    cpu_scope(cpu_scope const &) = delete;
+    cpu_scope &operator=(cpu_scope const &) = delete;
+
+    // Ends the scope before the end of the block, for stages that don't line up with one
+    void end()
+    {
+        if (name != nullptr)
+        {
+            record_cpu_scope(name, start_ns, cpu_profiler_now_ns());
+            name = nullptr;
+        }
+    }
+};
+
+#define CPU_PROFILER_CONCAT_INNER(a, b) a##b
+#define CPU_PROFILER_CONCAT(a, b) CPU_PROFILER_CONCAT_INNER(a, b)
+#define CPU_SCOPE(name) cpu_scope CPU_PROFILER_CONCAT(cpu_scope_, __LINE__)(name)
+#define CPU_SCOPE_NAMED(variable, name) cpu_scope variable(name)
+#define CPU_SCOPE_END(variable) variable.end()
+
+// An empty trace_path writes no trace
+void init_cpu_profiler(std::filesystem::path const &trace_path);
+
+// Shown in the trace instead of a thread number
+void set_cpu_profiler_thread_name(std::string_view name);
+
+void collect_cpu_profile();
+
+// Timings of each scope name, percentiles over its recent samples
+void print_cpu_profiler_stats();
+
+// Collects what is left and closes the trace
+void shutdown_cpu_profiler();
+
+#else
+
+#define CPU_SCOPE(name) ((void)0)
+#define CPU_SCOPE_NAMED(variable, name) ((void)0)
+#define CPU_SCOPE_END(variable) ((void)0)
+
+inline void init_cpu_profiler(std::filesystem::path const &) {}
+inline void set_cpu_profiler_thread_name(std::string_view) {}
+inline void collect_cpu_profile() {}
+inline void print_cpu_profiler_stats() {}
+inline void shutdown_cpu_profiler() {}
+
+#endif
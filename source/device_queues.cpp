@@ -0,0 +1,185 @@
+#include "device_queues.hpp"
+
+#include <vector>
+
+#include <fmt/format.h>
+#include <magic_enum.hpp>
+
+VkResult init_gpu_queue(VkDevice device, uint32_t family_index, uint32_t queue_index, gpu_queue &queue)
+{
+    queue.device = device;
+    queue.family_index = family_index;
+    queue.submitted_value = 0;
+    vkGetDeviceQueue(device, family_index, queue_index, &queue.queue);
+
+    VkSemaphoreTypeCreateInfo semaphore_type_create_info{
+        .sType = VK_STRUCTURE_TYPE_SEMAPHORE_TYPE_CREATE_INFO,
+        .semaphoreType = VK_SEMAPHORE_TYPE_TIMELINE,
+        .initialValue = 0,
+    };
+    VkSemaphoreCreateInfo semaphore_create_info{
+        .sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO,
+        .pNext = &semaphore_type_create_info,
+    };
+    VkResult err = vkCreateSemaphore(device, &semaphore_create_info, nullptr, &queue.timeline);
+    if (err != VK_SUCCESS)
+    {
+        fmt::print("Failed to create timeline semaphore for queue family {} with error code {}\n", family_index, magic_enum::enum_name(err));
+        return VK_ERROR_INITIALIZATION_FAILED;
+    }
+    return VK_SUCCESS;
+}
+
+VkResult submit_to_queue(gpu_queue &queue, std::span<const VkCommandBuffer> command_buffers, std::span<const VkSemaphoreSubmitInfo> waits,
+                         std::span<const VkSemaphoreSubmitInfo> signals, uint64_t &out_value)
+{
+    std::vector<VkCommandBufferSubmitInfo> command_buffer_submit_infos;
+    command_buffer_submit_infos.reserve(command_buffers.size());
+    for (VkCommandBuffer command_buffer : command_buffers)
+    {
+        command_buffer_submit_infos.push_back(VkCommandBufferSubmitInfo{
+            .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_SUBMIT_INFO,
+            .commandBuffer = command_buffer,
+        });
+    }
+
+    uint64_t value = queue.submitted_value + 1;
+    std::vector<VkSemaphoreSubmitInfo> signal_semaphore_infos(signals.begin(), signals.end());
+    signal_semaphore_infos.push_back(VkSemaphoreSubmitInfo{
+        .sType = VK_STRUCTURE_TYPE_SEMAPHORE_SUBMIT_INFO,
+        .semaphore = queue.timeline,
+        .value = value,
+        .stageMask = VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT,
+    });
+
+    VkSubmitInfo2 submit_info{
+        .sType = VK_STRUCTURE_TYPE_SUBMIT_INFO_2,
+        .waitSemaphoreInfoCount = static_cast<uint32_t>(waits.size()),
+        .pWaitSemaphoreInfos = waits.data(),
+        .commandBufferInfoCount = static_cast<uint32_t>(command_buffer_submit_infos.size()),
+        .pCommandBufferInfos = command_buffer_submit_infos.data(),
+        .signalSemaphoreInfoCount = static_cast<uint32_t>(signal_semaphore_infos.size()),
+        .pSignalSemaphoreInfos = signal_semaphore_infos.data(),
+    };
+    VkResult err = vkQueueSubmit2(queue.queue, 1, &submit_info, VK_NULL_HANDLE);
+    if (err != VK_SUCCESS)
+    {
+        fmt::print("Failed to submit to queue family {} with error code {}\n", queue.family_index, magic_enum::enum_name(err));
+        return err;
+    }
+    queue.submitted_value = value;
+    out_value = value;
+    return VK_SUCCESS;
+}
+
+VkSemaphoreSubmitInfo queue_wait_info(gpu_queue const &queue, uint64_t value, VkPipelineStageFlags2 stage)
+{
+    return VkSemaphoreSubmitInfo{
+        .sType = VK_STRUCTURE_TYPE_SEMAPHORE_SUBMIT_INFO,
+        .semaphore = queue.timeline,
+        .value = value,
+        .stageMask = stage,
+    };
+}
+
+uint64_t completed_queue_value(gpu_queue const &queue)
+{
+    uint64_t value = 0;
+    vkGetSemaphoreCounterValue(queue.device, queue.timeline, &value);
+    return value;
+}
+
+VkResult wait_for_queue_value(gpu_queue const &queue, uint64_t value, uint64_t timeout)
+{
+    VkSemaphoreWaitInfo semaphore_wait_info{
+        .sType = VK_STRUCTURE_TYPE_SEMAPHORE_WAIT_INFO,
+        .semaphoreCount = 1,
+        .pSemaphores = &queue.timeline,
+        .pValues = &value,
+    };
+    VkResult err = vkWaitSemaphores(queue.device, &semaphore_wait_info, timeout);
+    if (err != VK_SUCCESS && err != VK_TIMEOUT)
+    {
+        fmt::print("Failed to wait on queue family {} with error code {}\n", queue.family_index, magic_enum::enum_name(err));
+    }
+    return err;
+}
+
+void destroy_gpu_queue(gpu_queue &queue)
+{
+    if (queue.timeline != VK_NULL_HANDLE)
+    {
+        vkDestroySemaphore(queue.device, queue.timeline, nullptr);
+    }
+    queue = gpu_queue{};
+}
+
+bool needs_ownership_transfer(queue_usage const &src, queue_usage const &dst)
+{
+    return src.family_index != dst.family_index;
+}
+
+buffer_ownership_transfer transfer_buffer_ownership(VkBuffer buffer, VkDeviceSize offset, VkDeviceSize size, queue_usage const &src,
+                                                    queue_usage const &dst)
+{
+    buffer_ownership_transfer transfer{};
+    transfer.release = VkBufferMemoryBarrier2{
+        .sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER_2,
+        .srcStageMask = src.stage_mask,
+        .srcAccessMask = src.access_mask,
+        .dstStageMask = dst.stage_mask,
+        .dstAccessMask = dst.access_mask,
+        .srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+        .dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+        .buffer = buffer,
+        .offset = offset,
+        .size = size,
+    };
+    if (needs_ownership_transfer(src, dst))
+    {
+        // The destination scope of a release and the source scope of an acquire are ignored, the semaphore wait
+        // between them orders the two
+        transfer.release.dstStageMask = VK_PIPELINE_STAGE_2_NONE;
+        transfer.release.dstAccessMask = VK_ACCESS_2_NONE;
+        transfer.release.srcQueueFamilyIndex = src.family_index;
+        transfer.release.dstQueueFamilyIndex = dst.family_index;
+        transfer.acquire = transfer.release;
+        transfer.acquire.srcStageMask = VK_PIPELINE_STAGE_2_NONE;
+        transfer.acquire.srcAccessMask = VK_ACCESS_2_NONE;
+        transfer.acquire.dstStageMask = dst.stage_mask;
+        transfer.acquire.dstAccessMask = dst.access_mask;
+    }
+    return transfer;
+}
+
+image_ownership_transfer transfer_image_ownership(VkImage image, VkImageSubresourceRange const &subresource_range, VkImageLayout old_layout,
+                                                  VkImageLayout new_layout, queue_usage const &src, queue_usage const &dst)
+{
+    image_ownership_transfer transfer{};
+    transfer.release = VkImageMemoryBarrier2{
+        .sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER_2,
+        .srcStageMask = src.stage_mask,
+        .srcAccessMask = src.access_mask,
+        .dstStageMask = dst.stage_mask,
+        .dstAccessMask = dst.access_mask,
+        .oldLayout = old_layout,
+        .newLayout = new_layout,
+        .srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+        .dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+        .image = image,
+        .subresourceRange = subresource_range,
+    };
+    if (needs_ownership_transfer(src, dst))
+    {
+        transfer.release.dstStageMask = VK_PIPELINE_STAGE_2_NONE;
+        transfer.release.dstAccessMask = VK_ACCESS_2_NONE;
+        transfer.release.srcQueueFamilyIndex = src.family_index;
+        transfer.release.dstQueueFamilyIndex = dst.family_index;
+        transfer.acquire = transfer.release;
+        transfer.acquire.srcStageMask = VK_PIPELINE_STAGE_2_NONE;
+        transfer.acquire.srcAccessMask = VK_ACCESS_2_NONE;
+        transfer.acquire.dstStageMask = dst.stage_mask;
+        transfer.acquire.dstAccessMask = dst.access_mask;
+    }
+    return transfer;
+}
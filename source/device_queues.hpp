@@ -0,0 +1,76 @@
+#pragma once
+
+#include <cstdint>
+#include <span>
+
+#include <vulkan/vulkan_core.h>
+
+// Families the renderer creates its queues on. Roles without a dedicated family share the family, and the VkQueue, of
+// the role they fall back to.
+struct queue_family_selection
+{
+    uint32_t graphics = 0; // Graphics, compute, and presentation when there is a window
+    uint32_t compute = 0;  // A compute family without graphics when there is one, otherwise graphics
+    uint32_t transfer = 0; // A transfer-only family when there is one, otherwise compute
+    VkExtent3D transfer_granularity{1, 1, 1}; // minImageTransferGranularity of the transfer family
+};
+
+// A queue and the timeline semaphore every submission to it signals. Work on another queue that consumes its results
+// waits on the timeline for the value of the submission that produced them, so queues only synchronize where one
+// actually depends on the other. Not thread safe, submitting to a VkQueue needs external synchronization anyway.
+struct gpu_queue
+{
+    VkDevice device{};
+    VkQueue queue{};
+    uint32_t family_index = 0;
+    VkSemaphore timeline{};
+    uint64_t submitted_value = 0;
+};
+
+VkResult init_gpu_queue(VkDevice device, uint32_t family_index, uint32_t queue_index, gpu_queue &queue);
+
+// Runs command_buffers after waits and signals the next value of the queue's timeline along with signals. out_value
+// is the value that signals once the submission has completed.
+VkResult submit_to_queue(gpu_queue &queue, std::span<const VkCommandBuffer> command_buffers, std::span<const VkSemaphoreSubmitInfo> waits,
+                         std::span<const VkSemaphoreSubmitInfo> signals, uint64_t &out_value);
+
+// For a submission on another queue that uses the results of value from stage on
+VkSemaphoreSubmitInfo queue_wait_info(gpu_queue const &queue, uint64_t value, VkPipelineStageFlags2 stage);
+
+uint64_t completed_queue_value(gpu_queue const &queue);
+VkResult wait_for_queue_value(gpu_queue const &queue, uint64_t value, uint64_t timeout);
+
+void destroy_gpu_queue(gpu_queue &queue);
+
+// Where a resource is last used before changing queues, or first used after
+struct queue_usage
+{
+    uint32_t family_index = 0;
+    VkPipelineStageFlags2 stage_mask = VK_PIPELINE_STAGE_2_NONE;
+    VkAccessFlags2 access_mask = VK_ACCESS_2_NONE;
+};
+
+// Exclusive resources belong to one queue family at a time. Moving one to another family takes the release barrier
+// recorded on the source queue and the matching acquire barrier recorded on the destination queue, in a submission
+// that waits on the source queue's timeline. Within one family no transfer is needed, release is then an ordinary
+// barrier from src to dst and acquire is left empty.
+struct buffer_ownership_transfer
+{
+    VkBufferMemoryBarrier2 release{};
+    VkBufferMemoryBarrier2 acquire{};
+};
+
+struct image_ownership_transfer
+{
+    VkImageMemoryBarrier2 release{};
+    VkImageMemoryBarrier2 acquire{};
+};
+
+bool needs_ownership_transfer(queue_usage const &src, queue_usage const &dst);
+
+buffer_ownership_transfer transfer_buffer_ownership(VkBuffer buffer, VkDeviceSize offset, VkDeviceSize size, queue_usage const &src,
+                                                    queue_usage const &dst);
+
+// The layout transition happens once, between the release and the acquire
+image_ownership_transfer transfer_image_ownership(VkImage image, VkImageSubresourceRange const &subresource_range, VkImageLayout old_layout,
+                                                  VkImageLayout new_layout, queue_usage const &src, queue_usage const &dst);
@@ -0,0 +1,14 @@
+#pragma once
+
+#include <cstdint>
+#include <span>
+#include <string_view>
+
+struct embedded_shader
+{
+    std::string_view name;
+    std::span<const uint32_t> spirv;
+};
+
+// Every shader in data/shaders compiled at build time, only linked in when EMBED_SHADERS is enabled
+std::span<const embedded_shader> get_embedded_shaders();
@@ -0,0 +1,143 @@
+#include "frame_pacer.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <thread>
+
+#include <fmt/format.h>
+
+// Weight of the newest sample in the running averages
+static constexpr double smoothing = 0.1;
+static constexpr double initial_margin_ns = 1e6;
+static constexpr double min_margin_ns = 0.25e6;
+static constexpr double max_margin_ns = 8e6;
+static constexpr uint64_t present_wait_timeout_ns = 100'000'000;
+
+double smooth(double average, double sample)
+{
+    return average == 0.0 ? sample : average + (sample - average) * smoothing;
+}
+
+uint64_t nanoseconds_between(std::chrono::steady_clock::time_point start, std::chrono::steady_clock::time_point end)
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count();
+}
+
+void init_frame_pacer(VkDevice device, bool present_wait, frame_pacer &pacer)
+{
+    pacer = frame_pacer{};
+    pacer.margin_ns = initial_margin_ns;
+    if (present_wait)
+    {
+        // Device extension commands aren't exported by the loader
+        pacer.wait_for_present = reinterpret_cast<PFN_vkWaitForPresentKHR>(vkGetDeviceProcAddr(device, "vkWaitForPresentKHR"));
+    }
+}
+
+void pace_frame(frame_pacer &pacer, VkDevice device, VkSwapchainKHR swapchain)
+{
+    auto now = std::chrono::steady_clock::now();
+    double sleep_ns = 0.0;
+    if (pacer.wait_for_present != nullptr)
+    {
+        // Waiting for the previous frame keeps at most one present queued, and the moment the wait returns is the
+        // vblank that frame was shown at
+        VkResult err = VK_NOT_READY;
+        if (pacer.waitable_present_id != 0 && swapchain != VK_NULL_HANDLE)
+        {
+            err = pacer.wait_for_present(device, swapchain, pacer.waitable_present_id, present_wait_timeout_ns);
+            now = std::chrono::steady_clock::now();
+        }
+        if (err == VK_SUCCESS)
+        {
+            if (pacer.last_present_time != std::chrono::steady_clock::time_point{})
+            {
+                double interval_ns = static_cast<double>(nanoseconds_between(pacer.last_present_time, now));
+                if (pacer.present_interval_ns > 0.0)
+                {
+                    // Taking several refresh intervals means the present missed its vblank, back off
+                    double intervals = std::max(1.0, std::round(interval_ns / pacer.present_interval_ns));
+                    if (intervals > 1.0)
+                    {
+                        pacer.missed_presents++;
+                        pacer.margin_ns = std::min(pacer.margin_ns * 2.0, max_margin_ns);
+                    }
+                    else
+                    {
+                        pacer.margin_ns = std::max(pacer.margin_ns * 0.98, min_margin_ns);
+                    }
+                    interval_ns /= intervals;
+                }
+                pacer.present_interval_ns = smooth(pacer.present_interval_ns, interval_ns);
+            }
+            pacer.last_present_time = now;
+            sleep_ns = pacer.present_interval_ns - pacer.work_ns - pacer.margin_ns;
+        }
+    }
+    else
+    {
+        // The display paces the frames either way, so sleeping off the time the last frames spent blocked after
+        // sampling input leaves the frame rate alone and moves the sampling closer to the present
+        if (pacer.slept_ns > 0 && static_cast<double>(pacer.blocked_ns) < pacer.margin_ns / 2.0)
+        {
+            // Barely blocked after sleeping, the sleep may have cost a frame
+            pacer.margin_ns = std::min(pacer.margin_ns * 2.0, max_margin_ns);
+        }
+        else
+        {
+            pacer.margin_ns = std::max(pacer.margin_ns * 0.98, min_margin_ns);
+        }
+        pacer.slack_ns = smooth(pacer.slack_ns, static_cast<double>(pacer.slept_ns + pacer.blocked_ns));
+        sleep_ns = pacer.slack_ns - pacer.margin_ns;
+    }
+
+    pacer.slept_ns = 0;
+    if (sleep_ns > 0.0)
+    {
+        pacer.slept_ns = static_cast<uint64_t>(sleep_ns);
+        pacer.total_sleep_ns += pacer.slept_ns;
+        std::this_thread::sleep_until(now + std::chrono::nanoseconds(pacer.slept_ns));
+    }
+    pacer.blocked_ns = 0;
+    pacer.input_time = std::chrono::steady_clock::now();
+}
+
+void add_blocked_time(frame_pacer &pacer, uint64_t blocked_ns)
+{
+    pacer.blocked_ns += blocked_ns;
+}
+
+uint64_t next_present_id(frame_pacer &pacer)
+{
+    pacer.present_id++;
+    pacer.waitable_present_id = pacer.present_id;
+    return pacer.present_id;
+}
+
+void reset_present_wait(frame_pacer &pacer)
+{
+    pacer.waitable_present_id = 0;
+    pacer.last_present_time = {};
+}
+
+void end_paced_frame(frame_pacer &pacer)
+{
+    uint64_t elapsed_ns = nanoseconds_between(pacer.input_time, std::chrono::steady_clock::now());
+    pacer.work_ns = smooth(pacer.work_ns, static_cast<double>(elapsed_ns > pacer.blocked_ns ? elapsed_ns - pacer.blocked_ns : 0));
+    pacer.frame_count++;
+}
+
+void print_frame_pacer_stats(frame_pacer const &pacer)
+{
+    fmt::print("Frame pacing ({}): {} frames, {:.2f} ms work per frame, {:.2f} ms average sleep before input",
+               pacer.wait_for_present != nullptr ? "present wait" : "CPU timing", pacer.frame_count, pacer.work_ns / 1e6,
+               pacer.frame_count > 0 ? pacer.total_sleep_ns / 1e6 / pacer.frame_count : 0.0);
+    if (pacer.wait_for_present != nullptr)
+    {
+        fmt::print(", {:.2f} ms refresh interval, {} missed presents\n", pacer.present_interval_ns / 1e6, pacer.missed_presents);
+    }
+    else
+    {
+        fmt::print("\n");
+    }
+}
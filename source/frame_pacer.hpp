@@ -0,0 +1,52 @@
+#pragma once
+
+#include <cstdint>
+#include <chrono>
+
+#include <vulkan/vulkan_core.h>
+
+// Delays input sampling and recording until just before the latest point the frame can start and still make the next
+// present. With VK_KHR_present_wait the pacer waits for the previous frame to reach the display, which gives an exact
+// vblank timestamp to schedule from. Without it, the time a frame spent blocked on the GPU or the swapchain after
+// sampling input is moved in front of the input sampling instead, where it doesn't add latency.
+struct frame_pacer
+{
+    PFN_vkWaitForPresentKHR wait_for_present = nullptr; // Null when present wait isn't enabled
+    uint64_t present_id = 0;                            // Last id handed to vkQueuePresentKHR, 0 before the first present
+    uint64_t waitable_present_id = 0;                   // Last id presented to the current swapchain, 0 right after a recreation
+
+    // Smoothed over recent frames, in nanoseconds
+    double present_interval_ns = 0.0; // Between presents reaching the display
+    double work_ns = 0.0;             // From sampling input to the present call returning, minus time spent blocked
+    double margin_ns = 0.0;           // Grows when a present misses its vblank, decays otherwise
+    double slack_ns = 0.0;            // CPU model only, sleep plus blocked time of recent frames
+
+    std::chrono::steady_clock::time_point last_present_time{};
+    std::chrono::steady_clock::time_point input_time{};
+    uint64_t slept_ns = 0;
+    uint64_t blocked_ns = 0; // Reported by render() for the current frame
+
+    uint64_t frame_count = 0;
+    uint64_t missed_presents = 0;
+    uint64_t total_sleep_ns = 0;
+};
+
+// present_wait is true when VK_KHR_present_id and VK_KHR_present_wait were both enabled on device
+void init_frame_pacer(VkDevice device, bool present_wait, frame_pacer &pacer);
+
+// Call right before polling input. Sleeps until the predicted start of the frame.
+void pace_frame(frame_pacer &pacer, VkDevice device, VkSwapchainKHR swapchain);
+
+// Time render() spent waiting on the GPU or in vkAcquireNextImageKHR after input was sampled
+void add_blocked_time(frame_pacer &pacer, uint64_t blocked_ns);
+
+// The id to chain into the next present through VkPresentIdKHR
+uint64_t next_present_id(frame_pacer &pacer);
+
+// Present ids only mean something to the swapchain they were presented to
+void reset_present_wait(frame_pacer &pacer);
+
+// Call once the frame has been presented
+void end_paced_frame(frame_pacer &pacer);
+
+void print_frame_pacer_stats(frame_pacer const &pacer);
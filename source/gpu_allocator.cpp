@@ -0,0 +1,600 @@
+#include "gpu_allocator.hpp"
+
+#include <algorithm>
+
+#include <fmt/format.h>
+#include <magic_enum.hpp>
+
+// Smallest range the buddy allocator hands out. Also covers nonCoherentAtomSize, which the spec caps at 256.
+static constexpr VkDeviceSize min_allocation_size = 256;
+static constexpr VkDeviceSize max_block_size = VkDeviceSize{256} << 20;
+
+uint32_t order_for_size(VkDeviceSize size)
+{
+    uint32_t order = 0;
+    while ((min_allocation_size << order) < size)
+        order++;
+    return order;
+}
+
+VkDeviceSize align_up(VkDeviceSize value, VkDeviceSize alignment)
+{
+    return (value + alignment - 1) / alignment * alignment;
+}
+
+bool is_host_visible(gpu_allocator const &allocator, uint32_t memory_type_index)
+{
+    return (allocator.memory_properties.memoryTypes[memory_type_index].propertyFlags & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT) != 0;
+}
+
+VkResult init_gpu_allocator(VkPhysicalDevice physical_device, VkDevice device, bool buffer_device_address, gpu_allocator &allocator)
+{
+    allocator.device = device;
+    allocator.buffer_device_address = buffer_device_address;
+    vkGetPhysicalDeviceMemoryProperties(physical_device, &allocator.memory_properties);
+
+    VkPhysicalDeviceProperties properties{};
+    vkGetPhysicalDeviceProperties(physical_device, &properties);
+    allocator.buffer_image_granularity = properties.limits.bufferImageGranularity;
+    allocator.max_memory_allocation_count = properties.limits.maxMemoryAllocationCount;
+
+    // Small heaps, like the 256 MiB host visible device local heap without resizable BAR, get proportionally smaller
+    // blocks so a single block can't exhaust them
+    for (uint32_t i = 0; i < allocator.memory_properties.memoryHeapCount; i++)
+    {
+        VkDeviceSize block_size = max_block_size;
+        while (block_size > min_allocation_size && block_size > allocator.memory_properties.memoryHeaps[i].size / 8)
+            block_size /= 2;
+        allocator.heap_block_sizes[i] = block_size;
+    }
+    return VK_SUCCESS;
+}
+
+VkResult find_memory_type(gpu_allocator const &allocator, uint32_t memory_type_bits, VkMemoryPropertyFlags required_flags,
+                          VkMemoryPropertyFlags preferred_flags, uint32_t &out_memory_type_index)
+{
+    for (VkMemoryPropertyFlags flags : {required_flags | preferred_flags, required_flags})
+    {
+        for (uint32_t i = 0; i < allocator.memory_properties.memoryTypeCount; i++)
+        {
+            if ((memory_type_bits & (1u << i)) != 0 && (allocator.memory_properties.memoryTypes[i].propertyFlags & flags) == flags)
+            {
+                out_memory_type_index = i;
+                return VK_SUCCESS;
+            }
+        }
+    }
+    return VK_ERROR_FEATURE_NOT_PRESENT;
+}
+
+VkResult allocate_device_memory(gpu_allocator &allocator, VkDeviceSize size, uint32_t memory_type_index, void const *pNext, VkDeviceMemory &out_memory,
+                                void *&out_mapped)
+{
+    if (allocator.device_memory_count >= allocator.max_memory_allocation_count)
+    {
+        fmt::print("Reached maxMemoryAllocationCount of {}\n", allocator.max_memory_allocation_count);
+        return VK_ERROR_TOO_MANY_OBJECTS;
+    }
+    VkMemoryAllocateInfo memory_allocate_info{
+        .sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO,
+        .pNext = pNext,
+        .allocationSize = size,
+        .memoryTypeIndex = memory_type_index,
+    };
+    VkResult err = vkAllocateMemory(allocator.device, &memory_allocate_info, nullptr, &out_memory);
+    if (err != VK_SUCCESS)
+    {
+        return err;
+    }
+    out_mapped = nullptr;
+    if (is_host_visible(allocator, memory_type_index))
+    {
+        err = vkMapMemory(allocator.device, out_memory, 0, VK_WHOLE_SIZE, 0, &out_mapped);
+        if (err != VK_SUCCESS)
+        {
+            vkFreeMemory(allocator.device, out_memory, nullptr);
+            out_memory = VK_NULL_HANDLE;
+            return err;
+        }
+    }
+    allocator.device_memory_count++;
+    return VK_SUCCESS;
+}
+
+void free_device_memory(gpu_allocator &allocator, VkDeviceMemory memory)
+{
+    // Freeing implicitly unmaps
+    vkFreeMemory(allocator.device, memory, nullptr);
+    allocator.device_memory_count--;
+}
+
+bool buddy_allocate(gpu_memory_block &block, uint32_t order, VkDeviceSize &out_offset)
+{
+    uint32_t available_order = order;
+    while (available_order < block.free_offsets.size() && block.free_offsets.at(available_order).empty())
+        available_order++;
+    if (available_order >= block.free_offsets.size())
+        return false;
+
+    auto &free_offsets = block.free_offsets.at(available_order);
+    VkDeviceSize offset = *free_offsets.begin();
+    free_offsets.erase(free_offsets.begin());
+    // Split down to the requested size, keeping the lower half and freeing the upper one at each step
+    while (available_order > order)
+    {
+        available_order--;
+        block.free_offsets.at(available_order).insert(offset + (min_allocation_size << available_order));
+    }
+    out_offset = offset;
+    return true;
+}
+
+void buddy_free(gpu_memory_block &block, VkDeviceSize offset, uint32_t order)
+{
+    while (order + 1 < block.free_offsets.size())
+    {
+        VkDeviceSize buddy = offset ^ (min_allocation_size << order);
+        auto &free_offsets = block.free_offsets.at(order);
+        auto it = free_offsets.find(buddy);
+        if (it == free_offsets.end())
+            break;
+        free_offsets.erase(it);
+        offset = std::min(offset, buddy);
+        order++;
+    }
+    block.free_offsets.at(order).insert(offset);
+}
+
+VkResult create_memory_block(gpu_allocator &allocator, uint32_t memory_type_index, gpu_resource_kind kind, uint32_t &out_block_index)
+{
+    uint32_t heap_index = allocator.memory_properties.memoryTypes[memory_type_index].heapIndex;
+    gpu_memory_block block{
+        .size = allocator.heap_block_sizes[heap_index],
+        .memory_type_index = memory_type_index,
+        .kind = kind,
+    };
+    // Any buffer can land in a linear block, so they all need to support vkGetBufferDeviceAddress
+    VkMemoryAllocateFlagsInfo memory_allocate_flags_info{
+        .sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_FLAGS_INFO,
+        .flags = VK_MEMORY_ALLOCATE_DEVICE_ADDRESS_BIT,
+    };
+    bool device_address = allocator.buffer_device_address && kind == gpu_resource_kind::linear;
+    VkResult err = allocate_device_memory(allocator, block.size, memory_type_index, device_address ? &memory_allocate_flags_info : nullptr, block.memory,
+                                          block.mapped);
+    if (err != VK_SUCCESS)
+    {
+        return err;
+    }
+    block.free_offsets.resize(order_for_size(block.size) + 1);
+    block.free_offsets.back().insert(0);
+
+    auto hole = std::find_if(allocator.blocks.begin(), allocator.blocks.end(), [](gpu_memory_block const &b) { return b.memory == VK_NULL_HANDLE; });
+    if (hole != allocator.blocks.end())
+    {
+        *hole = std::move(block);
+        out_block_index = static_cast<uint32_t>(hole - allocator.blocks.begin());
+    }
+    else
+    {
+        allocator.blocks.push_back(std::move(block));
+        out_block_index = static_cast<uint32_t>(allocator.blocks.size() - 1);
+    }
+    return VK_SUCCESS;
+}
+
+VkResult allocate_memory(gpu_allocator &allocator, VkMemoryRequirements const &requirements, VkMemoryDedicatedRequirements const &dedicated_requirements,
+                         VkMemoryDedicatedAllocateInfo const &dedicated_allocate_info, gpu_resource_kind kind, gpu_memory_request const &request,
+                         gpu_allocation &out_allocation)
+{
+    uint32_t memory_type_index = 0;
+    if (find_memory_type(allocator, requirements.memoryTypeBits, request.required_flags, request.preferred_flags, memory_type_index) != VK_SUCCESS)
+    {
+        fmt::print("No memory type with flags {:#x} fits memory type bits {:#x}\n", request.required_flags, requirements.memoryTypeBits);
+        return VK_ERROR_FEATURE_NOT_PRESENT;
+    }
+
+    std::lock_guard lock(allocator.mutex);
+    uint32_t heap_index = allocator.memory_properties.memoryTypes[memory_type_index].heapIndex;
+    // The buddy range has to cover the alignment as well, blocks of small heaps can be too small for either
+    bool dedicated = request.dedicated || dedicated_requirements.prefersDedicatedAllocation || dedicated_requirements.requiresDedicatedAllocation ||
+                     std::max(requirements.size, requirements.alignment) > allocator.heap_block_sizes[heap_index] / 2;
+    if (dedicated)
+    {
+        bool driver_dedicated = dedicated_requirements.prefersDedicatedAllocation || dedicated_requirements.requiresDedicatedAllocation;
+        VkMemoryAllocateFlagsInfo memory_allocate_flags_info{
+            .sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_FLAGS_INFO,
+            .flags = VK_MEMORY_ALLOCATE_DEVICE_ADDRESS_BIT,
+        };
+        VkMemoryDedicatedAllocateInfo chained_dedicated_allocate_info = dedicated_allocate_info;
+        void const *pNext = nullptr;
+        // Like blocks, only linear memory can hold buffers and needs a device address, transient and lazily allocated
+        // image memory is optimal
+        if (allocator.buffer_device_address && kind == gpu_resource_kind::linear && dedicated_allocate_info.image == VK_NULL_HANDLE)
+        {
+            pNext = &memory_allocate_flags_info;
+        }
+        if (driver_dedicated)
+        {
+            chained_dedicated_allocate_info.pNext = pNext;
+            pNext = &chained_dedicated_allocate_info;
+        }
+        out_allocation = gpu_allocation{.size = requirements.size, .memory_type_index = memory_type_index};
+        VkResult err = allocate_device_memory(allocator, requirements.size, memory_type_index, pNext, out_allocation.memory, out_allocation.mapped);
+        if (err != VK_SUCCESS)
+        {
+            fmt::print("Failed to allocate {} bytes of dedicated memory with error code {}\n", requirements.size, magic_enum::enum_name(err));
+            return err;
+        }
+        allocator.dedicated_count++;
+        allocator.dedicated_bytes += requirements.size;
+        return VK_SUCCESS;
+    }
+
+    // Ranges are at least min_allocation_size apart, finer granularity than that can't cause linear and optimal
+    // resources to share a page
+    if (allocator.buffer_image_granularity <= min_allocation_size)
+    {
+        kind = gpu_resource_kind::linear;
+    }
+    uint32_t order = order_for_size(std::max(requirements.size, requirements.alignment));
+    VkDeviceSize offset = 0;
+    uint32_t block_index = UINT32_MAX;
+    for (uint32_t i = 0; i < allocator.blocks.size(); i++)
+    {
+        auto &block = allocator.blocks.at(i);
+        if (block.memory != VK_NULL_HANDLE && block.memory_type_index == memory_type_index && block.kind == kind && buddy_allocate(block, order, offset))
+        {
+            block_index = i;
+            break;
+        }
+    }
+    if (block_index == UINT32_MAX)
+    {
+        VkResult err = create_memory_block(allocator, memory_type_index, kind, block_index);
+        if (err != VK_SUCCESS)
+        {
+            fmt::print("Failed to allocate a memory block with error code {}\n", magic_enum::enum_name(err));
+            return err;
+        }
+        if (!buddy_allocate(allocator.blocks.at(block_index), order, offset))
+        {
+            fmt::print("{} bytes aligned to {} don't fit in a new memory block\n", requirements.size, requirements.alignment);
+            free_device_memory(allocator, allocator.blocks.at(block_index).memory);
+            allocator.blocks.at(block_index) = gpu_memory_block{};
+            return VK_ERROR_OUT_OF_DEVICE_MEMORY;
+        }
+    }
+
+    auto &block = allocator.blocks.at(block_index);
+    block.used += min_allocation_size << order;
+    block.requested += requirements.size;
+    block.allocation_count++;
+    out_allocation = gpu_allocation{
+        .memory = block.memory,
+        .offset = offset,
+        .size = requirements.size,
+        .mapped = block.mapped != nullptr ? static_cast<char *>(block.mapped) + offset : nullptr,
+        .memory_type_index = memory_type_index,
+        .block_index = block_index,
+        .order = order,
+    };
+    return VK_SUCCESS;
+}
+
+void free_allocation(gpu_allocator &allocator, gpu_allocation &allocation)
+{
+    if (allocation.memory == VK_NULL_HANDLE)
+    {
+        return;
+    }
+    std::lock_guard lock(allocator.mutex);
+    if (allocation.block_index == UINT32_MAX)
+    {
+        free_device_memory(allocator, allocation.memory);
+        allocator.dedicated_count--;
+        allocator.dedicated_bytes -= allocation.size;
+    }
+    else
+    {
+        auto &block = allocator.blocks.at(allocation.block_index);
+        buddy_free(block, allocation.offset, allocation.order);
+        block.used -= min_allocation_size << allocation.order;
+        block.requested -= allocation.size;
+        block.allocation_count--;
+
+        // Keep one empty block per memory type and kind around so a resource that is recreated every so often doesn't
+        // allocate and free a whole block each time
+        if (block.allocation_count == 0)
+        {
+            bool has_other_block = std::any_of(allocator.blocks.begin(), allocator.blocks.end(), [&block](gpu_memory_block const &other) {
+                return &other != &block && other.memory != VK_NULL_HANDLE && other.memory_type_index == block.memory_type_index && other.kind == block.kind;
+            });
+            if (has_other_block)
+            {
+                free_device_memory(allocator, block.memory);
+                block = gpu_memory_block{};
+            }
+        }
+    }
+    allocation = gpu_allocation{};
+}
+
+VkResult allocate_gpu_memory(gpu_allocator &allocator, VkMemoryRequirements const &requirements, gpu_resource_kind kind, gpu_memory_request const &request,
+                             gpu_allocation &out_allocation)
+{
+    VkMemoryDedicatedRequirements dedicated_requirements{
+        .sType = VK_STRUCTURE_TYPE_MEMORY_DEDICATED_REQUIREMENTS,
+    };
+    VkMemoryDedicatedAllocateInfo dedicated_allocate_info{
+        .sType = VK_STRUCTURE_TYPE_MEMORY_DEDICATED_ALLOCATE_INFO,
+    };
+    return allocate_memory(allocator, requirements, dedicated_requirements, dedicated_allocate_info, kind, request, out_allocation);
+}
+
+void free_gpu_memory(gpu_allocator &allocator, gpu_allocation &allocation)
+{
+    free_allocation(allocator, allocation);
+}
+
+VkResult create_buffer(gpu_allocator &allocator, VkBufferCreateInfo const &create_info, gpu_memory_request const &request, VkBuffer &out_buffer,
+                       gpu_allocation &out_allocation)
+{
+    VkResult err = vkCreateBuffer(allocator.device, &create_info, nullptr, &out_buffer);
+    if (err != VK_SUCCESS)
+    {
+        fmt::print("Failed to create buffer with error code {}\n", magic_enum::enum_name(err));
+        return err;
+    }
+
+    VkBufferMemoryRequirementsInfo2 requirements_info{
+        .sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_REQUIREMENTS_INFO_2,
+        .buffer = out_buffer,
+    };
+    VkMemoryDedicatedRequirements dedicated_requirements{
+        .sType = VK_STRUCTURE_TYPE_MEMORY_DEDICATED_REQUIREMENTS,
+    };
+    VkMemoryRequirements2 requirements{
+        .sType = VK_STRUCTURE_TYPE_MEMORY_REQUIREMENTS_2,
+        .pNext = &dedicated_requirements,
+    };
+    vkGetBufferMemoryRequirements2(allocator.device, &requirements_info, &requirements);
+    VkMemoryDedicatedAllocateInfo dedicated_allocate_info{
+        .sType = VK_STRUCTURE_TYPE_MEMORY_DEDICATED_ALLOCATE_INFO,
+        .buffer = out_buffer,
+    };
+
+    err = allocate_memory(allocator, requirements.memoryRequirements, dedicated_requirements, dedicated_allocate_info, gpu_resource_kind::linear, request,
+                          out_allocation);
+    if (err == VK_SUCCESS)
+    {
+        err = vkBindBufferMemory(allocator.device, out_buffer, out_allocation.memory, out_allocation.offset);
+        if (err != VK_SUCCESS)
+        {
+            fmt::print("Failed to bind buffer memory with error code {}\n", magic_enum::enum_name(err));
+            free_allocation(allocator, out_allocation);
+        }
+    }
+    if (err != VK_SUCCESS)
+    {
+        vkDestroyBuffer(allocator.device, out_buffer, nullptr);
+        out_buffer = VK_NULL_HANDLE;
+    }
+    return err;
+}
+
+VkResult create_image(gpu_allocator &allocator, VkImageCreateInfo const &create_info, gpu_memory_request const &request, VkImage &out_image,
+                      gpu_allocation &out_allocation)
+{
+    VkResult err = vkCreateImage(allocator.device, &create_info, nullptr, &out_image);
+    if (err != VK_SUCCESS)
+    {
+        fmt::print("Failed to create image with error code {}\n", magic_enum::enum_name(err));
+        return err;
+    }
+
+    VkImageMemoryRequirementsInfo2 requirements_info{
+        .sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_REQUIREMENTS_INFO_2,
+        .image = out_image,
+    };
+    VkMemoryDedicatedRequirements dedicated_requirements{
+        .sType = VK_STRUCTURE_TYPE_MEMORY_DEDICATED_REQUIREMENTS,
+    };
+    VkMemoryRequirements2 requirements{
+        .sType = VK_STRUCTURE_TYPE_MEMORY_REQUIREMENTS_2,
+        .pNext = &dedicated_requirements,
+    };
+    vkGetImageMemoryRequirements2(allocator.device, &requirements_info, &requirements);
+    VkMemoryDedicatedAllocateInfo dedicated_allocate_info{
+        .sType = VK_STRUCTURE_TYPE_MEMORY_DEDICATED_ALLOCATE_INFO,
+        .image = out_image,
+    };
+
+    gpu_resource_kind kind = create_info.tiling == VK_IMAGE_TILING_LINEAR ? gpu_resource_kind::linear : gpu_resource_kind::optimal;
+    err = allocate_memory(allocator, requirements.memoryRequirements, dedicated_requirements, dedicated_allocate_info, kind, request, out_allocation);
+    if (err == VK_SUCCESS)
+    {
+        err = vkBindImageMemory(allocator.device, out_image, out_allocation.memory, out_allocation.offset);
+        if (err != VK_SUCCESS)
+        {
+            fmt::print("Failed to bind image memory with error code {}\n", magic_enum::enum_name(err));
+            free_allocation(allocator, out_allocation);
+        }
+    }
+    if (err != VK_SUCCESS)
+    {
+        vkDestroyImage(allocator.device, out_image, nullptr);
+        out_image = VK_NULL_HANDLE;
+    }
+    return err;
+}
+
+void destroy_buffer(gpu_allocator &allocator, VkBuffer buffer, gpu_allocation &allocation)
+{
+    vkDestroyBuffer(allocator.device, buffer, nullptr);
+    free_allocation(allocator, allocation);
+}
+
+void destroy_image(gpu_allocator &allocator, VkImage image, gpu_allocation &allocation)
+{
+    vkDestroyImage(allocator.device, image, nullptr);
+    free_allocation(allocator, allocation);
+}
+
+VkResult flush_allocation(gpu_allocator &allocator, gpu_allocation const &allocation, VkDeviceSize offset, VkDeviceSize size)
+{
+    if (allocator.memory_properties.memoryTypes[allocation.memory_type_index].propertyFlags & VK_MEMORY_PROPERTY_HOST_COHERENT_BIT)
+    {
+        return VK_SUCCESS;
+    }
+    // Ranges must be multiples of nonCoherentAtomSize, which min_allocation_size always is. Rounding out to it stays
+    // inside the allocation's own range of the block, and a dedicated allocation ending early flushes to the end.
+    VkDeviceSize begin = (allocation.offset + offset) / min_allocation_size * min_allocation_size;
+    VkDeviceSize end = align_up(allocation.offset + offset + size, min_allocation_size);
+    VkMappedMemoryRange range{
+        .sType = VK_STRUCTURE_TYPE_MAPPED_MEMORY_RANGE,
+        .memory = allocation.memory,
+        .offset = begin,
+        .size = allocation.block_index == UINT32_MAX && end > allocation.size ? VK_WHOLE_SIZE : end - begin,
+    };
+    return vkFlushMappedMemoryRanges(allocator.device, 1, &range);
+}
+
+gpu_allocator_stats get_gpu_allocator_stats(gpu_allocator &allocator)
+{
+    std::lock_guard lock(allocator.mutex);
+    gpu_allocator_stats stats{
+        .dedicated_count = allocator.dedicated_count,
+        .dedicated_bytes = allocator.dedicated_bytes,
+        .device_memory_count = allocator.device_memory_count,
+    };
+    VkDeviceSize total_free = 0;
+    double weighted_fragmentation = 0.0;
+    for (auto const &block : allocator.blocks)
+    {
+        if (block.memory == VK_NULL_HANDLE)
+            continue;
+        stats.block_count++;
+        stats.block_bytes += block.size;
+        stats.used_bytes += block.used;
+        stats.requested_bytes += block.requested;
+        stats.allocation_count += block.allocation_count;
+
+        VkDeviceSize free_bytes = block.size - block.used;
+        VkDeviceSize largest_free = 0;
+        for (uint32_t order = 0; order < block.free_offsets.size(); order++)
+        {
+            if (!block.free_offsets.at(order).empty())
+                largest_free = min_allocation_size << order;
+        }
+        if (free_bytes > 0)
+        {
+            weighted_fragmentation += (1.0 - static_cast<double>(largest_free) / free_bytes) * free_bytes;
+            total_free += free_bytes;
+        }
+    }
+    stats.allocation_count += allocator.dedicated_count;
+    stats.fragmentation = total_free > 0 ? weighted_fragmentation / total_free : 0.0;
+    return stats;
+}
+
+void print_gpu_allocator_stats(gpu_allocator &allocator)
+{
+    gpu_allocator_stats stats = get_gpu_allocator_stats(allocator);
+    fmt::print("GPU memory: {} allocations, {} blocks holding {:.2f} of {:.2f} MiB ({:.2f} MiB requested), {} dedicated using {:.2f} MiB, "
+               "{} of {} device memory allocations, {:.1f}% fragmented\n",
+               stats.allocation_count, stats.block_count, stats.used_bytes / 1048576.0, stats.block_bytes / 1048576.0,
+               stats.requested_bytes / 1048576.0, stats.dedicated_count, stats.dedicated_bytes / 1048576.0, stats.device_memory_count,
+               allocator.max_memory_allocation_count, stats.fragmentation * 100.0);
+}
+
+void destroy_gpu_allocator(gpu_allocator &allocator)
+{
+    std::lock_guard lock(allocator.mutex);
+    for (auto &block : allocator.blocks)
+    {
+        if (block.memory == VK_NULL_HANDLE)
+            continue;
+        if (block.allocation_count != 0)
+        {
+            fmt::print("Destroying a memory block with {} allocations still alive\n", block.allocation_count);
+        }
+        free_device_memory(allocator, block.memory);
+    }
+    allocator.blocks.clear();
+}
+
+VkResult create_ring_buffer(gpu_allocator &allocator, VkDeviceSize capacity, VkBufferUsageFlags usage, gpu_memory_request const &request,
+                            gpu_ring_buffer &ring)
+{
+    VkBufferCreateInfo buffer_create_info{
+        .sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO,
+        .size = capacity,
+        .usage = usage,
+        .sharingMode = VK_SHARING_MODE_EXCLUSIVE,
+    };
+    gpu_memory_request host_visible_request = request;
+    host_visible_request.required_flags |= VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT;
+    VkResult err = create_buffer(allocator, buffer_create_info, host_visible_request, ring.buffer, ring.allocation);
+    if (err != VK_SUCCESS)
+    {
+        return err;
+    }
+    ring.capacity = capacity;
+    ring_reset(ring);
+    return VK_SUCCESS;
+}
+
+bool ring_allocate(gpu_ring_buffer &ring, VkDeviceSize size, VkDeviceSize alignment, gpu_ring_allocation &out_allocation)
+{
+    if (size > ring.capacity)
+    {
+        return false;
+    }
+    VkDeviceSize head = ring.head;
+    VkDeviceSize offset = align_up(head % ring.capacity, std::max<VkDeviceSize>(alignment, 1));
+    if (offset + size > ring.capacity)
+    {
+        // Doesn't fit before the end, skip the remainder and start over at the front
+        head += ring.capacity - head % ring.capacity;
+        offset = 0;
+    }
+    VkDeviceSize new_head = head - head % ring.capacity + offset + size;
+    if (new_head - ring.tail > ring.capacity)
+    {
+        return false;
+    }
+    ring.head = new_head;
+    out_allocation = gpu_ring_allocation{
+        .buffer = ring.buffer,
+        .offset = offset,
+        .mapped = static_cast<char *>(ring.allocation.mapped) + offset,
+    };
+    return true;
+}
+
+void ring_end_frame(gpu_ring_buffer &ring, uint64_t frame)
+{
+    ring.frame_ends.push_back({frame, ring.head});
+}
+
+void ring_release_frames(gpu_ring_buffer &ring, uint64_t completed_frame)
+{
+    while (!ring.frame_ends.empty() && ring.frame_ends.front().frame <= completed_frame)
+    {
+        ring.tail = ring.frame_ends.front().head;
+        ring.frame_ends.pop_front();
+    }
+}
+
+void ring_reset(gpu_ring_buffer &ring)
+{
+    ring.head = 0;
+    ring.tail = 0;
+    ring.frame_ends.clear();
+}
+
+void destroy_ring_buffer(gpu_allocator &allocator, gpu_ring_buffer &ring)
+{
+    destroy_buffer(allocator, ring.buffer, ring.allocation);
+    ring = gpu_ring_buffer{};
+}
@@ -0,0 +1,156 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+#include <set>
+#include <deque>
+#include <mutex>
+
+#include <vulkan/vulkan_core.h>
+
+// Buffers and linearly tiled images never share a block with optimally tiled images, so neighbouring allocations never
+// need bufferImageGranularity padding between them
+enum class gpu_resource_kind
+{
+    linear,
+    optimal,
+};
+
+struct gpu_memory_request
+{
+    VkMemoryPropertyFlags required_flags = 0;
+    VkMemoryPropertyFlags preferred_flags = 0; // Used when some memory type has them, ignored otherwise
+    bool dedicated = false;                    // Drivers can also ask for one through VkMemoryDedicatedRequirements
+};
+
+struct gpu_allocation
+{
+    VkDeviceMemory memory{};
+    VkDeviceSize offset = 0;
+    VkDeviceSize size = 0;
+    void *mapped = nullptr; // Host visible memory stays mapped for its whole lifetime, already offset to this allocation
+    uint32_t memory_type_index = 0;
+    uint32_t block_index = UINT32_MAX; // UINT32_MAX for dedicated allocations
+    uint32_t order = 0;
+};
+
+// A single VkDeviceMemory split up by a buddy allocator. Ranges are powers of two of min_allocation_size, aligned to
+// their own size, so any alignment up to the range size comes for free and neighbours coalesce in O(log n).
+struct gpu_memory_block
+{
+    VkDeviceMemory memory{};
+    VkDeviceSize size = 0;
+    void *mapped = nullptr;
+    uint32_t memory_type_index = 0;
+    gpu_resource_kind kind = gpu_resource_kind::linear;
+
+    // free_offsets[order] holds the offsets of the free ranges of min_allocation_size << order bytes
+    std::vector<std::set<VkDeviceSize>> free_offsets;
+    VkDeviceSize used = 0;      // Sum of the rounded up range sizes
+    VkDeviceSize requested = 0; // Sum of the sizes asked for, the gap to used is lost to rounding
+    uint32_t allocation_count = 0;
+};
+
+struct gpu_allocator_stats
+{
+    uint32_t block_count = 0;
+    VkDeviceSize block_bytes = 0;
+    VkDeviceSize used_bytes = 0;
+    VkDeviceSize requested_bytes = 0;
+    uint32_t allocation_count = 0;
+    uint32_t dedicated_count = 0;
+    VkDeviceSize dedicated_bytes = 0;
+    uint32_t device_memory_count = 0; // Live vkAllocateMemory calls, bounded by maxMemoryAllocationCount
+    double fragmentation = 0.0;       // 1 - largest free range / total free, averaged over blocks weighted by free bytes
+};
+
+struct gpu_allocator
+{
+    VkDevice device{};
+    VkPhysicalDeviceMemoryProperties memory_properties{};
+    VkDeviceSize buffer_image_granularity = 1;
+    uint32_t max_memory_allocation_count = 0;
+    VkDeviceSize heap_block_sizes[VK_MAX_MEMORY_HEAPS] = {};
+    bool buffer_device_address = false; // Memory that buffers can be bound to is allocated with DEVICE_ADDRESS
+
+    std::mutex mutex;
+    std::vector<gpu_memory_block> blocks; // Blocks released when they empty out leave a hole that is reused
+    uint32_t device_memory_count = 0;
+    uint32_t dedicated_count = 0;
+    VkDeviceSize dedicated_bytes = 0;
+};
+
+// buffer_device_address must match the bufferDeviceAddress feature the device was created with
+VkResult init_gpu_allocator(VkPhysicalDevice physical_device, VkDevice device, bool buffer_device_address, gpu_allocator &allocator);
+
+// Returns the first memory type allowed by memory_type_bits that has required_flags, preferring ones that also have
+// preferred_flags
+VkResult find_memory_type(gpu_allocator const &allocator, uint32_t memory_type_bits, VkMemoryPropertyFlags required_flags,
+                          VkMemoryPropertyFlags preferred_flags, uint32_t &out_memory_type_index);
+
+// Create the resource, allocate memory for it, and bind the two together. Safe to call from multiple threads.
+VkResult create_buffer(gpu_allocator &allocator, VkBufferCreateInfo const &create_info, gpu_memory_request const &request, VkBuffer &out_buffer,
+                       gpu_allocation &out_allocation);
+VkResult create_image(gpu_allocator &allocator, VkImageCreateInfo const &create_info, gpu_memory_request const &request, VkImage &out_image,
+                      gpu_allocation &out_allocation);
+
+// Memory the caller binds resources to itself, for example several images aliasing the same range. A dedicated
+// request gets a VkDeviceMemory of its own that isn't tied to any one resource.
+VkResult allocate_gpu_memory(gpu_allocator &allocator, VkMemoryRequirements const &requirements, gpu_resource_kind kind, gpu_memory_request const &request,
+                             gpu_allocation &out_allocation);
+void free_gpu_memory(gpu_allocator &allocator, gpu_allocation &allocation);
+
+void destroy_buffer(gpu_allocator &allocator, VkBuffer buffer, gpu_allocation &allocation);
+void destroy_image(gpu_allocator &allocator, VkImage image, gpu_allocation &allocation);
+
+// Needed after writing through gpu_allocation::mapped when the memory type isn't HOST_COHERENT
+VkResult flush_allocation(gpu_allocator &allocator, gpu_allocation const &allocation, VkDeviceSize offset, VkDeviceSize size);
+
+gpu_allocator_stats get_gpu_allocator_stats(gpu_allocator &allocator);
+void print_gpu_allocator_stats(gpu_allocator &allocator);
+
+// Every allocation must have been freed first
+void destroy_gpu_allocator(gpu_allocator &allocator);
+
+// A persistently mapped buffer handed out front to back, for data that lives a frame or two. Used linearly it is reset
+// once per frame. Used as a ring, each frame's allocations are released once that frame has completed on the GPU.
+// Not thread safe.
+struct gpu_ring_buffer
+{
+    VkBuffer buffer{};
+    gpu_allocation allocation{};
+    VkDeviceSize capacity = 0;
+    VkDeviceSize head = 0; // Both count bytes ever handed out, the offset into the buffer is the value modulo capacity
+    VkDeviceSize tail = 0;
+
+    struct frame_end
+    {
+        uint64_t frame;
+        VkDeviceSize head;
+    };
+    std::deque<frame_end> frame_ends;
+};
+
+struct gpu_ring_allocation
+{
+    VkBuffer buffer{};
+    VkDeviceSize offset = 0;
+    void *mapped = nullptr;
+};
+
+VkResult create_ring_buffer(gpu_allocator &allocator, VkDeviceSize capacity, VkBufferUsageFlags usage, gpu_memory_request const &request,
+                            gpu_ring_buffer &ring);
+
+// Returns false when the ring has no room left until older frames are released
+bool ring_allocate(gpu_ring_buffer &ring, VkDeviceSize size, VkDeviceSize alignment, gpu_ring_allocation &out_allocation);
+
+// Marks everything allocated so far as belonging to frame
+void ring_end_frame(gpu_ring_buffer &ring, uint64_t frame);
+
+// Reclaims the space of every frame up to and including completed_frame
+void ring_release_frames(gpu_ring_buffer &ring, uint64_t completed_frame);
+
+// Linear use, drops every allocation at once
+void ring_reset(gpu_ring_buffer &ring);
+
+void destroy_ring_buffer(gpu_allocator &allocator, gpu_ring_buffer &ring);
@@ -0,0 +1,271 @@
+#include "gpu_profiler.hpp"
+
+#include <algorithm>
+
+#include <fmt/format.h>
+#include <magic_enum.hpp>
+
+static constexpr uint32_t max_scopes_per_frame = 64;
+
+// Trace argument names of gpu_profiler_statistics, in bit order
+static constexpr const char *statistic_names[gpu_profiler_statistic_count] = {
+    "input_assembly_vertices",
+    "vertex_shader_invocations",
+    "clipping_primitives",
+    "fragment_shader_invocations",
+    "compute_shader_invocations",
+};
+
+VkResult init_gpu_profiler(VkPhysicalDevice physical_device, VkDevice device, uint32_t queue_family_index, uint32_t frames_in_flight,
+                           bool pipeline_statistics, std::filesystem::path const &trace_path, gpu_profiler &profiler)
+{
+    VkPhysicalDeviceProperties physical_device_properties{};
+    vkGetPhysicalDeviceProperties(physical_device, &physical_device_properties);
+    uint32_t queue_family_count = 0;
+    vkGetPhysicalDeviceQueueFamilyProperties(physical_device, &queue_family_count, nullptr);
+    std::vector<VkQueueFamilyProperties> queue_family_properties(queue_family_count);
+    vkGetPhysicalDeviceQueueFamilyProperties(physical_device, &queue_family_count, queue_family_properties.data());
+
+    uint32_t valid_bits = queue_family_properties.at(queue_family_index).timestampValidBits;
+    if (valid_bits == 0 || physical_device_properties.limits.timestampPeriod == 0.0f)
+    {
+        fmt::print("Queue family {} doesn't support timestamps, GPU profiling is disabled\n", queue_family_index);
+        return VK_SUCCESS;
+    }
+
+    profiler.device = device;
+    profiler.timestamp_period_ns = physical_device_properties.limits.timestampPeriod;
+    profiler.timestamp_mask = valid_bits >= 64 ? ~uint64_t{0} : (uint64_t{1} << valid_bits) - 1;
+    profiler.pipeline_statistics = pipeline_statistics;
+    profiler.max_scopes = max_scopes_per_frame;
+    profiler.frames.resize(frames_in_flight);
+    for (auto &frame : profiler.frames)
+    {
+        VkQueryPoolCreateInfo timestamp_pool_create_info{
+            .sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO,
+            .queryType = VK_QUERY_TYPE_TIMESTAMP,
+            .queryCount = 2 * profiler.max_scopes,
+        };
+        VkResult err = vkCreateQueryPool(device, &timestamp_pool_create_info, nullptr, &frame.timestamps);
+        if (err != VK_SUCCESS)
+        {
+            fmt::print("Failed to create timestamp query pool with error code {}\n", magic_enum::enum_name(err));
+            return VK_ERROR_INITIALIZATION_FAILED;
+        }
+        if (pipeline_statistics)
+        {
+            VkQueryPoolCreateInfo statistics_pool_create_info{
+                .sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO,
+                .queryType = VK_QUERY_TYPE_PIPELINE_STATISTICS,
+                .queryCount = profiler.max_scopes,
+                .pipelineStatistics = gpu_profiler_statistics,
+            };
+            err = vkCreateQueryPool(device, &statistics_pool_create_info, nullptr, &frame.statistics);
+            if (err != VK_SUCCESS)
+            {
+                fmt::print("Failed to create pipeline statistics query pool with error code {}\n", magic_enum::enum_name(err));
+                return VK_ERROR_INITIALIZATION_FAILED;
+            }
+        }
+    }
+
+    if (!trace_path.empty())
+    {
+        open_chrome_trace(profiler.trace, trace_path, "GPU", 1);
+    }
+    profiler.enabled = true;
+    return VK_SUCCESS;
+}
+
+void read_back_frame(gpu_profiler &profiler, gpu_profiler::frame &frame)
+{
+    if (!frame.recorded || frame.scopes.empty())
+    {
+        frame.recorded = false;
+        return;
+    }
+    frame.recorded = false;
+
+    // Each query returns its value followed by its availability
+    uint32_t query_count = 2 * static_cast<uint32_t>(frame.scopes.size());
+    std::vector<uint64_t> timestamps(2 * query_count);
+    VkResult err = vkGetQueryPoolResults(profiler.device, frame.timestamps, 0, query_count, timestamps.size() * sizeof(uint64_t), timestamps.data(),
+                                         2 * sizeof(uint64_t), VK_QUERY_RESULT_64_BIT | VK_QUERY_RESULT_WITH_AVAILABILITY_BIT);
+    if (err != VK_SUCCESS && err != VK_NOT_READY)
+    {
+        fmt::print("Failed to read back GPU timestamps with error code {}\n", magic_enum::enum_name(err));
+        return;
+    }
+    uint32_t statistics_stride = gpu_profiler_statistic_count + 1;
+    std::vector<uint64_t> statistics(frame.statistics_count * statistics_stride);
+    if (frame.statistics_count > 0)
+    {
+        err = vkGetQueryPoolResults(profiler.device, frame.statistics, 0, frame.statistics_count, statistics.size() * sizeof(uint64_t),
+                                    statistics.data(), statistics_stride * sizeof(uint64_t), VK_QUERY_RESULT_64_BIT | VK_QUERY_RESULT_WITH_AVAILABILITY_BIT);
+        if (err != VK_SUCCESS && err != VK_NOT_READY)
+        {
+            fmt::print("Failed to read back pipeline statistics with error code {}\n", magic_enum::enum_name(err));
+            statistics.assign(statistics.size(), 0);
+        }
+    }
+
+    for (size_t i = 0; i < frame.scopes.size(); i++)
+    {
+        auto const &scope = frame.scopes[i];
+        uint64_t begin = timestamps[4 * i];
+        uint64_t end = timestamps[4 * i + 2];
+        if (timestamps[4 * i + 1] == 0 || timestamps[4 * i + 3] == 0)
+        {
+            continue; // Never executed, or the scope wasn't closed
+        }
+        uint64_t ticks = (end - begin) & profiler.timestamp_mask;
+        double duration_ms = ticks * profiler.timestamp_period_ns / 1e6;
+        add_timing_sample(profiler.history[scope.name], profiler.history_size, duration_ms);
+
+        if (!profiler.trace.file.is_open())
+        {
+            continue;
+        }
+        if (profiler.trace_origin == 0)
+        {
+            profiler.trace_origin = begin;
+        }
+        double start_us = ((begin - profiler.trace_origin) & profiler.timestamp_mask) * profiler.timestamp_period_ns / 1e3;
+        std::string args = fmt::format("\"frame\":{},\"depth\":{}", frame.frame_number, scope.depth);
+        if (scope.statistics_query != UINT32_MAX)
+        {
+            uint64_t const *values = &statistics[scope.statistics_query * statistics_stride];
+            if (values[gpu_profiler_statistic_count] != 0)
+            {
+                for (uint32_t s = 0; s < gpu_profiler_statistic_count; s++)
+                {
+                    args += fmt::format(",\"{}\":{}", statistic_names[s], values[s]);
+                }
+            }
+        }
+        write_trace_event(profiler.trace, scope.name, "gpu", 1, start_us, duration_ms * 1e3, args);
+    }
+}
+
+void begin_gpu_frame(gpu_profiler &profiler, VkCommandBuffer command_buffer, uint32_t frame_index, uint64_t frame_number)
+{
+    if (!profiler.enabled)
+    {
+        return;
+    }
+    auto &frame = profiler.frames.at(frame_index);
+    read_back_frame(profiler, frame);
+
+    frame.scopes.clear();
+    frame.statistics_count = 0;
+    frame.frame_number = frame_number;
+    frame.recorded = true;
+    vkCmdResetQueryPool(command_buffer, frame.timestamps, 0, 2 * profiler.max_scopes);
+    if (frame.statistics != VK_NULL_HANDLE)
+    {
+        vkCmdResetQueryPool(command_buffer, frame.statistics, 0, profiler.max_scopes);
+    }
+    profiler.current = &frame;
+    profiler.open_scopes.clear();
+    profiler.open_statistics_query = UINT32_MAX;
+}
+
+void begin_gpu_scope(gpu_profiler &profiler, VkCommandBuffer command_buffer, std::string_view name, bool collect_statistics)
+{
+    if (!profiler.enabled || profiler.current == nullptr)
+    {
+        return;
+    }
+    auto &frame = *profiler.current;
+    if (frame.scopes.size() >= profiler.max_scopes)
+    {
+        // Still pushed so the matching end_gpu_scope is skipped as well
+        profiler.dropped_scopes++;
+        profiler.open_scopes.push_back(UINT32_MAX);
+        return;
+    }
+    uint32_t index = static_cast<uint32_t>(frame.scopes.size());
+    gpu_profiler::scope scope{
+        .name = std::string(name),
+        .depth = static_cast<uint32_t>(profiler.open_scopes.size()),
+    };
+    vkCmdWriteTimestamp2(command_buffer, VK_PIPELINE_STAGE_2_TOP_OF_PIPE_BIT, frame.timestamps, 2 * index);
+    if (collect_statistics && profiler.pipeline_statistics && profiler.open_statistics_query == UINT32_MAX)
+    {
+        scope.statistics_query = frame.statistics_count++;
+        vkCmdBeginQuery(command_buffer, frame.statistics, scope.statistics_query, 0);
+        profiler.open_statistics_query = index;
+    }
+    frame.scopes.push_back(std::move(scope));
+    profiler.open_scopes.push_back(index);
+}
+
+void end_gpu_scope(gpu_profiler &profiler, VkCommandBuffer command_buffer)
+{
+    if (!profiler.enabled || profiler.current == nullptr || profiler.open_scopes.empty())
+    {
+        return;
+    }
+    uint32_t index = profiler.open_scopes.back();
+    profiler.open_scopes.pop_back();
+    if (index == UINT32_MAX)
+    {
+        return;
+    }
+    auto &frame = *profiler.current;
+    if (profiler.open_statistics_query == index)
+    {
+        vkCmdEndQuery(command_buffer, frame.statistics, frame.scopes[index].statistics_query);
+        profiler.open_statistics_query = UINT32_MAX;
+    }
+    vkCmdWriteTimestamp2(command_buffer, VK_PIPELINE_STAGE_2_BOTTOM_OF_PIPE_BIT, frame.timestamps, 2 * index + 1);
+}
+
+void print_gpu_profiler_stats(gpu_profiler const &profiler)
+{
+    if (!profiler.enabled)
+    {
+        return;
+    }
+    fmt::print("GPU scopes in ms, percentiles over at most the last {} samples:\n", profiler.history_size);
+    for (auto const &[name, history] : profiler.history)
+    {
+        fmt::print("  {:<24} {}\n", name, format_timing_summary(history));
+    }
+    if (profiler.dropped_scopes > 0)
+    {
+        fmt::print("  {} scopes dropped past the limit of {} per frame\n", profiler.dropped_scopes, profiler.max_scopes);
+    }
+}
+
+void flush_gpu_profiler(gpu_profiler &profiler)
+{
+    // Oldest first so the trace stays in order
+    std::vector<gpu_profiler::frame *> remaining;
+    for (auto &frame : profiler.frames)
+    {
+        if (frame.recorded)
+        {
+            remaining.push_back(&frame);
+        }
+    }
+    std::sort(remaining.begin(), remaining.end(), [](auto const *a, auto const *b) { return a->frame_number < b->frame_number; });
+    for (auto *frame : remaining)
+    {
+        read_back_frame(profiler, *frame);
+    }
+}
+
+void destroy_gpu_profiler(gpu_profiler &profiler)
+{
+    flush_gpu_profiler(profiler);
+    close_chrome_trace(profiler.trace);
+    for (auto &frame : profiler.frames)
+    {
+        vkDestroyQueryPool(profiler.device, frame.timestamps, nullptr);
+        vkDestroyQueryPool(profiler.device, frame.statistics, nullptr);
+    }
+    profiler.frames.clear();
+    profiler.current = nullptr;
+    profiler.enabled = false;
+}
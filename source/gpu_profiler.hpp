@@ -0,0 +1,84 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <map>
+#include <filesystem>
+
+#include <vulkan/vulkan_core.h>
+
+#include "profiling.hpp"
+
+// Statistics collected per scope when pipeline statistics are enabled, in the order the query returns them
+constexpr VkQueryPipelineStatisticFlags gpu_profiler_statistics =
+    VK_QUERY_PIPELINE_STATISTIC_INPUT_ASSEMBLY_VERTICES_BIT | VK_QUERY_PIPELINE_STATISTIC_VERTEX_SHADER_INVOCATIONS_BIT |
+    VK_QUERY_PIPELINE_STATISTIC_CLIPPING_PRIMITIVES_BIT | VK_QUERY_PIPELINE_STATISTIC_FRAGMENT_SHADER_INVOCATIONS_BIT |
+    VK_QUERY_PIPELINE_STATISTIC_COMPUTE_SHADER_INVOCATIONS_BIT;
+constexpr uint32_t gpu_profiler_statistic_count = 5;
+
+// Times named scopes of GPU work with timestamp queries. Every frame in flight has its own query pools, and a frame's
+// results are read back the next time its slot is used, after the renderer has waited for that frame to complete, so
+// reading them never stalls. Scopes nest, only the outermost scope asking for them gets pipeline statistics since a
+// command buffer can't have two statistics queries active at once.
+struct gpu_profiler
+{
+    bool enabled = false;
+    VkDevice device{};
+    double timestamp_period_ns = 1.0;
+    uint64_t timestamp_mask = ~uint64_t{0}; // From timestampValidBits, so wrapped timestamps still subtract correctly
+    bool pipeline_statistics = false;
+    uint32_t max_scopes = 0; // Per frame
+
+    struct scope
+    {
+        std::string name;
+        uint32_t depth = 0;
+        uint32_t statistics_query = UINT32_MAX; // UINT32_MAX when not collected
+    };
+    struct frame
+    {
+        VkQueryPool timestamps{}; // Two queries per scope, begin and end
+        VkQueryPool statistics{};
+        std::vector<scope> scopes;
+        uint32_t statistics_count = 0;
+        uint64_t frame_number = 0;
+        bool recorded = false;
+    };
+    std::vector<frame> frames;
+    frame *current = nullptr;
+    std::vector<uint32_t> open_scopes;
+    uint32_t open_statistics_query = UINT32_MAX;
+
+    uint32_t history_size = 256;
+    std::map<std::string, timing_history, std::less<>> history;
+    uint32_t dropped_scopes = 0; // Past max_scopes in a frame
+
+    // Events are streamed out as frames are read back
+    chrome_trace trace;
+    uint64_t trace_origin = 0; // First timestamp read back, the trace starts at zero
+};
+
+// Does nothing but leave the profiler disabled when queue_family_index can't write timestamps. Pipeline statistics need
+// the pipelineStatisticsQuery feature. An empty trace_path writes no trace.
+VkResult init_gpu_profiler(VkPhysicalDevice physical_device, VkDevice device, uint32_t queue_family_index, uint32_t frames_in_flight,
+                           bool pipeline_statistics, std::filesystem::path const &trace_path, gpu_profiler &profiler);
+
+// Reads back the results of the frame that last used frame_index, which must have completed, and resets its queries.
+// Call right after beginning the frame's command buffer.
+void begin_gpu_frame(gpu_profiler &profiler, VkCommandBuffer command_buffer, uint32_t frame_index, uint64_t frame_number);
+
+// Scopes must be closed in the command buffer that opened them, in reverse order. A scope opened inside a rendering
+// instance must be closed inside it too when it collects statistics.
+void begin_gpu_scope(gpu_profiler &profiler, VkCommandBuffer command_buffer, std::string_view name, bool collect_statistics = false);
+void end_gpu_scope(gpu_profiler &profiler, VkCommandBuffer command_buffer);
+
+// Reads back every frame not read yet, they must all have completed
+void flush_gpu_profiler(gpu_profiler &profiler);
+
+// Timings of each scope, percentiles over its recent samples
+void print_gpu_profiler_stats(gpu_profiler const &profiler);
+
+// Flushes first, so every frame must have completed
+void destroy_gpu_profiler(gpu_profiler &profiler);
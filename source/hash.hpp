@@ -0,0 +1,28 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <string>
+
+// 64 bit FNV-1a, used to key the on-disk caches
+struct fnv1a_hasher
+{
+    uint64_t state = 14695981039346656037ull;
+
+    void update(const void *data, size_t size)
+    {
+        auto bytes = static_cast<const unsigned char *>(data);
+        for (size_t i = 0; i < size; i++)
+        {
+            state ^= bytes[i];
+            state *= 1099511628211ull;
+        }
+    }
+    void update(std::string const &str)
+    {
+        // Hash the length too so that adjacent strings can't shift into each other
+        uint64_t size = str.size();
+        update(&size, sizeof(size));
+        update(str.data(), str.size());
+    }
+};
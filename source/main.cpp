@@ -1,5 +1,6 @@
 #include <vector>
 #include <string>
+#include <cstdlib>
 
 #include <fmt/format.h>
 #include <magic_enum.hpp>
@@ -8,15 +9,102 @@
 
 #include "renderer.hpp"
 #include "window.hpp"
+#include "cpu_profiler.hpp"
 
-int main()
+void parse_arguments(int argc, char **argv, init_settings &settings)
+{
+    for (int i = 1; i < argc; i++)
+    {
+        std::string arg = argv[i];
+        if (arg == "--headless")
+        {
+            settings.headless = true;
+        }
+        else if (arg == "--compile-shaders")
+        {
+            settings.runtime_shader_compilation = true;
+        }
+        else if (arg == "--spirv-opt" && i + 1 < argc)
+        {
+            auto optimization = magic_enum::enum_cast<spirv_optimization>(argv[++i]);
+            if (optimization)
+                settings.shader_optimization = *optimization;
+            else
+                fmt::print("Unknown --spirv-opt recipe {}, expected none, performance, or size\n", argv[i]);
+        }
+        else if (arg == "--strip-shaders")
+        {
+            settings.strip_shader_debug_info = true;
+        }
+        else if (arg == "--measure-spirv-opt")
+        {
+            settings.measure_shader_optimization = true;
+        }
+        else if (arg == "--frames" && i + 1 < argc)
+        {
+            settings.headless_frame_count = std::strtoull(argv[++i], nullptr, 10);
+        }
+        else if (arg == "--present-mode" && i + 1 < argc)
+        {
+            std::string mode = argv[++i];
+            if (mode == "fifo")
+                settings.present_mode = VK_PRESENT_MODE_FIFO_KHR;
+            else if (mode == "fifo_relaxed")
+                settings.present_mode = VK_PRESENT_MODE_FIFO_RELAXED_KHR;
+            else if (mode == "mailbox")
+                settings.present_mode = VK_PRESENT_MODE_MAILBOX_KHR;
+            else if (mode == "immediate")
+                settings.present_mode = VK_PRESENT_MODE_IMMEDIATE_KHR;
+            else
+                fmt::print("Unknown --present-mode {}, expected fifo, fifo_relaxed, mailbox, or immediate\n", mode);
+        }
+        else if (arg == "--swapchain-images" && i + 1 < argc)
+        {
+            settings.swapchain_image_count = static_cast<uint32_t>(std::strtoul(argv[++i], nullptr, 10));
+        }
+        else if (arg == "--frames-in-flight" && i + 1 < argc)
+        {
+            settings.frames_in_flight = static_cast<uint32_t>(std::strtoul(argv[++i], nullptr, 10));
+        }
+        else if (arg == "--no-frame-pacing")
+        {
+            settings.frame_pacing = false;
+        }
+        else if (arg == "--gpu-profile")
+        {
+            settings.gpu_profiling = true;
+        }
+        else if (arg == "--gpu-trace" && i + 1 < argc)
+        {
+            settings.gpu_profiling = true;
+            settings.gpu_trace_path = argv[++i];
+        }
+        else if (arg == "--cpu-trace" && i + 1 < argc)
+        {
+            settings.cpu_trace_path = argv[++i];
+        }
+        else if (arg == "--pipeline-statistics")
+        {
+            settings.gpu_profiling = true;
+            settings.gpu_pipeline_statistics = true;
+        }
+    }
+}
+
+int main(int argc, char **argv)
 {
     init_settings settings{};
+    parse_arguments(argc, argv, settings);
+    init_cpu_profiler(settings.cpu_trace_path);
+    set_cpu_profiler_thread_name("main");
     renderer rend{};
-    rend.glfw_window = create_window(settings);
-    if (!rend.glfw_window)
+    if (!settings.headless)
     {
-        return -1;
+        rend.glfw_window = create_window(settings);
+        if (!rend.glfw_window)
+        {
+            return -1;
+        }
     }
     int ret = init_renderer(settings, rend);
     if (ret != 0)
@@ -24,18 +112,43 @@ int main()
         return ret;
     }
 
-    while (!glfwWindowShouldClose(rend.glfw_window))
+    while (settings.headless ? rend.frame_count < settings.headless_frame_count : !glfwWindowShouldClose(rend.glfw_window))
     {
-        glfwPollEvents();
+        CPU_SCOPE("frame");
+        bool paced = !settings.headless && settings.frame_pacing;
+        if (paced)
+        {
+            CPU_SCOPE("pace frame");
+            pace_frame(rend.pacer, rend.device, rend.swapchain);
+        }
+        if (!settings.headless)
+        {
+            CPU_SCOPE("poll events");
+            glfwPollEvents();
+        }
         ret = render(rend);
         if (ret != 0)
         {
             return ret;
         }
+        if (paced)
+        {
+            end_paced_frame(rend.pacer);
+        }
         rend.frame_count++;
+        collect_cpu_profile();
+    }
+    shutdown_cpu_profiler();
+    print_cpu_profiler_stats();
+    if (!settings.headless && settings.frame_pacing)
+    {
+        print_frame_pacer_stats(rend.pacer);
     }
     shutdown_renderer(rend);
-    glfwDestroyWindow(rend.glfw_window);
-    glfwTerminate();
+    if (!settings.headless)
+    {
+        glfwDestroyWindow(rend.glfw_window);
+        glfwTerminate();
+    }
     return 0;
 }
@@ -0,0 +1,84 @@
+#include "mesh_pool.hpp"
+
+#include <fmt/format.h>
+#include <magic_enum.hpp>
+
+// Vertices are read as 16 byte vectors through the device address
+static constexpr VkDeviceSize vertex_alignment = 16;
+
+VkResult create_mesh_pool(gpu_allocator &allocator, upload_ring const &uploads, VkDeviceSize capacity, mesh_pool &pool)
+{
+    VkBufferCreateInfo buffer_create_info{
+        .sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO,
+        .size = capacity,
+        .usage = VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDEX_BUFFER_BIT |
+                 VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+        .sharingMode = VK_SHARING_MODE_EXCLUSIVE,
+    };
+    VkResult err = create_buffer(allocator, buffer_create_info, upload_destination_request(uploads), pool.buffer, pool.allocation);
+    if (err != VK_SUCCESS)
+    {
+        fmt::print("Failed to create mesh pool with error code {}\n", magic_enum::enum_name(err));
+        return VK_ERROR_INITIALIZATION_FAILED;
+    }
+    VkBufferDeviceAddressInfo buffer_device_address_info{
+        .sType = VK_STRUCTURE_TYPE_BUFFER_DEVICE_ADDRESS_INFO,
+        .buffer = pool.buffer,
+    };
+    pool.address = vkGetBufferDeviceAddress(allocator.device, &buffer_device_address_info);
+    pool.capacity = capacity;
+    pool.used = 0;
+    return VK_SUCCESS;
+}
+
+VkResult add_mesh(gpu_allocator &allocator, upload_ring &uploads, mesh_pool &pool, std::span<const mesh_vertex> vertices,
+                  std::span<const uint32_t> indices, mesh &out_mesh)
+{
+    VkDeviceSize vertex_offset = (pool.used + vertex_alignment - 1) / vertex_alignment * vertex_alignment;
+    VkDeviceSize index_offset = vertex_offset + vertices.size_bytes();
+    if (index_offset + indices.size_bytes() > pool.capacity)
+    {
+        fmt::print("Mesh pool is full, {} of {} bytes used\n", pool.used, pool.capacity);
+        return VK_ERROR_OUT_OF_DEVICE_MEMORY;
+    }
+
+    // index_offset stays 4 byte aligned because mesh_vertex is a multiple of 16 bytes. Appending never touches a range
+    // the GPU could be reading, so direct writes are safe while earlier frames are in flight.
+    VkResult err = upload_buffer(allocator, uploads, pool.buffer, pool.allocation, vertex_offset, vertices.data(), vertices.size_bytes());
+    if (err == VK_SUCCESS)
+    {
+        err = upload_buffer(allocator, uploads, pool.buffer, pool.allocation, index_offset, indices.data(), indices.size_bytes());
+    }
+    if (err != VK_SUCCESS)
+    {
+        return err;
+    }
+    pool.used = index_offset + indices.size_bytes();
+    out_mesh = mesh{
+        .vertex_offset = vertex_offset,
+        .vertex_count = static_cast<uint32_t>(vertices.size()),
+        .first_index = static_cast<uint32_t>(index_offset / sizeof(uint32_t)),
+        .index_count = static_cast<uint32_t>(indices.size()),
+    };
+    return VK_SUCCESS;
+}
+
+void bind_mesh_pool(VkCommandBuffer command_buffer, mesh_pool const &pool)
+{
+    vkCmdBindIndexBuffer(command_buffer, pool.buffer, 0, VK_INDEX_TYPE_UINT32);
+}
+
+void draw_mesh(VkCommandBuffer command_buffer, VkPipelineLayout pipeline_layout, mesh_pool const &pool, mesh const &mesh, uint32_t instance_count)
+{
+    mesh_push_constants push_constants{
+        .vertices = pool.address + mesh.vertex_offset,
+    };
+    vkCmdPushConstants(command_buffer, pipeline_layout, VK_SHADER_STAGE_ALL, 0, sizeof(push_constants), &push_constants);
+    vkCmdDrawIndexed(command_buffer, mesh.index_count, instance_count, mesh.first_index, 0, 0);
+}
+
+void destroy_mesh_pool(gpu_allocator &allocator, mesh_pool &pool)
+{
+    destroy_buffer(allocator, pool.buffer, pool.allocation);
+    pool = mesh_pool{};
+}
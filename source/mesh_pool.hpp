@@ -0,0 +1,58 @@
+#pragma once
+
+#include <cstdint>
+#include <span>
+
+#include <vulkan/vulkan_core.h>
+
+#include "gpu_allocator.hpp"
+#include "upload_ring.hpp"
+
+// Matches MeshVertex in data/shaders/common/mesh.slang
+struct mesh_vertex
+{
+    float position[4];
+    float color[4];
+};
+
+// Matches MeshPushConstants in data/shaders/common/mesh.slang, shaders read their vertices through the address
+struct mesh_push_constants
+{
+    VkDeviceAddress vertices = 0;
+};
+
+// Where a mesh lives inside its pool. Indices are relative to the mesh's first vertex.
+struct mesh
+{
+    VkDeviceSize vertex_offset = 0;
+    uint32_t vertex_count = 0;
+    uint32_t first_index = 0; // In indices from the start of the pool's buffer, as vkCmdDrawIndexed expects
+    uint32_t index_count = 0;
+};
+
+// One device local buffer that meshes are appended to. Shaders pull vertices through a 64-bit buffer device address
+// instead of vertex input state, so every mesh works with every pipeline and the whole pool is drawn with a single
+// index buffer binding.
+struct mesh_pool
+{
+    VkBuffer buffer{};
+    gpu_allocation allocation{};
+    VkDeviceAddress address = 0;
+    VkDeviceSize capacity = 0;
+    VkDeviceSize used = 0;
+};
+
+// The pool is host visible when uploads can write device local memory directly
+VkResult create_mesh_pool(gpu_allocator &allocator, upload_ring const &uploads, VkDeviceSize capacity, mesh_pool &pool);
+
+// The mesh can be drawn once its uploads are submitted and acquired, render() does both at the start of each frame
+VkResult add_mesh(gpu_allocator &allocator, upload_ring &uploads, mesh_pool &pool, std::span<const mesh_vertex> vertices,
+                  std::span<const uint32_t> indices, mesh &out_mesh);
+
+// Binds the pool's index buffer, once per command buffer before any draw_mesh
+void bind_mesh_pool(VkCommandBuffer command_buffer, mesh_pool const &pool);
+
+// Pushes the vertex address to offset 0 of the push constants and draws
+void draw_mesh(VkCommandBuffer command_buffer, VkPipelineLayout pipeline_layout, mesh_pool const &pool, mesh const &mesh, uint32_t instance_count = 1);
+
+void destroy_mesh_pool(gpu_allocator &allocator, mesh_pool &pool);
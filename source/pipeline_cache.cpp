@@ -0,0 +1,250 @@
+#include "pipeline_cache.hpp"
+#include "hash.hpp"
+#include "atomic_file.hpp"
+
+#include <vector>
+#include <fstream>
+#include <cstring>
+#include <span>
+
+#include <fmt/format.h>
+#include <magic_enum.hpp>
+
+static constexpr uint32_t pipeline_cache_file_magic = 0x4350'4d57; // "WMPC"
+static constexpr uint32_t pipeline_cache_file_version = 1;
+
+// Prepended to the driver's blob. The driver's own header has no driver version, and a blob from a different driver
+// build is at best ignored and at worst crashes the driver, so it is checked here before the data is handed over.
+struct pipeline_cache_file_header
+{
+    uint32_t magic;
+    uint32_t file_version;
+    uint32_t vendor_id;
+    uint32_t device_id;
+    uint32_t driver_version;
+    uint8_t pipeline_cache_uuid[VK_UUID_SIZE];
+    uint32_t miss_count;
+    uint64_t miss_creation_ns;
+    uint64_t data_size;
+    uint64_t data_hash;
+};
+
+bool validate_pipeline_cache_file(VkPhysicalDeviceProperties const &properties, std::vector<char> const &contents, std::string &out_reason)
+{
+    if (contents.size() < sizeof(pipeline_cache_file_header))
+    {
+        out_reason = "file is too small";
+        return false;
+    }
+    pipeline_cache_file_header header{};
+    memcpy(&header, contents.data(), sizeof(header));
+    if (header.magic != pipeline_cache_file_magic || header.file_version != pipeline_cache_file_version)
+    {
+        out_reason = "unknown file format";
+        return false;
+    }
+    if (header.vendor_id != properties.vendorID || header.device_id != properties.deviceID)
+    {
+        out_reason = "written by a different device";
+        return false;
+    }
+    if (header.driver_version != properties.driverVersion)
+    {
+        out_reason = "written by a different driver version";
+        return false;
+    }
+    if (memcmp(header.pipeline_cache_uuid, properties.pipelineCacheUUID, VK_UUID_SIZE) != 0)
+    {
+        out_reason = "pipelineCacheUUID mismatch";
+        return false;
+    }
+    if (header.data_size != contents.size() - sizeof(header))
+    {
+        out_reason = "file is truncated";
+        return false;
+    }
+    fnv1a_hasher hasher{};
+    hasher.update(contents.data() + sizeof(header), header.data_size);
+    if (hasher.state != header.data_hash)
+    {
+        out_reason = "data is corrupt";
+        return false;
+    }
+
+    // Also check the driver's own header at the front of the blob
+    VkPipelineCacheHeaderVersionOne driver_header{};
+    if (header.data_size < sizeof(driver_header))
+    {
+        out_reason = "driver data is too small";
+        return false;
+    }
+    memcpy(&driver_header, contents.data() + sizeof(header), sizeof(driver_header));
+    if (driver_header.headerVersion != VK_PIPELINE_CACHE_HEADER_VERSION_ONE ||
+        driver_header.vendorID != properties.vendorID ||
+        driver_header.deviceID != properties.deviceID ||
+        memcmp(driver_header.pipelineCacheUUID, properties.pipelineCacheUUID, VK_UUID_SIZE) != 0)
+    {
+        out_reason = "driver header mismatch";
+        return false;
+    }
+    return true;
+}
+
+VkResult init_pipeline_cache(VkPhysicalDevice physical_device, VkDevice device, std::filesystem::path const &cache_directory, persistent_pipeline_cache &cache)
+{
+    cache.path = cache_directory / "pipeline_cache.bin";
+
+    VkPhysicalDeviceProperties properties{};
+    vkGetPhysicalDeviceProperties(physical_device, &properties);
+
+    std::vector<char> contents;
+    std::ifstream file(cache.path, std::ios::ate | std::ios::binary);
+    if (file.is_open())
+    {
+        contents.resize((size_t)file.tellg());
+        file.seekg(0);
+        file.read(contents.data(), contents.size());
+        file.close();
+    }
+
+    VkPipelineCacheCreateInfo pipeline_cache_create_info{
+        .sType = VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO,
+    };
+
+    std::string reason;
+    if (!contents.empty())
+    {
+        if (validate_pipeline_cache_file(properties, contents, reason))
+        {
+            pipeline_cache_file_header header{};
+            memcpy(&header, contents.data(), sizeof(header));
+            cache.loaded_data_size = header.data_size;
+            cache.stats.previous_miss_count = header.miss_count;
+            cache.stats.previous_miss_creation_ns = header.miss_creation_ns;
+            pipeline_cache_create_info.initialDataSize = header.data_size;
+            pipeline_cache_create_info.pInitialData = contents.data() + sizeof(header);
+        }
+        else
+        {
+            fmt::print("Ignoring pipeline cache {}: {}\n", cache.path.string(), reason);
+        }
+    }
+
+    VkResult err = vkCreatePipelineCache(device, &pipeline_cache_create_info, nullptr, &cache.cache);
+    if (err != VK_SUCCESS && pipeline_cache_create_info.initialDataSize != 0)
+    {
+        // The driver is allowed to reject data it doesn't like, start over with an empty cache
+        fmt::print("Driver rejected pipeline cache {} with error code {}\n", cache.path.string(), magic_enum::enum_name(err));
+        cache.loaded_data_size = 0;
+        pipeline_cache_create_info.initialDataSize = 0;
+        pipeline_cache_create_info.pInitialData = nullptr;
+        err = vkCreatePipelineCache(device, &pipeline_cache_create_info, nullptr, &cache.cache);
+    }
+    if (err != VK_SUCCESS)
+    {
+        fmt::print("Failed to create pipeline cache with error code {}", magic_enum::enum_name(err));
+        return VK_ERROR_INITIALIZATION_FAILED;
+    }
+    return VK_SUCCESS;
+}
+
+void record_pipeline_creation(persistent_pipeline_cache &cache, VkPipelineCreationFeedback const &feedback, uint64_t measured_ns)
+{
+    uint64_t duration_ns = (feedback.flags & VK_PIPELINE_CREATION_FEEDBACK_VALID_BIT) ? feedback.duration : measured_ns;
+    std::lock_guard lock(cache.stats_mutex);
+    cache.stats.pipelines_created++;
+    if (feedback.flags & VK_PIPELINE_CREATION_FEEDBACK_APPLICATION_PIPELINE_CACHE_HIT_BIT)
+    {
+        cache.stats.cache_hits++;
+        cache.stats.hit_creation_ns += duration_ns;
+    }
+    else
+    {
+        cache.stats.miss_creation_ns += duration_ns;
+    }
+}
+
+void print_pipeline_cache_stats(persistent_pipeline_cache const &cache)
+{
+    auto const &stats = cache.stats;
+    uint32_t misses = stats.pipelines_created - stats.cache_hits;
+    uint32_t total_miss_count = misses + stats.previous_miss_count;
+    uint64_t total_miss_ns = stats.miss_creation_ns + stats.previous_miss_creation_ns;
+    double average_miss_ms = total_miss_count > 0 ? total_miss_ns / 1e6 / total_miss_count : 0.0;
+    double hit_ms = stats.hit_creation_ns / 1e6;
+    double saved_ms = stats.cache_hits * average_miss_ms - hit_ms;
+
+    fmt::print("Pipeline cache: {} of {} pipelines hit, {:.2f} ms creating ({:.2f} ms on hits, {:.2f} ms on misses)",
+               stats.cache_hits, stats.pipelines_created, hit_ms + stats.miss_creation_ns / 1e6, hit_ms, stats.miss_creation_ns / 1e6);
+    if (total_miss_count > 0)
+    {
+        fmt::print(", saved an estimated {:.2f} ms\n", saved_ms > 0.0 ? saved_ms : 0.0);
+    }
+    else
+    {
+        fmt::print("\n");
+    }
+}
+
+VkResult save_pipeline_cache(VkPhysicalDevice physical_device, VkDevice device, persistent_pipeline_cache &cache)
+{
+    size_t data_size = 0;
+    VkResult err = vkGetPipelineCacheData(device, cache.cache, &data_size, nullptr);
+    if (err != VK_SUCCESS)
+    {
+        fmt::print("Failed to get pipeline cache size with error code {}", magic_enum::enum_name(err));
+        return err;
+    }
+    std::vector<char> contents(sizeof(pipeline_cache_file_header) + data_size);
+    err = vkGetPipelineCacheData(device, cache.cache, &data_size, contents.data() + sizeof(pipeline_cache_file_header));
+    if (err != VK_SUCCESS)
+    {
+        fmt::print("Failed to get pipeline cache data with error code {}", magic_enum::enum_name(err));
+        return err;
+    }
+    contents.resize(sizeof(pipeline_cache_file_header) + data_size);
+
+    VkPhysicalDeviceProperties properties{};
+    vkGetPhysicalDeviceProperties(physical_device, &properties);
+
+    // Keep the miss history bounded so old runs age out
+    uint32_t miss_count = cache.stats.previous_miss_count + (cache.stats.pipelines_created - cache.stats.cache_hits);
+    uint64_t miss_creation_ns = cache.stats.previous_miss_creation_ns + cache.stats.miss_creation_ns;
+    while (miss_count > 1024)
+    {
+        miss_count /= 2;
+        miss_creation_ns /= 2;
+    }
+
+    pipeline_cache_file_header header{
+        .magic = pipeline_cache_file_magic,
+        .file_version = pipeline_cache_file_version,
+        .vendor_id = properties.vendorID,
+        .device_id = properties.deviceID,
+        .driver_version = properties.driverVersion,
+        .miss_count = miss_count,
+        .miss_creation_ns = miss_creation_ns,
+        .data_size = data_size,
+    };
+    memcpy(header.pipeline_cache_uuid, properties.pipelineCacheUUID, VK_UUID_SIZE);
+    fnv1a_hasher hasher{};
+    hasher.update(contents.data() + sizeof(header), data_size);
+    header.data_hash = hasher.state;
+    memcpy(contents.data(), &header, sizeof(header));
+
+    // Readers never see a partial file
+    std::error_code ec;
+    std::filesystem::create_directories(cache.path.parent_path(), ec);
+    if (!write_file_atomically(cache.path, std::as_bytes(std::span(contents))))
+    {
+        fmt::print("Failed to write pipeline cache to {}", cache.path.string());
+        return VK_ERROR_UNKNOWN;
+    }
+    return VK_SUCCESS;
+}
+
+void destroy_pipeline_cache(VkDevice device, persistent_pipeline_cache &cache)
+{
+    vkDestroyPipelineCache(device, cache.cache, nullptr);
+    cache.cache = VK_NULL_HANDLE;
+}
@@ -0,0 +1,43 @@
+#pragma once
+
+#include <filesystem>
+#include <mutex>
+
+#include <vulkan/vulkan_core.h>
+
+struct pipeline_cache_stats
+{
+    uint32_t pipelines_created = 0;
+    uint32_t cache_hits = 0; // Reported by the driver through VkPipelineCreationFeedback
+    uint64_t hit_creation_ns = 0;
+    uint64_t miss_creation_ns = 0;
+
+    // Average cost of a miss carried over from earlier runs, so savings can be estimated on fully warm runs
+    uint64_t previous_miss_creation_ns = 0;
+    uint32_t previous_miss_count = 0;
+};
+
+struct persistent_pipeline_cache
+{
+    VkPipelineCache cache{};
+    std::filesystem::path path;
+    size_t loaded_data_size = 0;
+
+    // VkPipelineCache is internally synchronized, only the stats need a lock when pipelines are created in parallel
+    std::mutex stats_mutex;
+    pipeline_cache_stats stats{};
+};
+
+// Loads the cache blob from disk when it was written by the same device, vendor, and driver version
+VkResult init_pipeline_cache(VkPhysicalDevice physical_device, VkDevice device, std::filesystem::path const &cache_directory, persistent_pipeline_cache &cache);
+
+// Call with the feedback chained into each vkCreate*Pipelines call, measured_ns is used when the driver leaves it invalid.
+// Safe to call from multiple threads.
+void record_pipeline_creation(persistent_pipeline_cache &cache, VkPipelineCreationFeedback const &feedback, uint64_t measured_ns);
+
+void print_pipeline_cache_stats(persistent_pipeline_cache const &cache);
+
+// Serializes the cache next to a header identifying the device, the file is replaced atomically
+VkResult save_pipeline_cache(VkPhysicalDevice physical_device, VkDevice device, persistent_pipeline_cache &cache);
+
+void destroy_pipeline_cache(VkDevice device, persistent_pipeline_cache &cache);
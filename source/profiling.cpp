@@ -0,0 +1,118 @@
+#include "profiling.hpp"
+
+#include <algorithm>
+
+#include <fmt/format.h>
+
+void add_timing_sample(timing_history &history, uint32_t window_size, double duration_ms)
+{
+    if (history.samples_ms.size() < window_size)
+    {
+        history.samples_ms.push_back(duration_ms);
+    }
+    else
+    {
+        history.samples_ms[history.next] = duration_ms;
+        history.next = (history.next + 1) % window_size;
+    }
+    history.min_ms = history.total_count == 0 ? duration_ms : std::min(history.min_ms, duration_ms);
+    history.max_ms = history.total_count == 0 ? duration_ms : std::max(history.max_ms, duration_ms);
+    history.total_ms += duration_ms;
+    history.total_count++;
+}
+
+timing_summary summarize_timings(timing_history const &history)
+{
+    if (history.total_count == 0)
+    {
+        return {};
+    }
+    std::vector<double> sorted = history.samples_ms;
+    std::sort(sorted.begin(), sorted.end());
+    auto percentile = [&sorted](double p) { return sorted[static_cast<size_t>(p * (sorted.size() - 1) + 0.5)]; };
+    return timing_summary{
+        .count = history.total_count,
+        .min_ms = history.min_ms,
+        .avg_ms = history.total_ms / history.total_count,
+        .p50_ms = percentile(0.5),
+        .p95_ms = percentile(0.95),
+        .p99_ms = percentile(0.99),
+        .max_ms = history.max_ms,
+    };
+}
+
+std::string format_timing_summary(timing_history const &history)
+{
+    if (history.total_count == 0)
+    {
+        return "no samples";
+    }
+    timing_summary summary = summarize_timings(history);
+    return fmt::format("min {:8.3f}  avg {:8.3f}  p50 {:8.3f}  p95 {:8.3f}  p99 {:8.3f}  max {:8.3f}  ({} samples)", summary.min_ms, summary.avg_ms,
+                       summary.p50_ms, summary.p95_ms, summary.p99_ms, summary.max_ms, summary.count);
+}
+
+std::string escape_json(std::string_view text)
+{
+    std::string escaped;
+    escaped.reserve(text.size());
+    for (char c : text)
+    {
+        if (c == '"' || c == '\\')
+        {
+            escaped.push_back('\\');
+        }
+        escaped.push_back(c);
+    }
+    return escaped;
+}
+
+bool open_chrome_trace(chrome_trace &trace, std::filesystem::path const &path, std::string_view process_name, uint32_t pid)
+{
+    std::error_code ec;
+    if (path.has_parent_path())
+    {
+        std::filesystem::create_directories(path.parent_path(), ec);
+    }
+    trace.file.open(path, std::ios::trunc);
+    if (!trace.file)
+    {
+        fmt::print("Failed to open trace {}, no trace is written\n", path.string());
+        return false;
+    }
+    trace.pid = pid;
+    // The metadata event goes first so every later event can be written with a leading comma
+    trace.file << fmt::format("{{\"traceEvents\":[\n{{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":{},\"args\":{{\"name\":\"{}\"}}}}", pid,
+                              escape_json(process_name));
+    return true;
+}
+
+void write_trace_thread_name(chrome_trace &trace, uint32_t tid, std::string_view name)
+{
+    if (!trace.file.is_open())
+    {
+        return;
+    }
+    trace.file << fmt::format(",\n{{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":{},\"tid\":{},\"args\":{{\"name\":\"{}\"}}}}", trace.pid, tid,
+                              escape_json(name));
+}
+
+void write_trace_event(chrome_trace &trace, std::string_view name, std::string_view category, uint32_t tid, double start_us, double duration_us,
+                       std::string_view args)
+{
+    if (!trace.file.is_open())
+    {
+        return;
+    }
+    trace.file << fmt::format(",\n{{\"name\":\"{}\",\"cat\":\"{}\",\"ph\":\"X\",\"pid\":{},\"tid\":{},\"ts\":{:.3f},\"dur\":{:.3f},\"args\":{{{}}}}}",
+                              escape_json(name), category, trace.pid, tid, start_us, duration_us, args);
+}
+
+void close_chrome_trace(chrome_trace &trace)
+{
+    if (trace.file.is_open())
+    {
+        trace.file << "\n]}\n";
+        trace.file.close();
+    }
+}
@@ -0,0 +1,59 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <fstream>
+#include <filesystem>
+
+// Every sample's min, max, and average, plus a window of the most recent samples for the percentiles
+struct timing_history
+{
+    std::vector<double> samples_ms;
+    uint32_t next = 0;
+    uint64_t total_count = 0;
+    double total_ms = 0.0;
+    double min_ms = 0.0;
+    double max_ms = 0.0;
+};
+
+void add_timing_sample(timing_history &history, uint32_t window_size, double duration_ms);
+
+struct timing_summary
+{
+    uint64_t count = 0;
+    double min_ms = 0.0;
+    double avg_ms = 0.0;
+    double p50_ms = 0.0;
+    double p95_ms = 0.0;
+    double p99_ms = 0.0;
+    double max_ms = 0.0;
+};
+
+// All zero when there are no samples
+timing_summary summarize_timings(timing_history const &history);
+
+// min, avg, p50, p95, p99, and max on one line
+std::string format_timing_summary(timing_history const &history);
+
+// Escapes quotes and backslashes for use inside a JSON string
+std::string escape_json(std::string_view text);
+
+// Streams complete events in the Chrome trace event format, viewable in chrome://tracing or Perfetto. Each profiler
+// writes its own file as its own process.
+struct chrome_trace
+{
+    std::ofstream file;
+    uint32_t pid = 0;
+};
+
+bool open_chrome_trace(chrome_trace &trace, std::filesystem::path const &path, std::string_view process_name, uint32_t pid);
+
+void write_trace_thread_name(chrome_trace &trace, uint32_t tid, std::string_view name);
+
+// args is the inside of a JSON object, empty for none
+void write_trace_event(chrome_trace &trace, std::string_view name, std::string_view category, uint32_t tid, double start_us, double duration_us,
+                       std::string_view args = {});
+
+void close_chrome_trace(chrome_trace &trace);
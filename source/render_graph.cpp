@@ -0,0 +1,469 @@
+#include "render_graph.hpp"
+
+#include <algorithm>
+
+#include <fmt/format.h>
+#include <magic_enum.hpp>
+
+#include "hash.hpp"
+
+static constexpr VkAccessFlags2 write_access_mask = VK_ACCESS_2_COLOR_ATTACHMENT_WRITE_BIT | VK_ACCESS_2_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT |
+                                                   VK_ACCESS_2_SHADER_WRITE_BIT | VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT | VK_ACCESS_2_TRANSFER_WRITE_BIT |
+                                                   VK_ACCESS_2_HOST_WRITE_BIT | VK_ACCESS_2_MEMORY_WRITE_BIT;
+
+graph_resource_state graph_usage_state(graph_usage usage)
+{
+    switch (usage)
+    {
+    case graph_usage::color_attachment:
+        return {VK_PIPELINE_STAGE_2_COLOR_ATTACHMENT_OUTPUT_BIT, VK_ACCESS_2_COLOR_ATTACHMENT_READ_BIT | VK_ACCESS_2_COLOR_ATTACHMENT_WRITE_BIT,
+                VK_IMAGE_LAYOUT_ATTACHMENT_OPTIMAL};
+    case graph_usage::depth_attachment:
+        return {VK_PIPELINE_STAGE_2_EARLY_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_2_LATE_FRAGMENT_TESTS_BIT,
+                VK_ACCESS_2_DEPTH_STENCIL_ATTACHMENT_READ_BIT | VK_ACCESS_2_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT, VK_IMAGE_LAYOUT_ATTACHMENT_OPTIMAL};
+    case graph_usage::depth_read:
+        return {VK_PIPELINE_STAGE_2_EARLY_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_2_LATE_FRAGMENT_TESTS_BIT, VK_ACCESS_2_DEPTH_STENCIL_ATTACHMENT_READ_BIT,
+                VK_IMAGE_LAYOUT_READ_ONLY_OPTIMAL};
+    case graph_usage::sampled:
+        return {VK_PIPELINE_STAGE_2_FRAGMENT_SHADER_BIT | VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT, VK_ACCESS_2_SHADER_SAMPLED_READ_BIT,
+                VK_IMAGE_LAYOUT_READ_ONLY_OPTIMAL};
+    case graph_usage::storage_read:
+        return {VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT, VK_ACCESS_2_SHADER_STORAGE_READ_BIT, VK_IMAGE_LAYOUT_GENERAL};
+    case graph_usage::storage_write:
+        return {VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT, VK_ACCESS_2_SHADER_STORAGE_READ_BIT | VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT,
+                VK_IMAGE_LAYOUT_GENERAL};
+    case graph_usage::vertex_read:
+        return {VK_PIPELINE_STAGE_2_INDEX_INPUT_BIT | VK_PIPELINE_STAGE_2_VERTEX_SHADER_BIT,
+                VK_ACCESS_2_INDEX_READ_BIT | VK_ACCESS_2_SHADER_STORAGE_READ_BIT, VK_IMAGE_LAYOUT_UNDEFINED};
+    case graph_usage::transfer_source:
+        return {VK_PIPELINE_STAGE_2_ALL_TRANSFER_BIT, VK_ACCESS_2_TRANSFER_READ_BIT, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL};
+    case graph_usage::transfer_destination:
+        return {VK_PIPELINE_STAGE_2_ALL_TRANSFER_BIT, VK_ACCESS_2_TRANSFER_WRITE_BIT, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL};
+    case graph_usage::present:
+        // The transition has to finish before the present semaphore, which is signaled at this stage
+        return {VK_PIPELINE_STAGE_2_COLOR_ATTACHMENT_OUTPUT_BIT, VK_ACCESS_2_NONE, VK_IMAGE_LAYOUT_PRESENT_SRC_KHR};
+    }
+    return {};
+}
+
+void begin_render_graph(render_graph &graph)
+{
+    graph.resources.clear();
+    graph.passes.clear();
+}
+
+graph_resource import_graph_image(render_graph &graph, std::string name, VkImage image, VkImageSubresourceRange const &subresource_range,
+                                  graph_resource_state const &initial, graph_resource_state const &final)
+{
+    graph.resources.push_back(render_graph::resource{
+        .name = std::move(name),
+        .is_image = true,
+        .image = image,
+        .subresource_range = subresource_range,
+        .initial = initial,
+        .final = final,
+    });
+    return static_cast<graph_resource>(graph.resources.size() - 1);
+}
+
+graph_resource import_graph_buffer(render_graph &graph, std::string name, VkBuffer buffer, graph_resource_state const &initial,
+                                   graph_resource_state const &final)
+{
+    graph.resources.push_back(render_graph::resource{
+        .name = std::move(name),
+        .buffer = buffer,
+        .initial = {initial.stage_mask, initial.access_mask, VK_IMAGE_LAYOUT_UNDEFINED},
+        .final = {final.stage_mask, final.access_mask, VK_IMAGE_LAYOUT_UNDEFINED},
+    });
+    return static_cast<graph_resource>(graph.resources.size() - 1);
+}
+
+graph_resource create_graph_image(render_graph &graph, std::string name, transient_image_desc const &desc)
+{
+    graph.resources.push_back(render_graph::resource{
+        .name = std::move(name),
+        .is_image = true,
+        .transient = true,
+        .desc = desc,
+        .subresource_range = VkImageSubresourceRange{desc.aspect, 0, 1, 0, 1},
+    });
+    return static_cast<graph_resource>(graph.resources.size() - 1);
+}
+
+VkImageView graph_image_view(render_graph const &graph, graph_resource resource)
+{
+    return graph.resources.at(resource).view;
+}
+
+void add_graph_pass(render_graph &graph, std::string name, std::initializer_list<graph_use> uses, std::function<void(VkCommandBuffer)> record, bool keep)
+{
+    graph.passes.push_back(render_graph::pass{
+        .name = std::move(name),
+        .uses = uses,
+        .record = std::move(record),
+        .keep = keep,
+    });
+}
+
+// Field by field, graph_resource_state has padding
+void hash_resource_state(fnv1a_hasher &hasher, graph_resource_state const &state)
+{
+    hasher.update(&state.stage_mask, sizeof(state.stage_mask));
+    hasher.update(&state.access_mask, sizeof(state.access_mask));
+    hasher.update(&state.layout, sizeof(state.layout));
+}
+
+uint64_t hash_graph_topology(render_graph const &graph)
+{
+    fnv1a_hasher hasher{};
+    for (auto const &resource : graph.resources)
+    {
+        hasher.update(resource.name);
+        hasher.update(&resource.is_image, sizeof(resource.is_image));
+        hasher.update(&resource.transient, sizeof(resource.transient));
+        hasher.update(&resource.desc.format, sizeof(resource.desc.format));
+        hasher.update(&resource.desc.extent, sizeof(resource.desc.extent));
+        hasher.update(&resource.desc.aspect, sizeof(resource.desc.aspect));
+        hasher.update(&resource.desc.samples, sizeof(resource.desc.samples));
+        hasher.update(&resource.subresource_range, sizeof(resource.subresource_range));
+        hash_resource_state(hasher, resource.initial);
+        hash_resource_state(hasher, resource.final);
+    }
+    for (auto const &pass : graph.passes)
+    {
+        hasher.update(pass.name);
+        hasher.update(&pass.keep, sizeof(pass.keep));
+        uint64_t use_count = pass.uses.size();
+        hasher.update(&use_count, sizeof(use_count));
+        for (auto const &use : pass.uses)
+        {
+            hasher.update(&use.resource, sizeof(use.resource));
+            hasher.update(&use.usage, sizeof(use.usage));
+        }
+    }
+    return hasher.state;
+}
+
+// Every use of a resource within one pass, combined into one state
+struct combined_use
+{
+    graph_resource resource;
+    graph_resource_state state;
+};
+
+std::vector<combined_use> combine_pass_uses(render_graph const &graph, render_graph::pass const &pass)
+{
+    std::vector<combined_use> combined;
+    for (auto const &use : pass.uses)
+    {
+        graph_resource_state state = graph_usage_state(use.usage);
+        if (!graph.resources.at(use.resource).is_image)
+        {
+            state.layout = VK_IMAGE_LAYOUT_UNDEFINED;
+        }
+        auto it = std::find_if(combined.begin(), combined.end(), [&use](combined_use const &c) { return c.resource == use.resource; });
+        if (it == combined.end())
+        {
+            combined.push_back({use.resource, state});
+            continue;
+        }
+        if (it->state.layout != state.layout)
+        {
+            fmt::print("Pass {} uses {} in both {} and {}, using GENERAL\n", pass.name, graph.resources.at(use.resource).name,
+                       magic_enum::enum_name(it->state.layout), magic_enum::enum_name(state.layout));
+            it->state.layout = VK_IMAGE_LAYOUT_GENERAL;
+        }
+        it->state.stage_mask |= state.stage_mask;
+        it->state.access_mask |= state.access_mask;
+    }
+    return combined;
+}
+
+VkImageUsageFlags graph_usage_image_usage(graph_usage usage)
+{
+    switch (usage)
+    {
+    case graph_usage::color_attachment:
+        return VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT;
+    case graph_usage::depth_attachment:
+    case graph_usage::depth_read:
+        return VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT;
+    case graph_usage::sampled:
+        return VK_IMAGE_USAGE_SAMPLED_BIT;
+    case graph_usage::storage_read:
+    case graph_usage::storage_write:
+        return VK_IMAGE_USAGE_STORAGE_BIT;
+    case graph_usage::transfer_source:
+        return VK_IMAGE_USAGE_TRANSFER_SRC_BIT;
+    case graph_usage::transfer_destination:
+        return VK_IMAGE_USAGE_TRANSFER_DST_BIT;
+    case graph_usage::vertex_read:
+    case graph_usage::present:
+        return 0;
+    }
+    return 0;
+}
+
+// Lifetimes are positions in compiled_passes, transients no live pass uses don't get an image
+void compute_transient_requests(render_graph &graph)
+{
+    graph.transient_requests.clear();
+    graph.transient_resources.clear();
+    std::vector<uint32_t> request_index(graph.resources.size(), UINT32_MAX);
+    for (uint32_t c = 0; c < graph.compiled_passes.size(); c++)
+    {
+        for (auto const &use : graph.passes[graph.compiled_passes[c].pass_index].uses)
+        {
+            auto const &resource = graph.resources[use.resource];
+            if (!resource.transient)
+            {
+                continue;
+            }
+            if (request_index[use.resource] == UINT32_MAX)
+            {
+                request_index[use.resource] = static_cast<uint32_t>(graph.transient_requests.size());
+                graph.transient_requests.push_back({resource.desc, 0, c, c});
+                graph.transient_resources.push_back(use.resource);
+            }
+            auto &request = graph.transient_requests[request_index[use.resource]];
+            request.usage |= graph_usage_image_usage(use.usage);
+            request.last_pass = c;
+        }
+    }
+}
+
+// What later uses of a resource have to synchronize with
+struct resource_tracking
+{
+    VkImageLayout layout = VK_IMAGE_LAYOUT_UNDEFINED;
+    graph_resource_state last_write{};           // Layout transitions count as writes
+    VkPipelineStageFlags2 visible_stages = 0;    // Already wait for last_write
+    VkAccessFlags2 visible_access = 0;           // Already see last_write
+    VkPipelineStageFlags2 reads_since_write = 0; // The next write or transition waits for these
+};
+
+void compile_render_graph(render_graph &graph)
+{
+    graph.compiled_passes.clear();
+    graph.barriers.clear();
+    graph.culled_pass_count = 0;
+
+    std::vector<std::vector<combined_use>> pass_uses;
+    pass_uses.reserve(graph.passes.size());
+    for (auto const &pass : graph.passes)
+    {
+        pass_uses.push_back(combine_pass_uses(graph, pass));
+    }
+
+    // Walk backwards from what outlives the graph, a pass is live when something after it reads one of its writes.
+    // Attachment writes may load what was there, so they don't end the contents of earlier writes.
+    std::vector<bool> needed(graph.resources.size());
+    for (size_t i = 0; i < graph.resources.size(); i++)
+    {
+        needed[i] = graph.resources[i].final.stage_mask != VK_PIPELINE_STAGE_2_NONE;
+    }
+    std::vector<bool> live(graph.passes.size());
+    for (size_t p = graph.passes.size(); p-- > 0;)
+    {
+        live[p] = graph.passes[p].keep;
+        for (auto const &use : pass_uses[p])
+        {
+            live[p] = live[p] || ((use.state.access_mask & write_access_mask) != 0 && needed[use.resource]);
+        }
+        if (!live[p])
+        {
+            graph.culled_pass_count++;
+            continue;
+        }
+        for (auto const &use : pass_uses[p])
+        {
+            bool reads = (use.state.access_mask & ~write_access_mask) != 0;
+            needed[use.resource] = reads || (needed[use.resource] && (use.state.access_mask & write_access_mask) == 0);
+        }
+    }
+
+    // Transients may alias each other's memory and are reused by the next frame, so their first use waits for every
+    // transient use of the graph
+    graph_resource_state transient_initial{};
+    for (uint32_t p = 0; p < graph.passes.size(); p++)
+    {
+        for (auto const &use : pass_uses[p])
+        {
+            if (live[p] && graph.resources[use.resource].transient)
+            {
+                transient_initial.stage_mask |= use.state.stage_mask;
+                transient_initial.access_mask |= use.state.access_mask & write_access_mask;
+            }
+        }
+    }
+
+    std::vector<resource_tracking> tracking(graph.resources.size());
+    for (size_t i = 0; i < graph.resources.size(); i++)
+    {
+        auto const &initial = graph.resources[i].transient ? transient_initial : graph.resources[i].initial;
+        tracking[i].layout = initial.layout;
+        if ((initial.access_mask & write_access_mask) != 0)
+        {
+            tracking[i].last_write = initial;
+        }
+        else
+        {
+            tracking[i].reads_since_write = initial.stage_mask;
+        }
+    }
+
+    // A barrier is needed for writes and layout transitions after any earlier access, and for reads that don't see the
+    // last write yet. Reads after reads in the same layout need nothing.
+    auto transition = [&graph, &tracking](graph_resource resource, graph_resource_state const &dst) {
+        auto &state = tracking[resource];
+        bool writes = (dst.access_mask & write_access_mask) != 0;
+        bool layout_change = state.layout != dst.layout;
+        if (writes || layout_change)
+        {
+            VkPipelineStageFlags2 src_stages = state.last_write.stage_mask | state.reads_since_write;
+            if (src_stages != VK_PIPELINE_STAGE_2_NONE || layout_change)
+            {
+                graph.barriers.push_back({resource, {src_stages, state.last_write.access_mask, state.layout}, dst});
+            }
+            state.last_write = {dst.stage_mask, dst.access_mask & write_access_mask, dst.layout};
+            state.visible_stages = dst.stage_mask;
+            state.visible_access = dst.access_mask;
+            state.reads_since_write = writes ? VK_PIPELINE_STAGE_2_NONE : dst.stage_mask;
+            state.layout = dst.layout;
+            return;
+        }
+        bool unseen = (dst.stage_mask & ~state.visible_stages) != 0 || (dst.access_mask & ~state.visible_access) != 0;
+        if (state.last_write.stage_mask != VK_PIPELINE_STAGE_2_NONE && unseen)
+        {
+            graph.barriers.push_back({resource, state.last_write, dst});
+            state.visible_stages |= dst.stage_mask;
+            state.visible_access |= dst.access_mask;
+        }
+        state.reads_since_write |= dst.stage_mask;
+    };
+
+    for (uint32_t p = 0; p < graph.passes.size(); p++)
+    {
+        if (!live[p])
+        {
+            continue;
+        }
+        uint32_t first_barrier = static_cast<uint32_t>(graph.barriers.size());
+        for (auto const &use : pass_uses[p])
+        {
+            transition(use.resource, use.state);
+        }
+        graph.compiled_passes.push_back({p, first_barrier, static_cast<uint32_t>(graph.barriers.size()) - first_barrier});
+    }
+
+    graph.first_final_barrier = static_cast<uint32_t>(graph.barriers.size());
+    for (uint32_t r = 0; r < graph.resources.size(); r++)
+    {
+        auto const &final = graph.resources[r].final;
+        if (final.stage_mask != VK_PIPELINE_STAGE_2_NONE)
+        {
+            transition(r, final);
+        }
+    }
+
+    compute_transient_requests(graph);
+    graph.compiled = true;
+    graph.compile_count++;
+}
+
+void record_graph_barriers(render_graph &graph, VkCommandBuffer command_buffer, uint32_t first_barrier, uint32_t barrier_count)
+{
+    if (barrier_count == 0)
+    {
+        return;
+    }
+    graph.image_barrier_scratch.clear();
+    graph.buffer_barrier_scratch.clear();
+    for (uint32_t i = first_barrier; i < first_barrier + barrier_count; i++)
+    {
+        auto const &barrier = graph.barriers[i];
+        auto const &resource = graph.resources.at(barrier.resource);
+        if (resource.is_image)
+        {
+            graph.image_barrier_scratch.push_back(VkImageMemoryBarrier2{
+                .sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER_2,
+                .srcStageMask = barrier.src.stage_mask,
+                .srcAccessMask = barrier.src.access_mask,
+                .dstStageMask = barrier.dst.stage_mask,
+                .dstAccessMask = barrier.dst.access_mask,
+                .oldLayout = barrier.src.layout,
+                .newLayout = barrier.dst.layout,
+                .srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+                .dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+                .image = resource.image,
+                .subresourceRange = resource.subresource_range,
+            });
+        }
+        else
+        {
+            graph.buffer_barrier_scratch.push_back(VkBufferMemoryBarrier2{
+                .sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER_2,
+                .srcStageMask = barrier.src.stage_mask,
+                .srcAccessMask = barrier.src.access_mask,
+                .dstStageMask = barrier.dst.stage_mask,
+                .dstAccessMask = barrier.dst.access_mask,
+                .srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+                .dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+                .buffer = resource.buffer,
+                .offset = 0,
+                .size = VK_WHOLE_SIZE,
+            });
+        }
+    }
+    VkDependencyInfo dependency_info{
+        .sType = VK_STRUCTURE_TYPE_DEPENDENCY_INFO,
+        .bufferMemoryBarrierCount = static_cast<uint32_t>(graph.buffer_barrier_scratch.size()),
+        .pBufferMemoryBarriers = graph.buffer_barrier_scratch.data(),
+        .imageMemoryBarrierCount = static_cast<uint32_t>(graph.image_barrier_scratch.size()),
+        .pImageMemoryBarriers = graph.image_barrier_scratch.data(),
+    };
+    vkCmdPipelineBarrier2(command_buffer, &dependency_info);
+}
+
+VkResult prepare_render_graph(render_graph &graph, gpu_allocator &allocator, transient_pool &transients, uint64_t retire_value)
+{
+    uint64_t topology_hash = hash_graph_topology(graph);
+    if (!graph.compiled || topology_hash != graph.topology_hash)
+    {
+        compile_render_graph(graph);
+        graph.topology_hash = topology_hash;
+        if (!graph.transient_requests.empty() || !transients.images.empty())
+        {
+            VkResult err = build_transient_images(allocator, transients, graph.transient_requests, retire_value);
+            if (err != VK_SUCCESS)
+            {
+                graph.compiled = false; // Try again next frame
+                return err;
+            }
+        }
+    }
+    for (size_t i = 0; i < graph.transient_resources.size(); i++)
+    {
+        auto &resource = graph.resources[graph.transient_resources[i]];
+        resource.image = transients.images[i].image;
+        resource.view = transients.images[i].view;
+    }
+    return VK_SUCCESS;
+}
+
+void execute_render_graph(render_graph &graph, VkCommandBuffer command_buffer)
+{
+    for (auto const &compiled_pass : graph.compiled_passes)
+    {
+        record_graph_barriers(graph, command_buffer, compiled_pass.first_barrier, compiled_pass.barrier_count);
+        graph.passes.at(compiled_pass.pass_index).record(command_buffer);
+    }
+    record_graph_barriers(graph, command_buffer, graph.first_final_barrier, static_cast<uint32_t>(graph.barriers.size()) - graph.first_final_barrier);
+    graph.execute_count++;
+}
+
+void print_render_graph_stats(render_graph const &graph)
+{
+    fmt::print("Render graph: compiled {} times in {} frames, {} passes and {} barriers, {} passes culled\n", graph.compile_count, graph.execute_count,
+               graph.compiled_passes.size(), graph.barriers.size(), graph.culled_pass_count);
+}
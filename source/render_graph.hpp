@@ -0,0 +1,134 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <functional>
+#include <initializer_list>
+
+#include <vulkan/vulkan_core.h>
+
+#include "transient_pool.hpp"
+
+// How a pass uses a resource, each maps to the stages, accesses, and image layout of that use
+enum class graph_usage
+{
+    color_attachment,       // Written, or read and written with LOAD_OP_LOAD
+    depth_attachment,       // Tested and written
+    depth_read,             // Tested only
+    sampled,                // Read by fragment or compute shaders
+    storage_read,           // Compute shaders
+    storage_write,          // Compute shaders, read and written
+    vertex_read,            // Index buffers and vertex pulling
+    transfer_source,
+    transfer_destination,
+    present,                // Final state of swapchain images
+};
+
+struct graph_resource_state
+{
+    VkPipelineStageFlags2 stage_mask = VK_PIPELINE_STAGE_2_NONE;
+    VkAccessFlags2 access_mask = VK_ACCESS_2_NONE;
+    VkImageLayout layout = VK_IMAGE_LAYOUT_UNDEFINED; // Ignored for buffers
+};
+
+graph_resource_state graph_usage_state(graph_usage usage);
+
+// Index into render_graph::resources, only valid for the frame it was declared in
+using graph_resource = uint32_t;
+
+struct graph_use
+{
+    graph_resource resource;
+    graph_usage usage;
+};
+
+// Passes and the resources they use are declared again every frame, in submission order. Compiling derives the
+// barriers between passes from the declared uses, one vkCmdPipelineBarrier2 per pass covering every resource it
+// needs, and culls passes whose writes nothing reads. The compiled result only depends on the topology, the passes,
+// their uses, and the resources' descriptions, so it is reused as long as that stays the same and only the VkImage and
+// VkBuffer handles are patched in when it is executed. Images created by the graph are transient, they get their
+// memory from a transient_pool sized and aliased by the lifetimes the compilation found.
+struct render_graph
+{
+    struct resource
+    {
+        std::string name;
+        bool is_image = false;
+        bool transient = false;
+        transient_image_desc desc{}; // Only for transient images
+        VkImage image{};
+        VkImageView view{}; // Only for transient images, filled in by prepare_render_graph
+        VkBuffer buffer{};
+        VkImageSubresourceRange subresource_range{};
+        graph_resource_state initial{}; // State left by whatever ran before the graph
+        graph_resource_state final{};   // Transitioned to after the last pass. Stage NONE means nothing reads the
+                                        // resource after the graph, passes writing only it are culled.
+    };
+    struct pass
+    {
+        std::string name;
+        std::vector<graph_use> uses;
+        std::function<void(VkCommandBuffer)> record;
+        bool keep = false; // Never culled, for passes with side effects outside the graph
+    };
+    std::vector<resource> resources;
+    std::vector<pass> passes;
+
+    // Barriers refer to resources by index, their handles are filled in when executing
+    struct barrier
+    {
+        graph_resource resource;
+        graph_resource_state src;
+        graph_resource_state dst;
+    };
+    struct compiled_pass
+    {
+        uint32_t pass_index;
+        uint32_t first_barrier;
+        uint32_t barrier_count;
+    };
+    bool compiled = false;
+    uint64_t topology_hash = 0;
+    std::vector<compiled_pass> compiled_passes;
+    std::vector<barrier> barriers;
+    uint32_t first_final_barrier = 0; // Barriers from here on come after the last pass
+    std::vector<transient_image_request> transient_requests;
+    std::vector<graph_resource> transient_resources; // The resource each transient request is for
+
+    uint64_t compile_count = 0;
+    uint64_t execute_count = 0;
+    uint32_t culled_pass_count = 0; // In the current compilation
+
+    std::vector<VkImageMemoryBarrier2> image_barrier_scratch;
+    std::vector<VkBufferMemoryBarrier2> buffer_barrier_scratch;
+};
+
+// Drops the previous frame's declarations, the compiled graph is kept
+void begin_render_graph(render_graph &graph);
+
+graph_resource import_graph_image(render_graph &graph, std::string name, VkImage image, VkImageSubresourceRange const &subresource_range,
+                                  graph_resource_state const &initial, graph_resource_state const &final);
+graph_resource import_graph_buffer(render_graph &graph, std::string name, VkBuffer buffer, graph_resource_state const &initial,
+                                   graph_resource_state const &final);
+
+// Contents are undefined when the first pass using it starts and are gone after the last one
+graph_resource create_graph_image(render_graph &graph, std::string name, transient_image_desc const &desc);
+
+// Only valid while recording passes
+VkImageView graph_image_view(render_graph const &graph, graph_resource resource);
+
+// record is called while executing with the barriers for uses already recorded. A resource used more than once in a
+// pass must be used with the same image layout every time.
+void add_graph_pass(render_graph &graph, std::string name, std::initializer_list<graph_use> uses, std::function<void(VkCommandBuffer)> record,
+                    bool keep = false);
+
+// Recompiles when the topology changed since the last compile, rebuilding the transient images along with it, and
+// patches the transient images into this frame's resources. The images replaced by a rebuild are retired until the
+// frame timeline reaches retire_value.
+VkResult prepare_render_graph(render_graph &graph, gpu_allocator &allocator, transient_pool &transients, uint64_t retire_value);
+
+// Records every pass that wasn't culled, the graph has to be prepared first
+void execute_render_graph(render_graph &graph, VkCommandBuffer command_buffer);
+
+void print_render_graph_stats(render_graph const &graph);
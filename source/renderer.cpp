@@ -1,7 +1,10 @@
 #include "renderer.hpp"
+#include "cpu_profiler.hpp"
 
-#include <fstream>
+#include <cstring>
 #include <cstdlib>
+#include <chrono>
+#include <algorithm>
 
 #include <fmt/format.h>
 #include <magic_enum.hpp>
@@ -9,16 +12,23 @@
 static constexpr VkImageSubresourceRange single_color_image_subresource_range{VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1};
 
 static const std::vector<const char *> required_device_extensions{
-    "VK_KHR_swapchain", "VK_KHR_maintenance5"};
+    "VK_KHR_maintenance5"};
+
+// Only required when presenting to a window
+static const std::vector<const char *> required_presentation_device_extensions{
+    "VK_KHR_swapchain"};
 
 VkResult init_instance(init_settings &settings, renderer &rend)
 {
-    uint32_t glfw_extension_count = 0;
-    const char **required_glfw_extensions = glfwGetRequiredInstanceExtensions(&glfw_extension_count);
     std::vector<const char *> required_instance_extensions;
-    for (uint32_t i = 0; i < glfw_extension_count; i++)
+    if (!rend.headless)
     {
-        required_instance_extensions.push_back(required_glfw_extensions[i]);
+        uint32_t glfw_extension_count = 0;
+        const char **required_glfw_extensions = glfwGetRequiredInstanceExtensions(&glfw_extension_count);
+        for (uint32_t i = 0; i < glfw_extension_count; i++)
+        {
+            required_instance_extensions.push_back(required_glfw_extensions[i]);
+        }
     }
     VkApplicationInfo app_create_info{
         .sType = VK_STRUCTURE_TYPE_APPLICATION_INFO,
@@ -41,7 +51,11 @@ VkResult init_instance(init_settings &settings, renderer &rend)
         return VK_ERROR_INITIALIZATION_FAILED;
     }
 
-    VkSurfaceKHR surface{};
+    if (rend.headless)
+    {
+        return VK_SUCCESS;
+    }
+
     err = glfwCreateWindowSurface(rend.inst, rend.glfw_window, NULL, &rend.surface);
     if (err != VK_SUCCESS)
     {
@@ -60,22 +74,51 @@ VkResult validate_physical_device(renderer &rend, VkPhysicalDevice physical_devi
     fmt::print("Using physical device {} with api version {}.{}.{}\n", physical_device_properties.deviceName,
                VK_API_VERSION_MAJOR(version), VK_API_VERSION_MINOR(version), VK_API_VERSION_PATCH(version));
 
-    if (!glfwGetPhysicalDevicePresentationSupport(rend.inst, physical_device, 0))
+    uint32_t queue_family_count = 0;
+    vkGetPhysicalDeviceQueueFamilyProperties(physical_device, &queue_family_count, nullptr);
+    std::vector<VkQueueFamilyProperties> queue_family_properties(queue_family_count);
+    vkGetPhysicalDeviceQueueFamilyProperties(physical_device, &queue_family_count, queue_family_properties.data());
+
+    // Graphics families implicitly support transfers
+    bool found_graphics_family = false;
+    for (uint32_t i = 0; i < queue_family_count && !found_graphics_family; i++)
+    {
+        VkQueueFlags flags = queue_family_properties[i].queueFlags;
+        if ((flags & VK_QUEUE_GRAPHICS_BIT) && (flags & VK_QUEUE_COMPUTE_BIT) &&
+            (rend.headless || glfwGetPhysicalDevicePresentationSupport(rend.inst, physical_device, i)))
+        {
+            rend.queue_families.graphics = i;
+            found_graphics_family = true;
+        }
+    }
+    if (!found_graphics_family)
     {
-        fmt::print("Physical Device does not support presentation");
+        fmt::print("VkPhysicalDevice has no queue family supporting graphics, compute{}", rend.headless ? "" : ", and presentation");
         return VK_ERROR_INITIALIZATION_FAILED;
     }
 
-    uint32_t queue_count = 1;
-    VkQueueFamilyProperties queue_family_properties{};
-    vkGetPhysicalDeviceQueueFamilyProperties(physical_device, &queue_count, &queue_family_properties);
-    if ((queue_family_properties.queueFlags & VK_QUEUE_GRAPHICS_BIT) == 0 ||
-        (queue_family_properties.queueFlags & VK_QUEUE_COMPUTE_BIT) == 0 ||
-        (queue_family_properties.queueFlags & VK_QUEUE_TRANSFER_BIT) == 0)
+    // Dedicated families usually map to separate hardware queues that run alongside rasterization
+    rend.queue_families.compute = rend.queue_families.graphics;
+    for (uint32_t i = 0; i < queue_family_count; i++)
     {
-        fmt::print("VkPhysicalDevice's first queue doesn't support all required queue operations of graphics, compute, and transfer");
-        return VK_ERROR_INITIALIZATION_FAILED;
+        VkQueueFlags flags = queue_family_properties[i].queueFlags;
+        if ((flags & VK_QUEUE_COMPUTE_BIT) && !(flags & VK_QUEUE_GRAPHICS_BIT))
+        {
+            rend.queue_families.compute = i;
+            break;
+        }
+    }
+    rend.queue_families.transfer = rend.queue_families.compute;
+    for (uint32_t i = 0; i < queue_family_count; i++)
+    {
+        VkQueueFlags flags = queue_family_properties[i].queueFlags;
+        if ((flags & VK_QUEUE_TRANSFER_BIT) && !(flags & (VK_QUEUE_GRAPHICS_BIT | VK_QUEUE_COMPUTE_BIT)))
+        {
+            rend.queue_families.transfer = i;
+            break;
+        }
     }
+    rend.queue_families.transfer_granularity = queue_family_properties[rend.queue_families.transfer].minImageTransferGranularity;
 
     std::vector<VkExtensionProperties> available_device_extensions{};
     uint32_t device_extension_count = 0;
@@ -93,7 +136,13 @@ VkResult validate_physical_device(renderer &rend, VkPhysicalDevice physical_devi
         return VK_ERROR_INITIALIZATION_FAILED;
     }
 
-    for (const auto &required_ext : required_device_extensions)
+    std::vector<const char *> device_extensions = required_device_extensions;
+    if (!rend.headless)
+    {
+        device_extensions.insert(device_extensions.end(), required_presentation_device_extensions.begin(), required_presentation_device_extensions.end());
+    }
+
+    for (const auto &required_ext : device_extensions)
     {
         bool found = false;
         for (const auto &avail_ext : available_device_extensions)
@@ -135,11 +184,21 @@ VkResult validate_physical_device(renderer &rend, VkPhysicalDevice physical_devi
     // Required Physical Device Features across all versions
 
     if (
+        available_physical_device_features.features.shaderInt64 != VK_TRUE ||
+
         available_features_1_2.timelineSemaphore != VK_TRUE ||
         available_features_1_2.bufferDeviceAddress != VK_TRUE ||
         available_features_1_2.descriptorIndexing != VK_TRUE ||
         available_features_1_2.uniformBufferStandardLayout != VK_TRUE ||
         available_features_1_2.descriptorBindingPartiallyBound != VK_TRUE ||
+        available_features_1_2.runtimeDescriptorArray != VK_TRUE ||
+        available_features_1_2.shaderSampledImageArrayNonUniformIndexing != VK_TRUE ||
+        available_features_1_2.shaderStorageImageArrayNonUniformIndexing != VK_TRUE ||
+        available_features_1_2.shaderStorageBufferArrayNonUniformIndexing != VK_TRUE ||
+        available_features_1_2.descriptorBindingSampledImageUpdateAfterBind != VK_TRUE ||
+        available_features_1_2.descriptorBindingStorageImageUpdateAfterBind != VK_TRUE ||
+        available_features_1_2.descriptorBindingStorageBufferUpdateAfterBind != VK_TRUE ||
+        available_features_1_2.descriptorBindingUpdateUnusedWhilePending != VK_TRUE ||
 
         available_features_1_3.dynamicRendering != VK_TRUE ||
         available_features_1_3.maintenance4 != VK_TRUE ||
@@ -151,13 +210,52 @@ VkResult validate_physical_device(renderer &rend, VkPhysicalDevice physical_devi
         return VK_ERROR_INITIALIZATION_FAILED;
     }
 
-    err = vkGetPhysicalDeviceSurfaceCapabilitiesKHR(physical_device, rend.surface, &rend.surface_capabilities);
-    if (err != VK_SUCCESS)
+    if (!rend.headless)
     {
-        fmt::print("Unable to get physical device surface capabilities with err {}", magic_enum::enum_name(err));
-        return VK_ERROR_INITIALIZATION_FAILED;
+        err = vkGetPhysicalDeviceSurfaceCapabilitiesKHR(physical_device, rend.surface, &rend.surface_capabilities);
+        if (err != VK_SUCCESS)
+        {
+            fmt::print("Unable to get physical device surface capabilities with err {}", magic_enum::enum_name(err));
+            return VK_ERROR_INITIALIZATION_FAILED;
+        }
+    }
+
+    rend.pipeline_statistics_supported = available_physical_device_features.features.pipelineStatisticsQuery == VK_TRUE;
+    rend.inherited_queries_supported = available_physical_device_features.features.inheritedQueries == VK_TRUE;
+
+    // Present wait gives the frame pacer exact present timings, without it the pacer falls back to a CPU timing model
+    rend.present_wait_supported = false;
+    if (!rend.headless)
+    {
+        auto is_available = [&](const char *extension)
+        {
+            return std::any_of(available_device_extensions.begin(), available_device_extensions.end(),
+                               [&](VkExtensionProperties const &avail_ext) { return strcmp(extension, avail_ext.extensionName) == 0; });
+        };
+        if (is_available(VK_KHR_PRESENT_ID_EXTENSION_NAME) && is_available(VK_KHR_PRESENT_WAIT_EXTENSION_NAME))
+        {
+            VkPhysicalDevicePresentWaitFeaturesKHR available_features_present_wait{
+                .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PRESENT_WAIT_FEATURES_KHR,
+            };
+            VkPhysicalDevicePresentIdFeaturesKHR available_features_present_id{
+                .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PRESENT_ID_FEATURES_KHR,
+                .pNext = &available_features_present_wait,
+            };
+            VkPhysicalDeviceFeatures2 available_present_features{
+                .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2,
+                .pNext = &available_features_present_id,
+            };
+            vkGetPhysicalDeviceFeatures2(physical_device, &available_present_features);
+            if (available_features_present_id.presentId == VK_TRUE && available_features_present_wait.presentWait == VK_TRUE)
+            {
+                device_extensions.push_back(VK_KHR_PRESENT_ID_EXTENSION_NAME);
+                device_extensions.push_back(VK_KHR_PRESENT_WAIT_EXTENSION_NAME);
+                rend.present_wait_supported = true;
+            }
+        }
     }
 
+    rend.enabled_device_extensions = device_extensions;
     return VK_SUCCESS;
 }
 
@@ -197,8 +295,20 @@ VkResult choose_physical_device(init_settings &settings, renderer &rend)
 VkResult init_device(init_settings &settings, renderer &rend)
 {
 
+    VkPhysicalDevicePresentWaitFeaturesKHR enabled_features_present_wait{
+        .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PRESENT_WAIT_FEATURES_KHR,
+        .presentWait = VK_TRUE,
+    };
+
+    VkPhysicalDevicePresentIdFeaturesKHR enabled_features_present_id{
+        .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PRESENT_ID_FEATURES_KHR,
+        .pNext = &enabled_features_present_wait,
+        .presentId = VK_TRUE,
+    };
+
     VkPhysicalDeviceMaintenance5FeaturesKHR enabled_features_maintenance5{
         .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_MAINTENANCE_5_FEATURES_KHR,
+        .pNext = rend.present_wait_supported ? &enabled_features_present_id : nullptr,
         .maintenance5 = VK_TRUE,
     };
 
@@ -214,7 +324,15 @@ VkResult init_device(init_settings &settings, renderer &rend)
         .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_2_FEATURES,
         .pNext = &enabled_features_1_3,
         .descriptorIndexing = VK_TRUE,
+        .shaderSampledImageArrayNonUniformIndexing = VK_TRUE,
+        .shaderStorageBufferArrayNonUniformIndexing = VK_TRUE,
+        .shaderStorageImageArrayNonUniformIndexing = VK_TRUE,
+        .descriptorBindingSampledImageUpdateAfterBind = VK_TRUE,
+        .descriptorBindingStorageImageUpdateAfterBind = VK_TRUE,
+        .descriptorBindingStorageBufferUpdateAfterBind = VK_TRUE,
+        .descriptorBindingUpdateUnusedWhilePending = VK_TRUE,
         .descriptorBindingPartiallyBound = VK_TRUE,
+        .runtimeDescriptorArray = VK_TRUE,
         .uniformBufferStandardLayout = VK_TRUE,
         .timelineSemaphore = VK_TRUE,
         .bufferDeviceAddress = VK_TRUE,
@@ -225,26 +343,44 @@ VkResult init_device(init_settings &settings, renderer &rend)
         enabled_features_1_1.pNext = &enabled_features_1_2,
     };
 
+    // shaderInt64 is needed for the 64-bit device addresses shaders pull vertices through. Pipeline statistics are only
+    // turned on for the GPU profiler, inherited queries let them cover draws recorded into secondary command buffers.
+    bool pipeline_statistics = settings.gpu_pipeline_statistics && rend.pipeline_statistics_supported;
+    rend.inherited_queries_supported = pipeline_statistics && rend.inherited_queries_supported;
     VkPhysicalDeviceFeatures2 enabled_physical_device_features{
         .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2,
         .pNext = &enabled_features_1_1,
+        .features = {
+            .pipelineStatisticsQuery = pipeline_statistics ? VK_TRUE : VK_FALSE,
+            .shaderInt64 = VK_TRUE,
+            .inheritedQueries = rend.inherited_queries_supported ? VK_TRUE : VK_FALSE,
+        },
     };
 
+    // One queue per distinct family, roles sharing a family share its queue
     float queue_priority = 1.0f;
-    VkDeviceQueueCreateInfo queue_create_infos{
-        .sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO,
-        .queueFamilyIndex = 0,
-        .queueCount = 1,
-        .pQueuePriorities = &queue_priority,
-    };
+    std::vector<VkDeviceQueueCreateInfo> queue_create_infos;
+    for (uint32_t family_index : {rend.queue_families.graphics, rend.queue_families.compute, rend.queue_families.transfer})
+    {
+        if (std::none_of(queue_create_infos.begin(), queue_create_infos.end(),
+                         [family_index](VkDeviceQueueCreateInfo const &info) { return info.queueFamilyIndex == family_index; }))
+        {
+            queue_create_infos.push_back(VkDeviceQueueCreateInfo{
+                .sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO,
+                .queueFamilyIndex = family_index,
+                .queueCount = 1,
+                .pQueuePriorities = &queue_priority,
+            });
+        }
+    }
 
     VkDeviceCreateInfo device_create_info{
         .sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO,
         .pNext = &enabled_physical_device_features,
-        .queueCreateInfoCount = 1,
-        .pQueueCreateInfos = &queue_create_infos,
-        .enabledExtensionCount = static_cast<uint32_t>(required_device_extensions.size()),
-        .ppEnabledExtensionNames = required_device_extensions.data(),
+        .queueCreateInfoCount = static_cast<uint32_t>(queue_create_infos.size()),
+        .pQueueCreateInfos = queue_create_infos.data(),
+        .enabledExtensionCount = static_cast<uint32_t>(rend.enabled_device_extensions.size()),
+        .ppEnabledExtensionNames = rend.enabled_device_extensions.data(),
     };
     VkResult err = vkCreateDevice(rend.physical_device, &device_create_info, nullptr, &rend.device);
     if (err != VK_SUCCESS)
@@ -253,96 +389,114 @@ VkResult init_device(init_settings &settings, renderer &rend)
         return VK_ERROR_INITIALIZATION_FAILED;
     }
 
-    vkGetDeviceQueue(rend.device, 0, 0, &rend.main_queue);
+    vkGetDeviceQueue(rend.device, rend.queue_families.graphics, 0, &rend.main_queue);
+    if (init_gpu_queue(rend.device, rend.queue_families.compute, 0, rend.compute_queue) != VK_SUCCESS ||
+        init_gpu_queue(rend.device, rend.queue_families.transfer, 0, rend.transfer_queue) != VK_SUCCESS)
+    {
+        return VK_ERROR_INITIALIZATION_FAILED;
+    }
+    fmt::print("Using queue families {} for graphics, {} for compute, and {} for transfers\n", rend.queue_families.graphics,
+               rend.queue_families.compute, rend.queue_families.transfer);
     return VK_SUCCESS;
 }
-VkResult init_swapchain(init_settings &settings, renderer &rend)
+void destroy_swapchain_frames(renderer &rend, std::vector<swapchain_frame> &frames)
 {
+    for (auto &frame : frames)
+    {
+        vkDestroyImageView(rend.device, frame.image_view, nullptr);
+        vkDestroySemaphore(rend.device, frame.present_semaphore, nullptr);
+    }
+    frames.clear();
+}
 
-    uint32_t surface_format_count = 0;
-    std::vector<VkSurfaceFormatKHR> surface_formats{};
-    VkResult err = vkGetPhysicalDeviceSurfaceFormatsKHR(rend.physical_device, rend.surface, &surface_format_count, nullptr);
+// Creates the swapchain, or recreates it in place when one exists by passing it as oldSwapchain. Frames still in flight
+// keep using the old one until they complete, so the device never has to go idle. Returns VK_NOT_READY while the window
+// is minimized.
+VkResult create_swapchain(renderer &rend)
+{
+    VkResult err = vkGetPhysicalDeviceSurfaceCapabilitiesKHR(rend.physical_device, rend.surface, &rend.surface_capabilities);
     if (err != VK_SUCCESS)
     {
-        fmt::print("Cannot get count of VkSurfaceFormatKHRs with error code {}", magic_enum::enum_name(err));
-        return VK_ERROR_INITIALIZATION_FAILED;
+        fmt::print("Unable to get physical device surface capabilities with err {}", magic_enum::enum_name(err));
+        return err;
     }
-    surface_formats.resize(surface_format_count, VkSurfaceFormatKHR{});
-    err = vkGetPhysicalDeviceSurfaceFormatsKHR(rend.physical_device, rend.surface, &surface_format_count, surface_formats.data());
-    if (err != VK_SUCCESS)
+    auto const &capabilities = rend.surface_capabilities;
+    int width = 0, height = 0;
+    glfwGetFramebufferSize(rend.glfw_window, &width, &height);
+    VkExtent2D extent = capabilities.currentExtent;
+    if (extent.width == UINT32_MAX)
     {
-        fmt::print("Cannot get VkSurfaceFormatKHRs with error code {}", magic_enum::enum_name(err));
-        return VK_ERROR_INITIALIZATION_FAILED;
+        // The surface size is determined by the swapchain, follow the window
+        extent.width = std::clamp(static_cast<uint32_t>(width), capabilities.minImageExtent.width, capabilities.maxImageExtent.width);
+        extent.height = std::clamp(static_cast<uint32_t>(height), capabilities.minImageExtent.height, capabilities.maxImageExtent.height);
     }
-    rend.swapchain_image_format = VK_FORMAT_R8G8B8A8_SRGB;
-    bool swapchain_image_format_found = false;
-    for (const auto &format : surface_formats)
+    if (extent.width == 0 || extent.height == 0)
     {
-        if (rend.swapchain_image_format == format.format)
-        {
-            swapchain_image_format_found = true;
-            rend.swapchain_image_colorspace = format.colorSpace;
-            break;
-        }
+        return VK_NOT_READY;
     }
-    if (!swapchain_image_format_found)
+    uint32_t image_count = std::max(rend.requested_swapchain_image_count, capabilities.minImageCount);
+    if (capabilities.maxImageCount != 0)
     {
-        rend.swapchain_image_format = VK_FORMAT_B8G8R8A8_SRGB;
-        for (const auto &format : surface_formats)
-        {
-            if (rend.swapchain_image_format == format.format)
-            {
-                swapchain_image_format_found = true;
-                rend.swapchain_image_colorspace = format.colorSpace;
-                break;
-            }
-        }
-        if (!swapchain_image_format_found)
-        {
-            fmt::print("Cannot find suitable swapchain image format");
-            return VK_ERROR_INITIALIZATION_FAILED;
-        }
+        image_count = std::min(image_count, capabilities.maxImageCount);
     }
 
+    VkSwapchainKHR old_swapchain = rend.swapchain;
     VkSwapchainCreateInfoKHR swapchain_create_info{
         .sType = VK_STRUCTURE_TYPE_SWAPCHAIN_CREATE_INFO_KHR,
         .surface = rend.surface,
-        .minImageCount = (rend.surface_capabilities.minImageCount > 3) ? rend.surface_capabilities.minImageCount : 3,
+        .minImageCount = image_count,
         .imageFormat = rend.swapchain_image_format,
         .imageColorSpace = rend.swapchain_image_colorspace,
-        .imageExtent = VkExtent2D{static_cast<uint32_t>(settings.window_width), static_cast<uint32_t>(settings.window_height)},
+        .imageExtent = extent,
         .imageArrayLayers = 1,
-        .imageUsage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT,
+        // Blitting the compute background needs TRANSFER_DST, without it the backbuffer is cleared instead
+        .imageUsage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | (capabilities.supportedUsageFlags & VK_IMAGE_USAGE_TRANSFER_DST_BIT),
         .imageSharingMode = VK_SHARING_MODE_EXCLUSIVE,
         .queueFamilyIndexCount = 0,
         .pQueueFamilyIndices = nullptr,
         .preTransform = VK_SURFACE_TRANSFORM_IDENTITY_BIT_KHR,
         .compositeAlpha = VK_COMPOSITE_ALPHA_OPAQUE_BIT_KHR,
-        .presentMode = VK_PRESENT_MODE_FIFO_KHR,
+        .presentMode = rend.present_mode,
         .clipped = false,
+        .oldSwapchain = old_swapchain,
     };
     err = vkCreateSwapchainKHR(rend.device, &swapchain_create_info, nullptr, &rend.swapchain);
+
+    // The old swapchain is retired even when creating the new one failed
+    if (old_swapchain != VK_NULL_HANDLE)
+    {
+        rend.retired_swapchains.push_back(retired_swapchain{
+            .swapchain = old_swapchain,
+            .frames = std::move(rend.swapchain_frames),
+            .timeline_value = current_frame_value(rend),
+        });
+        rend.swapchain_frames.clear();
+        reset_present_wait(rend.pacer);
+    }
     if (err != VK_SUCCESS)
     {
         fmt::print("Failed to create swapchain with error code {}", magic_enum::enum_name(err));
-        return VK_ERROR_INITIALIZATION_FAILED;
+        rend.swapchain = VK_NULL_HANDLE;
+        return err;
     }
 
-    rend.swapchain_image_render_area.extent = {static_cast<uint32_t>(settings.window_width), static_cast<uint32_t>(settings.window_height)};
+    rend.swapchain_image_render_area.extent = extent;
+    rend.swapchain_framebuffer_size = {static_cast<uint32_t>(width), static_cast<uint32_t>(height)};
+    rend.swapchain_out_of_date = false;
 
     uint32_t swapchain_image_count = 0;
     err = vkGetSwapchainImagesKHR(rend.device, rend.swapchain, &swapchain_image_count, nullptr);
     if (err != VK_SUCCESS)
     {
         fmt::print("Failed to get swapchain image count with code {}", magic_enum::enum_name(err));
-        return VK_ERROR_INITIALIZATION_FAILED;
+        return err;
     }
     std::vector<VkImage> swapchain_images(swapchain_image_count, VkImage{});
     err = vkGetSwapchainImagesKHR(rend.device, rend.swapchain, &swapchain_image_count, swapchain_images.data());
     if (err != VK_SUCCESS)
     {
         fmt::print("Failed to get swapchain image count with code {}", magic_enum::enum_name(err));
-        return VK_ERROR_INITIALIZATION_FAILED;
+        return err;
     }
     rend.swapchain_frames.resize(swapchain_image_count, {});
 
@@ -365,169 +519,368 @@ VkResult init_swapchain(init_settings &settings, renderer &rend)
         if (err != VK_SUCCESS)
         {
             fmt::print("Failed to create swapchain image view with code {}", magic_enum::enum_name(err));
-            return VK_ERROR_INITIALIZATION_FAILED;
+            return err;
+        }
+        VkSemaphoreCreateInfo semaphore_create_info{
+            .sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO,
+        };
+        err = vkCreateSemaphore(rend.device, &semaphore_create_info, nullptr, &swapchain_frame.present_semaphore);
+        if (err != VK_SUCCESS)
+        {
+            fmt::print("Failed to create present semaphore with code {}", magic_enum::enum_name(err));
+            return err;
         }
     }
     return VK_SUCCESS;
 }
-VkResult init_frame_data(init_settings &settings, renderer &rend)
+
+VkResult init_swapchain(init_settings &settings, renderer &rend)
 {
 
-    VkCommandPoolCreateInfo command_buffer_create_info{
-        .sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO,
-        .flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT,
-        .queueFamilyIndex = 0,
-    };
-    VkResult err = vkCreateCommandPool(rend.device, &command_buffer_create_info, nullptr, &rend.submission_command_pool);
+    uint32_t surface_format_count = 0;
+    std::vector<VkSurfaceFormatKHR> surface_formats{};
+    VkResult err = vkGetPhysicalDeviceSurfaceFormatsKHR(rend.physical_device, rend.surface, &surface_format_count, nullptr);
     if (err != VK_SUCCESS)
     {
-        fmt::print("Failed to create command pool with error code {}", magic_enum::enum_name(err));
+        fmt::print("Cannot get count of VkSurfaceFormatKHRs with error code {}", magic_enum::enum_name(err));
         return VK_ERROR_INITIALIZATION_FAILED;
     }
-    VkCommandBufferAllocateInfo command_buffer_allocate_info{
-        .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO,
-        .commandPool = rend.submission_command_pool,
-        .level = VK_COMMAND_BUFFER_LEVEL_PRIMARY,
-        .commandBufferCount = static_cast<uint32_t>(rend.swapchain_frames.size()),
-    };
-    std::vector<VkCommandBuffer> command_buffers(rend.swapchain_frames.size(), {});
-    err = vkAllocateCommandBuffers(rend.device, &command_buffer_allocate_info, command_buffers.data());
+    surface_formats.resize(surface_format_count, VkSurfaceFormatKHR{});
+    err = vkGetPhysicalDeviceSurfaceFormatsKHR(rend.physical_device, rend.surface, &surface_format_count, surface_formats.data());
     if (err != VK_SUCCESS)
     {
-        fmt::print("Failed to create command buffers with error code {}", magic_enum::enum_name(err));
+        fmt::print("Cannot get VkSurfaceFormatKHRs with error code {}", magic_enum::enum_name(err));
         return VK_ERROR_INITIALIZATION_FAILED;
     }
+    rend.swapchain_image_format = VK_FORMAT_R8G8B8A8_SRGB;
+    bool swapchain_image_format_found = false;
+    for (const auto &format : surface_formats)
+    {
+        if (rend.swapchain_image_format == format.format)
+        {
+            swapchain_image_format_found = true;
+            rend.swapchain_image_colorspace = format.colorSpace;
+            break;
+        }
+    }
+    if (!swapchain_image_format_found)
+    {
+        rend.swapchain_image_format = VK_FORMAT_B8G8R8A8_SRGB;
+        for (const auto &format : surface_formats)
+        {
+            if (rend.swapchain_image_format == format.format)
+            {
+                swapchain_image_format_found = true;
+                rend.swapchain_image_colorspace = format.colorSpace;
+                break;
+            }
+        }
+        if (!swapchain_image_format_found)
+        {
+            fmt::print("Cannot find suitable swapchain image format");
+            return VK_ERROR_INITIALIZATION_FAILED;
+        }
+    }
 
-    // Double buffer the work we submit onto the GPU
-    rend.submission_frames.resize(2, {});
-    rend.submission_frames.at(0).command_buffer = command_buffers.at(0);
-    rend.submission_frames.at(1).command_buffer = command_buffers.at(1);
-    for (auto &submission_frame : rend.submission_frames)
+    uint32_t present_mode_count = 0;
+    err = vkGetPhysicalDeviceSurfacePresentModesKHR(rend.physical_device, rend.surface, &present_mode_count, nullptr);
+    if (err != VK_SUCCESS)
+    {
+        fmt::print("Cannot get count of VkPresentModeKHRs with error code {}", magic_enum::enum_name(err));
+        return VK_ERROR_INITIALIZATION_FAILED;
+    }
+    std::vector<VkPresentModeKHR> present_modes(present_mode_count);
+    err = vkGetPhysicalDeviceSurfacePresentModesKHR(rend.physical_device, rend.surface, &present_mode_count, present_modes.data());
+    if (err != VK_SUCCESS)
+    {
+        fmt::print("Cannot get VkPresentModeKHRs with error code {}", magic_enum::enum_name(err));
+        return VK_ERROR_INITIALIZATION_FAILED;
+    }
+    rend.present_mode = VK_PRESENT_MODE_FIFO_KHR;
+    if (std::find(present_modes.begin(), present_modes.end(), settings.present_mode) != present_modes.end())
     {
+        rend.present_mode = settings.present_mode;
+    }
+    else
+    {
+        fmt::print("Present mode {} is not supported by the surface, using FIFO\n", magic_enum::enum_name(settings.present_mode));
+    }
+    rend.requested_swapchain_image_count = settings.swapchain_image_count;
 
-        VkSemaphoreCreateInfo semaphore_create_info{};
-        semaphore_create_info.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+    err = create_swapchain(rend);
+    if (err != VK_SUCCESS)
+    {
+        return VK_ERROR_INITIALIZATION_FAILED;
+    }
+    return VK_SUCCESS;
+}
 
-        err = vkCreateSemaphore(rend.device, &semaphore_create_info, nullptr, &submission_frame.acquire_swapchain_semaphore);
-        if (err != VK_SUCCESS)
+VkResult choose_depth_format(renderer &rend)
+{
+    for (VkFormat format : {VK_FORMAT_D32_SFLOAT, VK_FORMAT_X8_D24_UNORM_PACK32, VK_FORMAT_D16_UNORM})
+    {
+        VkFormatProperties format_properties{};
+        vkGetPhysicalDeviceFormatProperties(rend.physical_device, format, &format_properties);
+        if (format_properties.optimalTilingFeatures & VK_FORMAT_FEATURE_DEPTH_STENCIL_ATTACHMENT_BIT)
         {
-            fmt::print("Failed to create acquire semaphore with code {}", magic_enum::enum_name(err));
-            return VK_ERROR_INITIALIZATION_FAILED;
+            rend.depth_format = format;
+            return VK_SUCCESS;
         }
-        err = vkCreateSemaphore(rend.device, &semaphore_create_info, nullptr, &submission_frame.present_swapchain_semaphore);
+    }
+    fmt::print("VkPhysicalDevice supports none of the depth formats");
+    return VK_ERROR_FORMAT_NOT_SUPPORTED;
+}
+
+// Headless replacement for init_swapchain, creates a ring of device-local images that render() cycles through
+VkResult init_offscreen_targets(init_settings &settings, renderer &rend)
+{
+    if (settings.offscreen_image_count < 2)
+    {
+        fmt::print("offscreen_image_count must be at least 2, got {}", settings.offscreen_image_count);
+        return VK_ERROR_INITIALIZATION_FAILED;
+    }
+    rend.swapchain_image_format = VK_FORMAT_R8G8B8A8_SRGB;
+    rend.swapchain_image_render_area.extent = {static_cast<uint32_t>(settings.window_width), static_cast<uint32_t>(settings.window_height)};
+    rend.swapchain_frames.resize(settings.offscreen_image_count, {});
+
+    for (auto &offscreen_frame : rend.swapchain_frames)
+    {
+        VkImageCreateInfo image_create_info{
+            .sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO,
+            .imageType = VK_IMAGE_TYPE_2D,
+            .format = rend.swapchain_image_format,
+            .extent = VkExtent3D{rend.swapchain_image_render_area.extent.width, rend.swapchain_image_render_area.extent.height, 1},
+            .mipLevels = 1,
+            .arrayLayers = 1,
+            .samples = VK_SAMPLE_COUNT_1_BIT,
+            .tiling = VK_IMAGE_TILING_OPTIMAL,
+            .usage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT,
+            .sharingMode = VK_SHARING_MODE_EXCLUSIVE,
+            .initialLayout = VK_IMAGE_LAYOUT_UNDEFINED,
+        };
+        VkResult err = create_image(rend.allocator, image_create_info, gpu_memory_request{.required_flags = VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT},
+                                    offscreen_frame.image, offscreen_frame.allocation);
         if (err != VK_SUCCESS)
         {
-            fmt::print("Failed to create present semaphore with code {}", magic_enum::enum_name(err));
+            fmt::print("Failed to create offscreen image with code {}", magic_enum::enum_name(err));
             return VK_ERROR_INITIALIZATION_FAILED;
         }
-        VkFenceCreateInfo fence_create_info{
-            .sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO,
-            .flags = VK_FENCE_CREATE_SIGNALED_BIT,
+
+        VkImageViewCreateInfo image_view_create_info{
+            .sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO,
+            .image = offscreen_frame.image,
+            .viewType = VK_IMAGE_VIEW_TYPE_2D,
+            .format = rend.swapchain_image_format,
+            .subresourceRange = single_color_image_subresource_range,
         };
-        err = vkCreateFence(rend.device, &fence_create_info, nullptr, &submission_frame.fence);
+        err = vkCreateImageView(rend.device, &image_view_create_info, nullptr, &offscreen_frame.image_view);
         if (err != VK_SUCCESS)
         {
-            fmt::print("Failed to create fence with code {}", magic_enum::enum_name(err));
+            fmt::print("Failed to create offscreen image view with code {}", magic_enum::enum_name(err));
             return VK_ERROR_INITIALIZATION_FAILED;
         }
     }
     return VK_SUCCESS;
 }
 
-VkResult init_pipeline_layout(renderer &rend)
+VkResult init_frame_data(init_settings &settings, renderer &rend)
 {
-    std::vector<VkDescriptorSetLayoutBinding> bindings{
-        // VkDescriptorSetLayoutBinding{
-        //     .binding = 0,
-        //     .descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE,
-        //     .descriptorCount = 1,
-        //     .stageFlags = VK_SHADER_STAGE_COMPUTE_BIT,
-        // },
-    };
-
-    VkDescriptorSetLayoutCreateInfo descriptor_set_layout_create_info{
-        .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO,
-        .bindingCount = static_cast<uint32_t>(bindings.size()),
-        .pBindings = bindings.data(),
-    };
-
-    VkResult err = vkCreateDescriptorSetLayout(rend.device, &descriptor_set_layout_create_info, nullptr, &rend.gradient_descriptor_set_layout);
-    if (err != VK_SUCCESS)
+    if (settings.frames_in_flight == 0)
     {
-        fmt::print("Failed to create descriptor set layout");
+        fmt::print("frames_in_flight must be at least 1");
         return VK_ERROR_INITIALIZATION_FAILED;
     }
-    std::vector<VkPushConstantRange> push_constants{
-        VkPushConstantRange{
-            .stageFlags = VK_SHADER_STAGE_ALL,
-            .offset = 0,
-            .size = 4,
-        },
-    };
+    // Offscreen images are reused round robin without an acquire, so every frame in flight needs one of its own
+    uint32_t frames_in_flight = settings.frames_in_flight;
+    if (rend.headless && frames_in_flight > rend.swapchain_frames.size())
+    {
+        frames_in_flight = static_cast<uint32_t>(rend.swapchain_frames.size());
+        fmt::print("Limiting frames in flight to the {} offscreen images\n", frames_in_flight);
+    }
+    rend.submission_frames.resize(frames_in_flight, {});
 
-    VkPipelineLayoutCreateInfo pipeline_layout_create_info{
-        .sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO,
-        .setLayoutCount = 1,
-        .pSetLayouts = &rend.gradient_descriptor_set_layout,
-        .pushConstantRangeCount = static_cast<uint32_t>(push_constants.size()),
-        .pPushConstantRanges = push_constants.data(),
-    };
+    VkResult err = VK_SUCCESS;
+    for (auto &submission_frame : rend.submission_frames)
+    {
+        // Each frame gets its own pool so all of its command buffers are recycled with a single vkResetCommandPool
+        VkCommandPoolCreateInfo command_pool_create_info{
+            .sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO,
+            .flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT,
+            .queueFamilyIndex = rend.queue_families.graphics,
+        };
+        err = vkCreateCommandPool(rend.device, &command_pool_create_info, nullptr, &submission_frame.command_pool);
+        if (err != VK_SUCCESS)
+        {
+            fmt::print("Failed to create command pool with error code {}", magic_enum::enum_name(err));
+            return VK_ERROR_INITIALIZATION_FAILED;
+        }
+        VkCommandBufferAllocateInfo command_buffer_allocate_info{
+            .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO,
+            .commandPool = submission_frame.command_pool,
+            .level = VK_COMMAND_BUFFER_LEVEL_PRIMARY,
+            .commandBufferCount = 1,
+        };
+        err = vkAllocateCommandBuffers(rend.device, &command_buffer_allocate_info, &submission_frame.command_buffer);
+        if (err != VK_SUCCESS)
+        {
+            fmt::print("Failed to create command buffers with error code {}", magic_enum::enum_name(err));
+            return VK_ERROR_INITIALIZATION_FAILED;
+        }
+
+        VkSemaphoreCreateInfo semaphore_create_info{};
+        semaphore_create_info.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+
+        err = vkCreateSemaphore(rend.device, &semaphore_create_info, nullptr, &submission_frame.acquire_swapchain_semaphore);
+        if (err != VK_SUCCESS)
+        {
+            fmt::print("Failed to create acquire semaphore with code {}", magic_enum::enum_name(err));
+            return VK_ERROR_INITIALIZATION_FAILED;
+        }
+    }
 
-    err = vkCreatePipelineLayout(rend.device, &pipeline_layout_create_info, nullptr, &rend.gradient_pipeline_layout);
+    VkSemaphoreTypeCreateInfo semaphore_type_create_info{
+        .sType = VK_STRUCTURE_TYPE_SEMAPHORE_TYPE_CREATE_INFO,
+        .semaphoreType = VK_SEMAPHORE_TYPE_TIMELINE,
+        .initialValue = 0,
+    };
+    VkSemaphoreCreateInfo timeline_create_info{
+        .sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO,
+        .pNext = &semaphore_type_create_info,
+    };
+    err = vkCreateSemaphore(rend.device, &timeline_create_info, nullptr, &rend.frame_timeline);
     if (err != VK_SUCCESS)
     {
-        fmt::print("Failed to create pipeline layout");
+        fmt::print("Failed to create frame timeline semaphore with code {}", magic_enum::enum_name(err));
         return VK_ERROR_INITIALIZATION_FAILED;
     }
     return VK_SUCCESS;
 }
 
-VkResult create_graphics_pipeline(renderer &rend, pipeline_create_details const &details, VkPipeline &out_pipeline)
+VkResult init_meshes(init_settings &settings, renderer &rend)
 {
-    std::string path_to_shader_source = DATA_DIRECTORY "/shaders/" + details.shader_name + ".slang";
-    std::string output_filename = details.shader_name + ".spv";
-    std::ifstream file_check(path_to_shader_source);
-    if (!file_check.is_open())
+    if (create_mesh_pool(rend.allocator, rend.uploads, settings.mesh_pool_size, rend.meshes) != VK_SUCCESS)
     {
-        fmt::print("The file at path {} could not be found", path_to_shader_source);
         return VK_ERROR_INITIALIZATION_FAILED;
     }
-    file_check.close();
 
-    std::string slang_invocation = "slangc ";
-    slang_invocation.append(path_to_shader_source);
-    slang_invocation.append(" -target spirv");
-    slang_invocation.append(" -profile sm_6_6");
-    slang_invocation.append(" -I " DATA_DIRECTORY "/shaders");
-    slang_invocation.append(" -o ").append(output_filename);
-
-    // if (details.type == pipeline_type::graphics)
-    // {
-    //     slang_invocation.append(" -entry mainVertex -entry mainFragment");
-    // }
-    // else
-    // {
-    //     slang_invocation.append(" -entry main");
-    // }
-
-    int err = system(slang_invocation.c_str());
-    if (err != 0)
+    mesh_vertex triangle_vertices[] = {
+        {.position = {-0.75f, 0.75f, 0.f, 1.f}, .color = {1.f, 0.f, 0.f, 1.f}},
+        {.position = {0.75f, 0.75f, 0.f, 1.f}, .color = {0.f, 1.f, 0.f, 1.f}},
+        {.position = {0.f, -0.75f, 0.f, 1.f}, .color = {0.f, 0.f, 1.f, 1.f}},
+    };
+    uint32_t triangle_indices[] = {0, 1, 2};
+    if (add_mesh(rend.allocator, rend.uploads, rend.meshes, triangle_vertices, triangle_indices, rend.triangle_mesh) != VK_SUCCESS)
     {
-        fmt::print("The slang invocation \"{}\" failed with error code {}", slang_invocation, err);
+        fmt::print("Failed to upload the triangle mesh");
         return VK_ERROR_INITIALIZATION_FAILED;
     }
-
-    std::ifstream shader_file(output_filename, std::ios::ate | std::ios::binary); // start at end
-    if (!shader_file.is_open())
+    return VK_SUCCESS;
+}
+
+// Needs the worker pool, a slice per worker plus one for the main thread
+VkResult init_draw_slices(init_settings &settings, renderer &rend)
+{
+    rend.draws_per_recording_slice = settings.draws_per_recording_slice;
+    uint32_t slice_count = rend.draws_per_recording_slice == 0 ? 0 : static_cast<uint32_t>(rend.workers.threads.size()) + 1;
+    for (auto &submission_frame : rend.submission_frames)
+    {
+        for (uint32_t i = 0; i < slice_count; i++)
+        {
+            VkCommandPoolCreateInfo command_pool_create_info{
+                .sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO,
+                .flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT,
+                .queueFamilyIndex = rend.queue_families.graphics,
+            };
+            VkCommandPool command_pool{};
+            VkResult err = vkCreateCommandPool(rend.device, &command_pool_create_info, nullptr, &command_pool);
+            if (err != VK_SUCCESS)
+            {
+                fmt::print("Failed to create command pool with error code {}", magic_enum::enum_name(err));
+                return VK_ERROR_INITIALIZATION_FAILED;
+            }
+            submission_frame.slice_command_pools.push_back(command_pool);
+            VkCommandBufferAllocateInfo command_buffer_allocate_info{
+                .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO,
+                .commandPool = command_pool,
+                .level = VK_COMMAND_BUFFER_LEVEL_SECONDARY,
+                .commandBufferCount = 1,
+            };
+            VkCommandBuffer command_buffer{};
+            err = vkAllocateCommandBuffers(rend.device, &command_buffer_allocate_info, &command_buffer);
+            if (err != VK_SUCCESS)
+            {
+                fmt::print("Failed to create command buffers with error code {}", magic_enum::enum_name(err));
+                return VK_ERROR_INITIALIZATION_FAILED;
+            }
+            submission_frame.slice_command_buffers.push_back(command_buffer);
+        }
+    }
+    return VK_SUCCESS;
+}
+
+VkResult init_pipeline_layout(renderer &rend)
+{
+    // Every pipeline shares this layout, resources come from the bindless heap and their indices from push constants
+    std::vector<VkPushConstantRange> push_constants{
+        VkPushConstantRange{
+            .stageFlags = VK_SHADER_STAGE_ALL,
+            .offset = 0,
+            .size = max_push_constants_size,
+        },
+    };
+
+    VkPipelineLayoutCreateInfo pipeline_layout_create_info{
+        .sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO,
+        .setLayoutCount = 1,
+        .pSetLayouts = &rend.bindless.layout,
+        .pushConstantRangeCount = static_cast<uint32_t>(push_constants.size()),
+        .pPushConstantRanges = push_constants.data(),
+    };
+
+    VkResult err = vkCreatePipelineLayout(rend.device, &pipeline_layout_create_info, nullptr, &rend.pipeline_layout);
+    if (err != VK_SUCCESS)
     {
-        fmt::print("The compiled shader {} could not be found", path_to_shader_source);
+        fmt::print("Failed to create pipeline layout");
         return VK_ERROR_INITIALIZATION_FAILED;
     }
-    size_t file_size = (size_t)shader_file.tellg();
-    std::vector<uint32_t> compiled_contents(file_size / sizeof(uint32_t));
-    shader_file.seekg(0); // go back to the beginning
-    shader_file.read((char *)compiled_contents.data(), file_size);
-    shader_file.close();
+    return VK_SUCCESS;
+}
+
+uint64_t nanoseconds_since(std::chrono::steady_clock::time_point start_time)
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start_time).count();
+}
+
+// Attachment formats the pipelines render to, copied into pipeline builds so workers never read swapchain state that
+// the main thread replaces on resize
+struct pipeline_target_formats
+{
+    VkFormat color = VK_FORMAT_UNDEFINED;
+    VkFormat depth = VK_FORMAT_UNDEFINED;
+};
+
+pipeline_target_formats current_target_formats(renderer const &rend)
+{
+    return {rend.swapchain_image_format, rend.depth_format};
+}
+
+// Stats are only recorded when pipeline_cache is the renderer's own cache
+VkResult create_pipeline_from_spirv(renderer &rend, pipeline_create_details const &details, pipeline_target_formats formats,
+                                    std::vector<uint32_t> const &compiled_contents, VkPipelineCache pipeline_cache, VkPipeline &out_pipeline,
+                                    uint64_t &out_create_ns)
+{
+    // Shaders without the constant ignore it
+    VkSpecializationMapEntry specialization_entry{
+        .constantID = 0,
+        .offset = 0,
+        .size = sizeof(details.specialization),
+    };
+    VkSpecializationInfo specialization_info{
+        .mapEntryCount = 1,
+        .pMapEntries = &specialization_entry,
+        .dataSize = sizeof(details.specialization),
+        .pData = &details.specialization,
+    };
 
     switch (details.type)
     {
@@ -545,15 +898,18 @@ VkResult create_graphics_pipeline(renderer &rend, pipeline_create_details const
                 .pNext = &shader_module_info,
                 .stage = VK_SHADER_STAGE_VERTEX_BIT,
                 .pName = "main",
+                .pSpecializationInfo = &specialization_info,
             },
             {
                 .sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO,
                 .pNext = &shader_module_info,
                 .stage = VK_SHADER_STAGE_FRAGMENT_BIT,
                 .pName = "main",
+                .pSpecializationInfo = &specialization_info,
             },
         };
 
+        // Vertices are pulled through buffer device addresses, so no pipeline has vertex input state
         VkPipelineVertexInputStateCreateInfo pipeline_vertex_input_state_create_info{
             .sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO,
         };
@@ -563,23 +919,18 @@ VkResult create_graphics_pipeline(renderer &rend, pipeline_create_details const
             .topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST,
         };
 
-        VkViewport viewport{
-            .width = static_cast<float>(rend.swapchain_image_render_area.extent.width),
-            .height = static_cast<float>(rend.swapchain_image_render_area.extent.height),
-            .maxDepth = 1.0f,
-        };
-        VkRect2D scissor = {.offset = {0, 0}, .extent = rend.swapchain_image_render_area.extent};
-
+        // Viewport and scissor are dynamic, so pipelines don't depend on the window size
         VkPipelineViewportStateCreateInfo pipeline_viewport_state_create_info{
             .sType = VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO,
             .viewportCount = 1,
-            .pViewports = &viewport,
             .scissorCount = 1,
-            .pScissors = &scissor,
         };
 
         VkPipelineDepthStencilStateCreateInfo pipeline_depth_stencil_state_create_info = {
             .sType = VK_STRUCTURE_TYPE_PIPELINE_DEPTH_STENCIL_STATE_CREATE_INFO,
+            .depthTestEnable = VK_TRUE,
+            .depthWriteEnable = VK_TRUE,
+            .depthCompareOp = VK_COMPARE_OP_LESS_OR_EQUAL,
             .minDepthBounds = 1.0f,
             .maxDepthBounds = 0.0f,
         };
@@ -625,12 +976,20 @@ VkResult create_graphics_pipeline(renderer &rend, pipeline_create_details const
         VkPipelineRenderingCreateInfo pipeline_rendering_create_info{
             .sType = VK_STRUCTURE_TYPE_PIPELINE_RENDERING_CREATE_INFO,
             .colorAttachmentCount = 1,
-            .pColorAttachmentFormats = &rend.swapchain_image_format,
+            .pColorAttachmentFormats = &formats.color,
+            .depthAttachmentFormat = formats.depth,
+        };
+
+        VkPipelineCreationFeedback pipeline_creation_feedback{};
+        VkPipelineCreationFeedbackCreateInfo pipeline_creation_feedback_create_info{
+            .sType = VK_STRUCTURE_TYPE_PIPELINE_CREATION_FEEDBACK_CREATE_INFO,
+            .pNext = &pipeline_rendering_create_info,
+            .pPipelineCreationFeedback = &pipeline_creation_feedback,
         };
 
         VkGraphicsPipelineCreateInfo graphics_pipeline_create_info{
             .sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO,
-            .pNext = &pipeline_rendering_create_info,
+            .pNext = &pipeline_creation_feedback_create_info,
             .stageCount = static_cast<uint32_t>(pipeline_shader_stage_create_infos.size()),
             .pStages = pipeline_shader_stage_create_infos.data(),
             .pVertexInputState = &pipeline_vertex_input_state_create_info,
@@ -641,15 +1000,19 @@ VkResult create_graphics_pipeline(renderer &rend, pipeline_create_details const
             .pDepthStencilState = &pipeline_depth_stencil_state_create_info,
             .pColorBlendState = &pipeline_color_blend_state_create_info,
             .pDynamicState = &pipeline_dynamic_state_create_info,
-            .layout = rend.gradient_pipeline_layout,
+            .layout = rend.pipeline_layout,
 
         };
-        VkResult err = vkCreateGraphicsPipelines(rend.device, nullptr, 1, &graphics_pipeline_create_info, nullptr, &out_pipeline);
+        auto start_time = std::chrono::steady_clock::now();
+        VkResult err = vkCreateGraphicsPipelines(rend.device, pipeline_cache, 1, &graphics_pipeline_create_info, nullptr, &out_pipeline);
+        out_create_ns = nanoseconds_since(start_time);
         if (err != VK_SUCCESS)
         {
             fmt::print("Failed to create graphics pipeline with error code {}", magic_enum::enum_name(err));
             return err;
         }
+        if (pipeline_cache == rend.pipeline_cache.cache)
+            record_pipeline_creation(rend.pipeline_cache, pipeline_creation_feedback, out_create_ns);
         break;
     }
     case (pipeline_type::compute):
@@ -660,23 +1023,35 @@ VkResult create_graphics_pipeline(renderer &rend, pipeline_create_details const
             .pCode = compiled_contents.data(),
         };
 
+        VkPipelineCreationFeedback pipeline_creation_feedback{};
+        VkPipelineCreationFeedbackCreateInfo pipeline_creation_feedback_create_info{
+            .sType = VK_STRUCTURE_TYPE_PIPELINE_CREATION_FEEDBACK_CREATE_INFO,
+            .pPipelineCreationFeedback = &pipeline_creation_feedback,
+        };
+
         VkComputePipelineCreateInfo compute_pipeline_create_info{
             .sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO,
+            .pNext = &pipeline_creation_feedback_create_info,
             .stage = VkPipelineShaderStageCreateInfo{
                 .sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO,
                 .pNext = &shader_module_info,
                 .stage = VK_SHADER_STAGE_COMPUTE_BIT,
                 .pName = "main",
+                .pSpecializationInfo = &specialization_info,
             },
-            .layout = rend.gradient_pipeline_layout,
+            .layout = rend.pipeline_layout,
 
         };
-        VkResult err = vkCreateComputePipelines(rend.device, nullptr, 1, &compute_pipeline_create_info, nullptr, &out_pipeline);
+        auto start_time = std::chrono::steady_clock::now();
+        VkResult err = vkCreateComputePipelines(rend.device, pipeline_cache, 1, &compute_pipeline_create_info, nullptr, &out_pipeline);
+        out_create_ns = nanoseconds_since(start_time);
         if (err != VK_SUCCESS)
         {
             fmt::print("Failed to create compute pipeline with error code {}", magic_enum::enum_name(err));
             return err;
         }
+        if (pipeline_cache == rend.pipeline_cache.cache)
+            record_pipeline_creation(rend.pipeline_cache, pipeline_creation_feedback, out_create_ns);
         break;
     }
     }
@@ -684,51 +1059,540 @@ VkResult create_graphics_pipeline(renderer &rend, pipeline_create_details const
     return VK_SUCCESS;
 }
 
+// Creates the pipeline from both the compiled and the optimized SPIR-V, bypassing the pipeline cache so the driver does
+// the full compile each time, and reports the difference
+void measure_spirv_optimization(renderer &rend, pipeline_create_details const &details, pipeline_target_formats formats,
+                                std::vector<uint32_t> const &unoptimized_spirv, std::vector<uint32_t> const &optimized_spirv)
+{
+    uint64_t create_ns[2] = {};
+    std::vector<uint32_t> const *variants[2] = {&unoptimized_spirv, &optimized_spirv};
+    for (int i = 0; i < 2; i++)
+    {
+        VkPipeline pipeline{};
+        if (create_pipeline_from_spirv(rend, details, formats, *variants[i], VK_NULL_HANDLE, pipeline, create_ns[i]) != VK_SUCCESS)
+        {
+            return;
+        }
+        vkDestroyPipeline(rend.device, pipeline, nullptr);
+    }
+    fmt::print("Shader {}: uncached pipeline creation {:.2f} ms compiled, {:.2f} ms optimized ({:+.2f} ms)\n", details.shader_name,
+               create_ns[0] / 1e6, create_ns[1] / 1e6, (static_cast<double>(create_ns[1]) - create_ns[0]) / 1e6);
+}
+
+VkResult create_graphics_pipeline(renderer &rend, pipeline_create_details const &details, pipeline_target_formats formats,
+                                  pipeline_create_result &out_result)
+{
+    auto load_start_time = std::chrono::steady_clock::now();
+    std::vector<uint32_t> compiled_contents;
+    std::vector<uint32_t> unoptimized_contents;
+    VkResult load_result = load_shader_spirv(rend.compiler, details.shader_name, compiled_contents,
+                                             rend.measure_spirv_optimization ? &unoptimized_contents : nullptr);
+    out_result.shader_load_ns = nanoseconds_since(load_start_time);
+    if (load_result != VK_SUCCESS)
+    {
+        return VK_ERROR_INITIALIZATION_FAILED;
+    }
+    if (!unoptimized_contents.empty())
+    {
+        measure_spirv_optimization(rend, details, formats, unoptimized_contents, compiled_contents);
+    }
+    return create_pipeline_from_spirv(rend, details, formats, compiled_contents, rend.pipeline_cache.cache, out_result.pipeline, out_result.pipeline_create_ns);
+}
+
+VkResult create_pipelines(renderer &rend, std::vector<pipeline_create_details> const &details, std::vector<pipeline_create_result> &out_results)
+{
+    out_results.clear();
+    out_results.resize(details.size());
+    pipeline_target_formats formats = current_target_formats(rend);
+    run_parallel(rend.workers, static_cast<uint32_t>(details.size()), [&](uint32_t i) {
+        out_results.at(i).result = create_graphics_pipeline(rend, details.at(i), formats, out_results.at(i));
+    });
+
+    VkResult err = VK_SUCCESS;
+    for (size_t i = 0; i < details.size(); i++)
+    {
+        if (out_results.at(i).result != VK_SUCCESS)
+        {
+            fmt::print("Failed to create pipeline for shader {}\n", details.at(i).shader_name);
+            err = out_results.at(i).result;
+        }
+    }
+    return err;
+}
+
 VkResult init_graphics_pipelines(init_settings &settings, renderer &rend)
 {
-    if (create_graphics_pipeline(rend, pipeline_create_details{pipeline_type::graphics, "single_triangle"}, rend.gradient_pipeline) != VK_SUCCESS)
-    // if (create_graphics_pipeline(rend, pipeline_create_details{pipeline_type::compute, "gradient"}, rend.gradient_pipeline) != VK_SUCCESS)
+    std::vector<pipeline_create_details> details = {
+        pipeline_create_details{pipeline_type::graphics, "single_triangle"},
+        pipeline_create_details{pipeline_type::compute, "gradient"},
+    };
+    std::vector<pipeline_create_result> results;
+    auto start_time = std::chrono::steady_clock::now();
+    VkResult err = create_pipelines(rend, details, results);
+    uint64_t elapsed_ns = nanoseconds_since(start_time);
+    if (err != VK_SUCCESS)
     {
+        for (auto &result : results)
+        {
+            vkDestroyPipeline(rend.device, result.pipeline, nullptr);
+        }
         return VK_ERROR_INITIALIZATION_FAILED;
     }
+
+    uint64_t serial_ns = 0;
+    for (size_t i = 0; i < details.size(); i++)
+    {
+        auto const &result = results.at(i);
+        serial_ns += result.shader_load_ns + result.pipeline_create_ns;
+        fmt::print("Pipeline {}: shader {:.2f} ms, create {:.2f} ms\n", details.at(i).shader_name, result.shader_load_ns / 1e6, result.pipeline_create_ns / 1e6);
+    }
+    fmt::print("Created {} pipelines on {} threads in {:.2f} ms ({:.2f} ms of work)\n", details.size(), std::max<size_t>(rend.workers.threads.size(), 1),
+               elapsed_ns / 1e6, serial_ns / 1e6);
+
+    // Pipelines created at init are ready immediately and double as fallbacks for the ones requested later
+    rend.triangle_pipeline = add_ready_pipeline(rend, details.at(0), results.at(0).pipeline);
+    rend.gradient_pipeline = add_ready_pipeline(rend, details.at(1), results.at(1).pipeline);
     return VK_SUCCESS;
 }
 
-VkResult init_descriptors(renderer &rend)
+pipeline_handle add_ready_pipeline(renderer &rend, pipeline_create_details const &details, VkPipeline pipeline)
 {
-    std::vector<VkDescriptorPoolSize> descriptor_pool_sizes = {
-        VkDescriptorPoolSize{
-            .type = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE,
-            .descriptorCount = 100,
-        },
+    pipeline_handle handle = static_cast<pipeline_handle>(rend.pipelines.size());
+    rend.pipelines.push_back(pipeline_slot{
+        .details = details,
+        .status = pipeline_status::ready,
+        .pipeline = pipeline,
+    });
+    return handle;
+}
+
+VkResult create_ready_pipelines(renderer &rend, std::vector<pipeline_create_details> const &details, std::vector<pipeline_handle> &out_handles)
+{
+    std::vector<pipeline_create_result> results;
+    VkResult err = create_pipelines(rend, details, results);
+    if (err != VK_SUCCESS)
+    {
+        for (auto &result : results)
+        {
+            vkDestroyPipeline(rend.device, result.pipeline, nullptr);
+        }
+        return err;
+    }
+    out_handles.clear();
+    for (size_t i = 0; i < details.size(); i++)
+    {
+        out_handles.push_back(add_ready_pipeline(rend, details.at(i), results.at(i).pipeline));
+    }
+    return VK_SUCCESS;
+}
+
+void queue_pipeline_build(renderer &rend, pipeline_handle handle)
+{
+    auto &slot = rend.pipelines.at(handle);
+    slot.generation++;
+    submit_job(rend.workers, [&rend, handle, generation = slot.generation, details = slot.details, formats = current_target_formats(rend)]() {
+        completed_pipeline completed{.handle = handle, .generation = generation};
+        completed.result.result = create_graphics_pipeline(rend, details, formats, completed.result);
+        std::lock_guard lock(rend.completed_pipelines_mutex);
+        rend.completed_pipelines.push_back(completed);
+    });
+}
+
+pipeline_handle request_pipeline(renderer &rend, pipeline_create_details const &details, pipeline_handle fallback)
+{
+    pipeline_handle handle = static_cast<pipeline_handle>(rend.pipelines.size());
+    rend.pipelines.push_back(pipeline_slot{
+        .details = details,
+        .fallback = fallback,
+    });
+    queue_pipeline_build(rend, handle);
+    return handle;
+}
+
+// Rebuilds every pipeline whose shader was built from a file that changed. The slots keep drawing with their current
+// pipeline until update_pipelines swaps the new one in.
+void reload_changed_shaders(renderer &rend)
+{
+    std::vector<std::filesystem::path> changed_files;
+    poll_shader_changes(rend.watcher, changed_files);
+    if (changed_files.empty())
+    {
+        return;
+    }
+    std::vector<std::string> shader_names = find_dependent_shaders(rend.compiler, changed_files);
+    if (shader_names.empty())
+    {
+        return;
+    }
+    invalidate_shader_modules(rend.compiler);
+    for (pipeline_handle handle = 0; handle < rend.pipelines.size(); handle++)
+    {
+        auto const &slot = rend.pipelines.at(handle);
+        if (std::find(shader_names.begin(), shader_names.end(), slot.details.shader_name) != shader_names.end())
+        {
+            fmt::print("Shader {} changed, rebuilding its pipeline\n", slot.details.shader_name);
+            queue_pipeline_build(rend, handle);
+        }
+    }
+}
+
+VkPipeline get_pipeline(renderer const &rend, pipeline_handle handle)
+{
+    if (handle >= rend.pipelines.size())
+    {
+        return VK_NULL_HANDLE;
+    }
+    auto const &slot = rend.pipelines.at(handle);
+    if (slot.status == pipeline_status::ready)
+    {
+        return slot.pipeline;
+    }
+    if (slot.fallback < rend.pipelines.size() && rend.pipelines.at(slot.fallback).status == pipeline_status::ready)
+    {
+        return rend.pipelines.at(slot.fallback).pipeline;
+    }
+    return VK_NULL_HANDLE;
+}
+
+uint64_t current_frame_value(renderer const &rend)
+{
+    return rend.frame_count + 1;
+}
+
+uint64_t completed_frame_value(renderer const &rend)
+{
+    uint64_t value = 0;
+    vkGetSemaphoreCounterValue(rend.device, rend.frame_timeline, &value);
+    return value;
+}
+
+VkResult wait_for_frame_value(renderer const &rend, uint64_t value, uint64_t timeout)
+{
+    VkSemaphoreWaitInfo semaphore_wait_info{
+        .sType = VK_STRUCTURE_TYPE_SEMAPHORE_WAIT_INFO,
+        .semaphoreCount = 1,
+        .pSemaphores = &rend.frame_timeline,
+        .pValues = &value,
     };
+    return vkWaitSemaphores(rend.device, &semaphore_wait_info, timeout);
+}
 
-    VkDescriptorPoolCreateInfo descriptor_pool_create_info = {
-        .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO,
-        .maxSets = 100,
-        .poolSizeCount = static_cast<uint32_t>(descriptor_pool_sizes.size()),
-        .pPoolSizes = descriptor_pool_sizes.data(),
+VkResult submit_async_compute(renderer &rend, std::span<const VkCommandBuffer> command_buffers, uint64_t after_frame_value, uint64_t &out_value)
+{
+    VkSemaphoreSubmitInfo frame_wait_info{
+        .sType = VK_STRUCTURE_TYPE_SEMAPHORE_SUBMIT_INFO,
+        .semaphore = rend.frame_timeline,
+        .value = after_frame_value,
+        .stageMask = VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT,
     };
+    std::span<const VkSemaphoreSubmitInfo> waits{};
+    if (after_frame_value != 0)
+    {
+        waits = {&frame_wait_info, 1};
+    }
+    return submit_to_queue(rend.compute_queue, command_buffers, waits, {}, out_value);
+}
+
+void wait_in_next_frame(renderer &rend, gpu_queue const &queue, uint64_t value, VkPipelineStageFlags2 stage)
+{
+    rend.frame_waits.push_back(queue_wait_info(queue, value, stage));
+}
 
-    VkResult err = vkCreateDescriptorPool(rend.device, &descriptor_pool_create_info, nullptr, &rend.gradient_descriptor_pool);
+VkResult init_compute_background(renderer &rend)
+{
+    VkFormatProperties format_properties{};
+    vkGetPhysicalDeviceFormatProperties(rend.physical_device, rend.swapchain_image_format, &format_properties);
+    bool transfer_destination = rend.headless || (rend.surface_capabilities.supportedUsageFlags & VK_IMAGE_USAGE_TRANSFER_DST_BIT);
+    if (!transfer_destination || !(format_properties.optimalTilingFeatures & VK_FORMAT_FEATURE_BLIT_DST_BIT))
+    {
+        fmt::print("The backbuffer can't be blitted to, clearing it instead of drawing the compute background\n");
+        return VK_SUCCESS;
+    }
+
+    // Drawn once at the initial size, the blit scales it to whatever the window is resized to
+    auto &background = rend.background;
+    background.extent = rend.swapchain_image_render_area.extent;
+    VkImageCreateInfo image_create_info{
+        .sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO,
+        .imageType = VK_IMAGE_TYPE_2D,
+        .format = VK_FORMAT_R8G8B8A8_UNORM,
+        .extent = VkExtent3D{background.extent.width, background.extent.height, 1},
+        .mipLevels = 1,
+        .arrayLayers = 1,
+        .samples = VK_SAMPLE_COUNT_1_BIT,
+        .tiling = VK_IMAGE_TILING_OPTIMAL,
+        .usage = VK_IMAGE_USAGE_STORAGE_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT,
+        .sharingMode = VK_SHARING_MODE_EXCLUSIVE,
+        .initialLayout = VK_IMAGE_LAYOUT_UNDEFINED,
+    };
+    VkResult err = create_image(rend.allocator, image_create_info, gpu_memory_request{.required_flags = VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT},
+                                background.image, background.allocation);
     if (err != VK_SUCCESS)
     {
-        fmt::print("Failed to create descriptor pool with error code {}", magic_enum::enum_name(err));
+        fmt::print("Failed to create background image with code {}\n", magic_enum::enum_name(err));
         return err;
     }
+    VkImageViewCreateInfo image_view_create_info{
+        .sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO,
+        .image = background.image,
+        .viewType = VK_IMAGE_VIEW_TYPE_2D,
+        .format = image_create_info.format,
+        .subresourceRange = single_color_image_subresource_range,
+    };
+    err = vkCreateImageView(rend.device, &image_view_create_info, nullptr, &background.image_view);
+    if (err != VK_SUCCESS)
+    {
+        fmt::print("Failed to create background image view with code {}\n", magic_enum::enum_name(err));
+        return err;
+    }
+    background.storage_index = bindless_add_storage_image(rend.device, rend.bindless, background.image_view);
+    if (background.storage_index == invalid_bindless_index)
+    {
+        fmt::print("No room left for the background image in the bindless heap\n");
+        return VK_ERROR_TOO_MANY_OBJECTS;
+    }
 
-    VkDescriptorSetAllocateInfo descriptor_set_allocate_info{
-        .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO,
-        .descriptorPool = rend.gradient_descriptor_pool,
-        .descriptorSetCount = 1,
-        .pSetLayouts = &rend.gradient_descriptor_set_layout,
+    VkCommandPoolCreateInfo command_pool_create_info{
+        .sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO,
+        .flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT,
+        .queueFamilyIndex = rend.queue_families.compute,
+    };
+    err = vkCreateCommandPool(rend.device, &command_pool_create_info, nullptr, &background.command_pool);
+    if (err != VK_SUCCESS)
+    {
+        fmt::print("Failed to create background command pool with code {}\n", magic_enum::enum_name(err));
+        return err;
+    }
+    VkCommandBufferAllocateInfo command_buffer_allocate_info{
+        .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO,
+        .commandPool = background.command_pool,
+        .level = VK_COMMAND_BUFFER_LEVEL_PRIMARY,
+        .commandBufferCount = 1,
+    };
+    VkCommandBuffer command_buffer{};
+    err = vkAllocateCommandBuffers(rend.device, &command_buffer_allocate_info, &command_buffer);
+    if (err != VK_SUCCESS)
+    {
+        fmt::print("Failed to allocate background command buffer with code {}\n", magic_enum::enum_name(err));
+        return err;
+    }
+    VkCommandBufferBeginInfo command_buffer_begin_info{
+        .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
+        .flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT,
     };
-    err = vkAllocateDescriptorSets(rend.device, &descriptor_set_allocate_info, &rend.gradient_descriptor_set);
+    err = vkBeginCommandBuffer(command_buffer, &command_buffer_begin_info);
     if (err != VK_SUCCESS)
     {
-        fmt::print("Failed to allocate descriptor set with error code {}", magic_enum::enum_name(err));
+        fmt::print("Failed to begin background command buffer with code {}\n", magic_enum::enum_name(err));
         return err;
     }
+
+    VkImageMemoryBarrier2 to_general_barrier{
+        .sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER_2,
+        .srcStageMask = VK_PIPELINE_STAGE_2_NONE,
+        .srcAccessMask = VK_ACCESS_2_NONE,
+        .dstStageMask = VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT,
+        .dstAccessMask = VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT,
+        .oldLayout = VK_IMAGE_LAYOUT_UNDEFINED,
+        .newLayout = VK_IMAGE_LAYOUT_GENERAL,
+        .srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+        .dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+        .image = background.image,
+        .subresourceRange = single_color_image_subresource_range,
+    };
+    VkDependencyInfo dependency_info{
+        .sType = VK_STRUCTURE_TYPE_DEPENDENCY_INFO,
+        .imageMemoryBarrierCount = 1,
+        .pImageMemoryBarriers = &to_general_barrier,
+    };
+    vkCmdPipelineBarrier2(command_buffer, &dependency_info);
+
+    vkCmdBindDescriptorSets(command_buffer, VK_PIPELINE_BIND_POINT_COMPUTE, rend.pipeline_layout, 0, 1, &rend.bindless.set, 0, nullptr);
+    vkCmdBindPipeline(command_buffer, VK_PIPELINE_BIND_POINT_COMPUTE, get_pipeline(rend, rend.gradient_pipeline));
+    vkCmdPushConstants(command_buffer, rend.pipeline_layout, VK_SHADER_STAGE_ALL, 0, sizeof(background.storage_index), &background.storage_index);
+    // The shader runs 16x16 workgroups
+    vkCmdDispatch(command_buffer, (background.extent.width + 15) / 16, (background.extent.height + 15) / 16, 1);
+
+    // Handed to the graphics family ready to be blitted from, which is where every frame finds it
+    graph_resource_state blit_state = graph_usage_state(graph_usage::transfer_source);
+    queue_usage src{rend.queue_families.compute, VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT, VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT};
+    queue_usage dst{rend.queue_families.graphics, blit_state.stage_mask, blit_state.access_mask};
+    auto transfer = transfer_image_ownership(background.image, single_color_image_subresource_range, VK_IMAGE_LAYOUT_GENERAL, blit_state.layout, src, dst);
+    dependency_info.pImageMemoryBarriers = &transfer.release;
+    vkCmdPipelineBarrier2(command_buffer, &dependency_info);
+    err = vkEndCommandBuffer(command_buffer);
+    if (err != VK_SUCCESS)
+    {
+        fmt::print("Failed to end background command buffer with code {}\n", magic_enum::enum_name(err));
+        return err;
+    }
+
+    uint64_t value = 0;
+    err = submit_async_compute(rend, {&command_buffer, 1}, 0, value);
+    if (err != VK_SUCCESS)
+    {
+        fmt::print("Failed to submit the background to the compute queue with code {}\n", magic_enum::enum_name(err));
+        return err;
+    }
+    wait_in_next_frame(rend, rend.compute_queue, value, blit_state.stage_mask);
+    if (needs_ownership_transfer(src, dst))
+    {
+        background.acquire = transfer.acquire;
+        background.acquire_pending = true;
+    }
+    return VK_SUCCESS;
+}
+
+void destroy_compute_background(renderer &rend)
+{
+    auto &background = rend.background;
+    vkDestroyCommandPool(rend.device, background.command_pool, nullptr);
+    vkDestroyImageView(rend.device, background.image_view, nullptr);
+    if (background.image != VK_NULL_HANDLE)
+    {
+        destroy_image(rend.allocator, background.image, background.allocation);
+    }
+    background = compute_background{};
+}
+
+// Called at the top of a frame, once the frame that last used its submission_frame has completed and before anything
+// is recorded
+void update_pipelines(renderer &rend, uint64_t completed_value)
+{
+    std::vector<completed_pipeline> completed;
+    {
+        std::lock_guard lock(rend.completed_pipelines_mutex);
+        completed.swap(rend.completed_pipelines);
+    }
+    for (auto &entry : completed)
+    {
+        auto &slot = rend.pipelines.at(entry.handle);
+        if (entry.generation != slot.generation)
+        {
+            // Superseded by a newer build before it was ever bound
+            vkDestroyPipeline(rend.device, entry.result.pipeline, nullptr);
+            continue;
+        }
+        if (entry.result.result != VK_SUCCESS)
+        {
+            fmt::print("Pipeline for shader {} failed to build, drawing with its fallback\n", slot.details.shader_name);
+            slot.status = slot.pipeline != VK_NULL_HANDLE ? pipeline_status::ready : pipeline_status::failed;
+            continue;
+        }
+        // Earlier frames may still be executing with the old pipeline, the last of them is the previous frame
+        if (slot.pipeline != VK_NULL_HANDLE)
+        {
+            rend.retired_pipelines.push_back(retired_pipeline{
+                .pipeline = slot.pipeline,
+                .timeline_value = current_frame_value(rend) - 1,
+            });
+        }
+        slot.pipeline = entry.result.pipeline;
+        slot.status = pipeline_status::ready;
+        fmt::print("Pipeline for shader {} is ready after {:.2f} ms\n", slot.details.shader_name,
+                   (entry.result.shader_load_ns + entry.result.pipeline_create_ns) / 1e6);
+    }
+
+    std::erase_if(rend.retired_pipelines, [&rend, completed_value](retired_pipeline const &retired) {
+        if (retired.timeline_value > completed_value)
+            return false;
+        vkDestroyPipeline(rend.device, retired.pipeline, nullptr);
+        return true;
+    });
+}
+
+// State secondary command buffers don't inherit is set again, so this works for both kinds of command buffer
+void record_draws(renderer const &rend, VkCommandBuffer command_buffer, uint32_t first_draw, uint32_t draw_count)
+{
+    VkViewport viewport{
+        .width = static_cast<float>(rend.swapchain_image_render_area.extent.width),
+        .height = static_cast<float>(rend.swapchain_image_render_area.extent.height),
+        .maxDepth = 1.0f,
+    };
+    vkCmdSetViewport(command_buffer, 0, 1, &viewport);
+    VkRect2D extent = {.offset = {0, 0}, .extent = rend.swapchain_image_render_area.extent};
+    vkCmdSetScissor(command_buffer, 0, 1, &extent);
+    vkCmdBindDescriptorSets(command_buffer, VK_PIPELINE_BIND_POINT_GRAPHICS, rend.pipeline_layout, 0, 1, &rend.bindless.set, 0, nullptr);
+    bind_mesh_pool(command_buffer, rend.meshes);
+
+    VkPipeline bound_pipeline = VK_NULL_HANDLE;
+    for (uint32_t i = first_draw; i < first_draw + draw_count; i++)
+    {
+        auto const &draw = rend.draws[i];
+        VkPipeline pipeline = get_pipeline(rend, draw.pipeline);
+        if (pipeline == VK_NULL_HANDLE)
+        {
+            continue;
+        }
+        if (pipeline != bound_pipeline)
+        {
+            vkCmdBindPipeline(command_buffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline);
+            bound_pipeline = pipeline;
+        }
+        draw_mesh(command_buffer, rend.pipeline_layout, rend.meshes, draw.geometry);
+    }
+}
+
+uint32_t draw_slice_count(renderer const &rend, submission_frame const &frame)
+{
+    if (rend.draws_per_recording_slice == 0)
+    {
+        return 1;
+    }
+    uint64_t slice_count = rend.draws.size() / rend.draws_per_recording_slice;
+    return static_cast<uint32_t>(std::min<uint64_t>(slice_count, frame.slice_command_buffers.size()));
+}
+
+// Records the draws into the first slice_count of the frame's secondary command buffers, continuing the main pass
+VkResult record_draw_slices(renderer &rend, submission_frame &frame, uint32_t slice_count)
+{
+    CPU_SCOPE("record draw slices");
+    VkCommandBufferInheritanceRenderingInfo inheritance_rendering_info{
+        .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_INHERITANCE_RENDERING_INFO,
+        .colorAttachmentCount = 1,
+        .pColorAttachmentFormats = &rend.swapchain_image_format,
+        .depthAttachmentFormat = rend.depth_format,
+        .rasterizationSamples = VK_SAMPLE_COUNT_1_BIT,
+    };
+    // The main pass's statistics query stays active while the slices execute
+    VkCommandBufferInheritanceInfo inheritance_info{
+        .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_INHERITANCE_INFO,
+        .pNext = &inheritance_rendering_info,
+        .pipelineStatistics = rend.profiler.open_statistics_query != UINT32_MAX ? gpu_profiler_statistics : 0,
+    };
+    VkCommandBufferBeginInfo command_buffer_begin_info{
+        .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
+        .flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT | VK_COMMAND_BUFFER_USAGE_RENDER_PASS_CONTINUE_BIT,
+        .pInheritanceInfo = &inheritance_info,
+    };
+
+    // Contiguous ranges, the first draws.size() % slice_count slices take one extra draw
+    uint32_t draw_count = static_cast<uint32_t>(rend.draws.size());
+    std::vector<VkResult> results(slice_count, VK_SUCCESS);
+    run_parallel(rend.workers, slice_count, [&](uint32_t slice) {
+        CPU_SCOPE("record draw slice");
+        uint32_t first_draw = slice * (draw_count / slice_count) + std::min(slice, draw_count % slice_count);
+        uint32_t slice_draw_count = draw_count / slice_count + (slice < draw_count % slice_count ? 1 : 0);
+        VkCommandBuffer command_buffer = frame.slice_command_buffers[slice];
+        results[slice] = vkBeginCommandBuffer(command_buffer, &command_buffer_begin_info);
+        if (results[slice] != VK_SUCCESS)
+        {
+            return;
+        }
+        record_draws(rend, command_buffer, first_draw, slice_draw_count);
+        results[slice] = vkEndCommandBuffer(command_buffer);
+    });
+
+    rend.sliced_frame_count++;
+    rend.recorded_slice_count += slice_count;
+    for (uint32_t slice = 0; slice < slice_count; slice++)
+    {
+        if (results[slice] != VK_SUCCESS)
+        {
+            fmt::print("Failed to record draw slice {} with code {}", slice, magic_enum::enum_name(results[slice]));
+            return results[slice];
+        }
+    }
     return VK_SUCCESS;
 }
 
@@ -737,37 +1601,102 @@ VkResult render(renderer &rend)
     VkResult err = VK_SUCCESS;
     auto &current_submission_frame = rend.submission_frames.at(rend.current_submission_frame_index);
     uint64_t timeout = 1000000000;
-
-    err = vkWaitForFences(rend.device, 1, &current_submission_frame.fence, VK_TRUE, timeout);
+    auto frame_start = std::chrono::steady_clock::now();
+    uint64_t blocked_ns = 0;
+
+    // Wait for the frame that last used this submission_frame
+    CPU_SCOPE_NAMED(wait_scope, "wait for frame");
+    err = wait_for_frame_value(rend, current_submission_frame.timeline_value, timeout);
+    CPU_SCOPE_END(wait_scope);
+    blocked_ns += nanoseconds_since(frame_start);
+    add_blocked_time(rend.pacer, blocked_ns);
     if (err == VK_TIMEOUT)
     {
-        fmt::print("vkWaitForFences on submission frame index {} exceeded timeout {}ns", rend.current_submission_frame_index, timeout);
+        fmt::print("Waiting for submission frame index {} exceeded timeout {}ns", rend.current_submission_frame_index, timeout);
         return VK_TIMEOUT;
     }
     else if (err != VK_SUCCESS)
     {
-        fmt::print("vkWaitForFences on submission frame index {} failed with code {}", rend.current_submission_frame_index, magic_enum::enum_name(err));
+        fmt::print("Waiting for submission frame index {} failed with code {}", rend.current_submission_frame_index, magic_enum::enum_name(err));
         return VK_ERROR_UNKNOWN;
     }
 
-    err = vkResetFences(rend.device, 1, &current_submission_frame.fence);
-    if (err != VK_SUCCESS)
+    // Frame boundary, nothing recorded from here on can reference a pipeline that gets swapped out
+    CPU_SCOPE_NAMED(boundary_scope, "frame boundary");
+    uint64_t completed_value = completed_frame_value(rend);
+    reload_changed_shaders(rend);
+    update_pipelines(rend, completed_value);
+    bindless_recycle_indices(rend.bindless, completed_value);
+    release_retired_transients(rend.allocator, rend.transients, completed_value);
+    reclaim_uploads(rend.uploads, completed_value);
+    CPU_SCOPE_END(boundary_scope);
+
+    if (!rend.headless)
     {
-        fmt::print("Failed to reset fence from submission frame index {} with code {}", rend.current_submission_frame_index, magic_enum::enum_name(err));
-        return VK_ERROR_UNKNOWN;
+        std::erase_if(rend.retired_swapchains, [&rend, completed_value](retired_swapchain &retired) {
+            if (retired.timeline_value > completed_value)
+                return false;
+            destroy_swapchain_frames(rend, retired.frames);
+            vkDestroySwapchainKHR(rend.device, retired.swapchain, nullptr);
+            return true;
+        });
+
+        // Compared with the size the swapchain was created for, its extent can differ after clamping or when the
+        // surface picks its own
+        int width = 0, height = 0;
+        glfwGetFramebufferSize(rend.glfw_window, &width, &height);
+        if (static_cast<uint32_t>(width) != rend.swapchain_framebuffer_size.width ||
+            static_cast<uint32_t>(height) != rend.swapchain_framebuffer_size.height)
+        {
+            rend.swapchain_out_of_date = true;
+        }
+        if (rend.swapchain_out_of_date || rend.swapchain == VK_NULL_HANDLE)
+        {
+            err = create_swapchain(rend);
+            if (err == VK_NOT_READY)
+            {
+                // Minimized, nothing to draw into. Sleep until the window changes instead of spinning.
+                glfwWaitEvents();
+                return VK_SUCCESS;
+            }
+            else if (err != VK_SUCCESS)
+            {
+                return VK_ERROR_UNKNOWN;
+            }
+        }
     }
 
     uint32_t next_swapchain_image_index = 0;
-    err = vkAcquireNextImageKHR(rend.device, rend.swapchain, timeout, current_submission_frame.acquire_swapchain_semaphore, nullptr, &next_swapchain_image_index);
+    if (rend.headless)
+    {
+        // Offscreen images are handed out round robin, the wait above guarantees the image is no longer in use
+        next_swapchain_image_index = rend.current_swapchain_frame_index;
+        rend.current_swapchain_frame_index = (rend.current_swapchain_frame_index + 1) % static_cast<uint32_t>(rend.swapchain_frames.size());
+    }
+    else
+    {
+        CPU_SCOPE("acquire");
+        auto acquire_start = std::chrono::steady_clock::now();
+        err = vkAcquireNextImageKHR(rend.device, rend.swapchain, timeout, current_submission_frame.acquire_swapchain_semaphore, nullptr, &next_swapchain_image_index);
+        uint64_t acquire_ns = nanoseconds_since(acquire_start);
+        blocked_ns += acquire_ns;
+        add_blocked_time(rend.pacer, acquire_ns);
+    }
     if (err == VK_TIMEOUT)
     {
         fmt::print("vkAcquireNextImageKHR on submission frame index {} exceeded timeout {}ns", rend.current_submission_frame_index, timeout);
         return err;
     }
+    else if (err == VK_ERROR_OUT_OF_DATE_KHR)
+    {
+        // Nothing was acquired and the semaphore is untouched, skip the frame
+        rend.swapchain_out_of_date = true;
+        return VK_SUCCESS;
+    }
     else if (err == VK_SUBOPTIMAL_KHR)
     {
-        fmt::print("vkAcquireNextImageKHR reported VK_SUBOPTIMAL_KHR from submission frame index {}", rend.current_submission_frame_index);
-        return err;
+        // The image is acquired and still usable, draw this frame and recreate before the next
+        rend.swapchain_out_of_date = true;
     }
     else if (err != VK_SUCCESS)
     {
@@ -778,219 +1707,451 @@ VkResult render(renderer &rend)
     auto &current_swapchain_frame = rend.swapchain_frames.at(next_swapchain_image_index);
     auto &command_buffer = current_submission_frame.command_buffer;
 
-    err = vkResetCommandBuffer(command_buffer, 0);
+    CPU_SCOPE_NAMED(reset_scope, "reset command pool");
+    err = vkResetCommandPool(rend.device, current_submission_frame.command_pool, 0);
+    for (size_t i = 0; i < current_submission_frame.slice_command_pools.size() && err == VK_SUCCESS; i++)
+    {
+        err = vkResetCommandPool(rend.device, current_submission_frame.slice_command_pools[i], 0);
+    }
+    CPU_SCOPE_END(reset_scope);
     if (err != VK_SUCCESS)
     {
-        fmt::print("Failed to reset command buffer from submission frame {} with code {}", rend.current_submission_frame_index, magic_enum::enum_name(err));
+        fmt::print("Failed to reset command pool from submission frame {} with code {}", rend.current_submission_frame_index, magic_enum::enum_name(err));
         return VK_ERROR_UNKNOWN;
     }
     VkCommandBufferBeginInfo command_buffer_begin_info{
         .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
         .flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT,
     };
+    CPU_SCOPE_NAMED(record_scope, "record");
     err = vkBeginCommandBuffer(command_buffer, &command_buffer_begin_info);
     if (err != VK_SUCCESS)
     {
         fmt::print("Failed to being command buffer from submission frame {} with code {}", rend.current_submission_frame_index, magic_enum::enum_name(err));
         return VK_ERROR_UNKNOWN;
     }
+    begin_gpu_frame(rend.profiler, command_buffer, rend.current_submission_frame_index, rend.frame_count);
+    begin_gpu_scope(rend.profiler, command_buffer, "frame");
+
+    // Everything uploaded before this frame goes ahead of the frame's own commands in one batch, and becomes visible
+    // through the acquires and the wait on the upload queue
+    uint64_t upload_value = 0;
+    CPU_SCOPE_NAMED(upload_scope, "submit uploads");
+    err = submit_uploads(rend.uploads, upload_value);
+    CPU_SCOPE_END(upload_scope);
+    if (err != VK_SUCCESS)
+    {
+        return VK_ERROR_UNKNOWN;
+    }
+    record_upload_acquires(rend.uploads, command_buffer, current_frame_value(rend));
+    if (rend.background.acquire_pending)
+    {
+        VkDependencyInfo dependency_info{
+            .sType = VK_STRUCTURE_TYPE_DEPENDENCY_INFO,
+            .imageMemoryBarrierCount = 1,
+            .pImageMemoryBarriers = &rend.background.acquire,
+        };
+        vkCmdPipelineBarrier2(command_buffer, &dependency_info);
+        rend.background.acquire_pending = false;
+    }
 
-    // VkDescriptorImageInfo descriptor_image_info{
-    // .imageView = current_swapchain_frame.image_view,
-    // .imageLayout = VK_IMAGE_LAYOUT_GENERAL,
-    // };
-
-    // VkWriteDescriptorSet write_descriptor_set = {
-    // .sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
-    // .pNext = nullptr,
-    // .dstSet = rend.gradient_descriptor_set,
-    // .dstBinding = 0,
-    // .descriptorCount = 1,
-    // .descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE,
-    // .pImageInfo = &descriptor_image_info,
-    // };
-
-    // vkUpdateDescriptorSets(rend.device, 1, &write_descriptor_set, 0, nullptr);
-
-    // Transition swapchain image from UNDEFINED to VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL
-    VkImageMemoryBarrier2 image_memory_barrier{
-        .sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER_2,
-        .srcStageMask = VK_PIPELINE_STAGE_2_COLOR_ATTACHMENT_OUTPUT_BIT_KHR,
-        .srcAccessMask = VK_ACCESS_2_NONE,
-        .dstStageMask = VK_PIPELINE_STAGE_2_COLOR_ATTACHMENT_OUTPUT_BIT_KHR,
-        .dstAccessMask = VK_ACCESS_2_COLOR_ATTACHMENT_WRITE_BIT_KHR,
-        .oldLayout = VK_IMAGE_LAYOUT_UNDEFINED,
-        .newLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL,
-        .srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
-        .dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
-        .image = current_swapchain_frame.image,
-        .subresourceRange = single_color_image_subresource_range,
-    };
-
-    VkDependencyInfo dependency_info_undefined_to_color_attach{
-        .sType = VK_STRUCTURE_TYPE_DEPENDENCY_INFO,
-        .imageMemoryBarrierCount = 1,
-        .pImageMemoryBarriers = &image_memory_barrier};
-
-    vkCmdPipelineBarrier2(command_buffer, &dependency_info_undefined_to_color_attach);
-
-    VkRenderingAttachmentInfoKHR rendering_attachment_info{
-        .sType = VK_STRUCTURE_TYPE_RENDERING_ATTACHMENT_INFO_KHR,
-        .imageView = current_swapchain_frame.image_view,
-        .imageLayout = VK_IMAGE_LAYOUT_ATTACHMENT_OPTIMAL_KHR,
-        .loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR,
-        .storeOp = VK_ATTACHMENT_STORE_OP_STORE,
-        .clearValue = VkClearValue{0.f, (100 + rend.frame_count) % 128 / 256.f, 0.f, 0.f},
-    };
-
-    VkRenderingInfoKHR rendering_info{
-        .sType = VK_STRUCTURE_TYPE_RENDERING_INFO,
-        .renderArea = rend.swapchain_image_render_area,
-        .layerCount = 1,
-        .viewMask = 0,
-        .colorAttachmentCount = 1,
-        .pColorAttachments = &rendering_attachment_info,
-    };
-
-    VkViewport viewport{
-        .width = static_cast<float>(rend.swapchain_image_render_area.extent.width),
-        .height = static_cast<float>(rend.swapchain_image_render_area.extent.height),
-        .maxDepth = 1.0f,
-    };
-    vkCmdSetViewport(command_buffer, 0, 1, &viewport);
-    VkRect2D extent = {.offset = {0, 0}, .extent = rend.swapchain_image_render_area.extent};
-    vkCmdSetScissor(command_buffer, 0, 1, &extent);
-
-    // bind the descriptor set containing the draw image for the compute pipeline
-    vkCmdBindDescriptorSets(command_buffer, VK_PIPELINE_BIND_POINT_COMPUTE, rend.gradient_pipeline_layout, 0, 1, &rend.gradient_descriptor_set, 0, nullptr);
-    vkCmdBeginRendering(command_buffer, &rendering_info);
-    vkCmdBindPipeline(command_buffer, VK_PIPELINE_BIND_POINT_GRAPHICS, rend.gradient_pipeline);
-    vkCmdDraw(command_buffer, 3, 1, 0, 0);
-    vkCmdEndRendering(command_buffer);
-
-    // bind the gradient drawing compute pipeline
-    // vkCmdBindPipeline(command_buffer, VK_PIPELINE_BIND_POINT_COMPUTE, rend.gradient_pipeline);
+    // The bindless heap is the only descriptor set, bound once per command buffer for both bind points
+    vkCmdBindDescriptorSets(command_buffer, VK_PIPELINE_BIND_POINT_GRAPHICS, rend.pipeline_layout, 0, 1, &rend.bindless.set, 0, nullptr);
+    vkCmdBindDescriptorSets(command_buffer, VK_PIPELINE_BIND_POINT_COMPUTE, rend.pipeline_layout, 0, 1, &rend.bindless.set, 0, nullptr);
+
+    // The image is first touched at COLOR_ATTACHMENT_OUTPUT, where the submission waits for the acquire. Offscreen
+    // images end up ready to be copied out instead of presented.
+    begin_render_graph(rend.graph);
+    graph_resource backbuffer = import_graph_image(
+        rend.graph, "backbuffer", current_swapchain_frame.image, single_color_image_subresource_range,
+        graph_resource_state{VK_PIPELINE_STAGE_2_COLOR_ATTACHMENT_OUTPUT_BIT, VK_ACCESS_2_NONE, VK_IMAGE_LAYOUT_UNDEFINED},
+        graph_usage_state(rend.headless ? graph_usage::transfer_source : graph_usage::present));
+    graph_resource depth = create_graph_image(rend.graph, "depth", {rend.depth_format, rend.swapchain_image_render_area.extent, VK_IMAGE_ASPECT_DEPTH_BIT});
+
+    bool draw_background = rend.background.image != VK_NULL_HANDLE;
+    if (draw_background)
+    {
+        // Left ready to be blitted from by the compute submission, and by every frame after
+        graph_resource_state blit_state = graph_usage_state(graph_usage::transfer_source);
+        graph_resource background =
+            import_graph_image(rend.graph, "background", rend.background.image, single_color_image_subresource_range, blit_state, blit_state);
+        add_graph_pass(rend.graph, "background", {{background, graph_usage::transfer_source}, {backbuffer, graph_usage::transfer_destination}},
+                       [&rend, &current_swapchain_frame](VkCommandBuffer command_buffer) {
+            VkExtent2D src_extent = rend.background.extent;
+            VkExtent2D dst_extent = rend.swapchain_image_render_area.extent;
+            VkImageBlit region{
+                .srcSubresource = VkImageSubresourceLayers{VK_IMAGE_ASPECT_COLOR_BIT, 0, 0, 1},
+                .srcOffsets = {{0, 0, 0}, {static_cast<int32_t>(src_extent.width), static_cast<int32_t>(src_extent.height), 1}},
+                .dstSubresource = VkImageSubresourceLayers{VK_IMAGE_ASPECT_COLOR_BIT, 0, 0, 1},
+                .dstOffsets = {{0, 0, 0}, {static_cast<int32_t>(dst_extent.width), static_cast<int32_t>(dst_extent.height), 1}},
+            };
+            vkCmdBlitImage(command_buffer, rend.background.image, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, current_swapchain_frame.image,
+                           VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &region, VK_FILTER_LINEAR);
+        });
+    }
 
-    // execute the compute pipeline dispatch. We are using 16x16 workgroup size so we need to divide by it
-    // vkCmdDispatch(command_buffer, std::ceil(rend.swapchain_image_render_area.extent.width / 16.0), std::ceil(rend.swapchain_image_render_area.extent.height / 16.0), 1);
+    uint32_t slice_count = draw_slice_count(rend, current_submission_frame);
+    VkResult slice_result = VK_SUCCESS;
+    add_graph_pass(rend.graph, "main pass", {{backbuffer, graph_usage::color_attachment}, {depth, graph_usage::depth_attachment}},
+                   [&rend, &current_swapchain_frame, &current_submission_frame, depth, draw_background, slice_count, &slice_result](VkCommandBuffer command_buffer) {
+        VkRenderingAttachmentInfoKHR rendering_attachment_info{
+            .sType = VK_STRUCTURE_TYPE_RENDERING_ATTACHMENT_INFO_KHR,
+            .imageView = current_swapchain_frame.image_view,
+            .imageLayout = VK_IMAGE_LAYOUT_ATTACHMENT_OPTIMAL_KHR,
+            .loadOp = draw_background ? VK_ATTACHMENT_LOAD_OP_LOAD : VK_ATTACHMENT_LOAD_OP_CLEAR,
+            .storeOp = VK_ATTACHMENT_STORE_OP_STORE,
+            .clearValue = VkClearValue{0.f, (100 + rend.frame_count) % 128 / 256.f, 0.f, 0.f},
+        };
+        // Never stored, so on tilers it can stay in tile memory
+        VkRenderingAttachmentInfoKHR depth_attachment_info{
+            .sType = VK_STRUCTURE_TYPE_RENDERING_ATTACHMENT_INFO_KHR,
+            .imageView = graph_image_view(rend.graph, depth),
+            .imageLayout = VK_IMAGE_LAYOUT_ATTACHMENT_OPTIMAL_KHR,
+            .loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR,
+            .storeOp = VK_ATTACHMENT_STORE_OP_DONT_CARE,
+            .clearValue = VkClearValue{.depthStencil = {1.f, 0}},
+        };
 
-    VkImageMemoryBarrier2 to_present_src_image_memory_barrier{
-        .sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER_2,
-        .srcStageMask = VK_PIPELINE_STAGE_2_COLOR_ATTACHMENT_OUTPUT_BIT_KHR,
-        .srcAccessMask = VK_ACCESS_2_COLOR_ATTACHMENT_WRITE_BIT_KHR,
-        .dstStageMask = VK_PIPELINE_STAGE_2_NONE,
-        .dstAccessMask = VK_ACCESS_2_NONE,
-        .oldLayout = VK_IMAGE_LAYOUT_ATTACHMENT_OPTIMAL,
-        .newLayout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR,
-        .srcQueueFamilyIndex = 0,
-        .dstQueueFamilyIndex = 0,
-        .image = current_swapchain_frame.image,
-        .subresourceRange = single_color_image_subresource_range,
-    };
+        VkRenderingInfoKHR rendering_info{
+            .sType = VK_STRUCTURE_TYPE_RENDERING_INFO,
+            .renderArea = rend.swapchain_image_render_area,
+            .layerCount = 1,
+            .viewMask = 0,
+            .colorAttachmentCount = 1,
+            .pColorAttachments = &rendering_attachment_info,
+            .pDepthAttachment = &depth_attachment_info,
+        };
 
-    VkDependencyInfo dependency_info_color_attach_to_present_src{
-        .sType = VK_STRUCTURE_TYPE_DEPENDENCY_INFO,
-        .imageMemoryBarrierCount = 1,
-        .pImageMemoryBarriers = &to_present_src_image_memory_barrier,
-    };
+        // Secondary command buffers can only run inside a statistics query when they inherit it
+        begin_gpu_scope(rend.profiler, command_buffer, "main pass", slice_count < 2 || rend.inherited_queries_supported);
+        if (slice_count < 2)
+        {
+            vkCmdBeginRendering(command_buffer, &rendering_info);
+            record_draws(rend, command_buffer, 0, static_cast<uint32_t>(rend.draws.size()));
+        }
+        else
+        {
+            // Executed in slice order, so the draws end up in the same order as when recorded directly
+            slice_result = record_draw_slices(rend, current_submission_frame, slice_count);
+            rendering_info.flags = VK_RENDERING_CONTENTS_SECONDARY_COMMAND_BUFFERS_BIT;
+            vkCmdBeginRendering(command_buffer, &rendering_info);
+            if (slice_result == VK_SUCCESS)
+            {
+                vkCmdExecuteCommands(command_buffer, slice_count, current_submission_frame.slice_command_buffers.data());
+            }
+        }
+        vkCmdEndRendering(command_buffer);
+        end_gpu_scope(rend.profiler, command_buffer);
+    });
 
-    vkCmdPipelineBarrier2(command_buffer, &dependency_info_color_attach_to_present_src);
+    // Images replaced by a rebuild may still be in use by the frames before this one
+    err = prepare_render_graph(rend.graph, rend.allocator, rend.transients, current_frame_value(rend) - 1);
+    if (err != VK_SUCCESS)
+    {
+        return VK_ERROR_UNKNOWN;
+    }
+    execute_render_graph(rend.graph, command_buffer);
+    end_gpu_scope(rend.profiler, command_buffer);
+    if (slice_result != VK_SUCCESS)
+    {
+        return VK_ERROR_UNKNOWN;
+    }
 
     err = vkEndCommandBuffer(command_buffer);
+    CPU_SCOPE_END(record_scope);
     if (err != VK_SUCCESS)
     {
         fmt::print("Failed to end command buffer from submission frame {} with code {}", rend.current_submission_frame_index, magic_enum::enum_name(err));
         return VK_ERROR_UNKNOWN;
     }
 
-    VkPipelineStageFlags wait_stages = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
-    VkSubmitInfo submit_info{
-        .sType = VK_STRUCTURE_TYPE_SUBMIT_INFO,
-        .waitSemaphoreCount = 1,
-        .pWaitSemaphores = &current_submission_frame.acquire_swapchain_semaphore,
-        .pWaitDstStageMask = &wait_stages,
-        .commandBufferCount = 1,
-        .pCommandBuffers = &current_submission_frame.command_buffer,
-        .signalSemaphoreCount = 1,
-        .pSignalSemaphores = &current_submission_frame.present_swapchain_semaphore,
+    // The swapchain image is first touched by the layout transition at COLOR_ATTACHMENT_OUTPUT, and last written there
+    // before it is presented. The timeline waits for everything since it guards reuse of the frame's resources.
+    std::vector<VkSemaphoreSubmitInfo> wait_semaphore_infos = std::move(rend.frame_waits);
+    rend.frame_waits.clear();
+    wait_semaphore_infos.push_back(upload_wait_info(rend.uploads));
+    if (!rend.headless)
+    {
+        wait_semaphore_infos.push_back(VkSemaphoreSubmitInfo{
+            .sType = VK_STRUCTURE_TYPE_SEMAPHORE_SUBMIT_INFO,
+            .semaphore = current_submission_frame.acquire_swapchain_semaphore,
+            .stageMask = VK_PIPELINE_STAGE_2_COLOR_ATTACHMENT_OUTPUT_BIT,
+        });
+    }
+    current_submission_frame.timeline_value = current_frame_value(rend);
+    VkSemaphoreSubmitInfo signal_semaphore_infos[] = {
+        {
+            .sType = VK_STRUCTURE_TYPE_SEMAPHORE_SUBMIT_INFO,
+            .semaphore = rend.frame_timeline,
+            .value = current_submission_frame.timeline_value,
+            .stageMask = VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT,
+        },
+        {
+            .sType = VK_STRUCTURE_TYPE_SEMAPHORE_SUBMIT_INFO,
+            .semaphore = current_swapchain_frame.present_semaphore,
+            .stageMask = VK_PIPELINE_STAGE_2_COLOR_ATTACHMENT_OUTPUT_BIT,
+        },
+    };
+    VkCommandBufferSubmitInfo command_buffer_submit_info{
+        .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_SUBMIT_INFO,
+        .commandBuffer = current_submission_frame.command_buffer,
+    };
+    VkSubmitInfo2 submit_info{
+        .sType = VK_STRUCTURE_TYPE_SUBMIT_INFO_2,
+        .waitSemaphoreInfoCount = static_cast<uint32_t>(wait_semaphore_infos.size()),
+        .pWaitSemaphoreInfos = wait_semaphore_infos.data(),
+        .commandBufferInfoCount = 1,
+        .pCommandBufferInfos = &command_buffer_submit_info,
+        .signalSemaphoreInfoCount = rend.headless ? 1u : 2u,
+        .pSignalSemaphoreInfos = signal_semaphore_infos,
     };
-    err = vkQueueSubmit(rend.main_queue, 1, &submit_info, current_submission_frame.fence);
+    CPU_SCOPE_NAMED(submit_scope, "submit");
+    err = vkQueueSubmit2(rend.main_queue, 1, &submit_info, VK_NULL_HANDLE);
+    CPU_SCOPE_END(submit_scope);
     if (err != VK_SUCCESS)
     {
         fmt::print("Failed to submit command buffer from submission frame {} with code {}", rend.current_submission_frame_index, magic_enum::enum_name(err));
         return VK_ERROR_UNKNOWN;
     }
 
-    VkPresentInfoKHR present_info{
-        .sType = VK_STRUCTURE_TYPE_PRESENT_INFO_KHR,
-        .waitSemaphoreCount = 1,
-        .pWaitSemaphores = &current_submission_frame.present_swapchain_semaphore,
-        .swapchainCount = 1,
-        .pSwapchains = &rend.swapchain,
-        .pImageIndices = &next_swapchain_image_index,
-        .pResults = nullptr,
-    };
-
-    vkQueuePresentKHR(rend.main_queue, &present_info);
-    if (err != VK_SUCCESS)
+    if (!rend.headless)
     {
-        fmt::print("Failed to present swapchain frame {} with code {}", rend.current_submission_frame_index, magic_enum::enum_name(err));
-        return VK_ERROR_UNKNOWN;
+        // Tags the present so the frame pacer can wait for it to reach the display
+        uint64_t present_id = 0;
+        VkPresentIdKHR present_id_info{
+            .sType = VK_STRUCTURE_TYPE_PRESENT_ID_KHR,
+            .swapchainCount = 1,
+            .pPresentIds = &present_id,
+        };
+        if (rend.pacer.wait_for_present != nullptr)
+        {
+            present_id = next_present_id(rend.pacer);
+        }
+        VkPresentInfoKHR present_info{
+            .sType = VK_STRUCTURE_TYPE_PRESENT_INFO_KHR,
+            .pNext = rend.pacer.wait_for_present != nullptr ? &present_id_info : nullptr,
+            .waitSemaphoreCount = 1,
+            .pWaitSemaphores = &current_swapchain_frame.present_semaphore,
+            .swapchainCount = 1,
+            .pSwapchains = &rend.swapchain,
+            .pImageIndices = &next_swapchain_image_index,
+            .pResults = nullptr,
+        };
+
+        CPU_SCOPE_NAMED(present_scope, "present");
+        err = vkQueuePresentKHR(rend.main_queue, &present_info);
+        CPU_SCOPE_END(present_scope);
+        if (err == VK_SUBOPTIMAL_KHR || err == VK_ERROR_OUT_OF_DATE_KHR)
+        {
+            // The frame is already submitted, recreate before the next one
+            rend.swapchain_out_of_date = true;
+        }
+        else if (err != VK_SUCCESS)
+        {
+            fmt::print("Failed to present swapchain frame {} with code {}", rend.current_submission_frame_index, magic_enum::enum_name(err));
+            return VK_ERROR_UNKNOWN;
+        }
     }
-    rend.current_submission_frame_index = (rend.current_submission_frame_index + 1) % 2;
+    rend.current_submission_frame_index = (rend.current_submission_frame_index + 1) % static_cast<uint32_t>(rend.submission_frames.size());
 
+    uint64_t frame_ns = nanoseconds_since(frame_start);
+    rend.frame_cpu_ns = frame_ns - std::min(blocked_ns, frame_ns);
     return VK_SUCCESS;
 }
 
+std::filesystem::path resolve_cache_directory(init_settings &settings)
+{
+    if (!settings.cache_directory.empty())
+    {
+        return settings.cache_directory;
+    }
+    if (const char *xdg_cache_home = std::getenv("XDG_CACHE_HOME"); xdg_cache_home && *xdg_cache_home)
+    {
+        return std::filesystem::path(xdg_cache_home) / "wamodren";
+    }
+    if (const char *home = std::getenv("HOME"); home && *home)
+    {
+        return std::filesystem::path(home) / ".cache" / "wamodren";
+    }
+    return std::filesystem::temp_directory_path() / "wamodren";
+}
+
 int init_renderer(init_settings &settings, renderer &rend)
 {
+    rend.headless = settings.headless;
+    rend.cache_directory = resolve_cache_directory(settings);
+    rend.startup_timings.clear();
+    auto stage_start = std::chrono::steady_clock::now();
+    auto end_stage = [&rend, &stage_start](const char *stage) {
+        rend.startup_timings.push_back(startup_timing{stage, nanoseconds_since(stage_start)});
+        stage_start = std::chrono::steady_clock::now();
+    };
+
     if (init_instance(settings, rend) != VK_SUCCESS)
         return -1;
+    end_stage("instance");
     if (choose_physical_device(settings, rend) != VK_SUCCESS)
         return -1;
     if (init_device(settings, rend) != VK_SUCCESS)
         return -1;
-    if (init_swapchain(settings, rend) != VK_SUCCESS)
+    end_stage("device");
+    init_frame_pacer(rend.device, rend.present_wait_supported && settings.frame_pacing, rend.pacer);
+    // bufferDeviceAddress is a required feature
+    if (init_gpu_allocator(rend.physical_device, rend.device, true, rend.allocator) != VK_SUCCESS)
         return -1;
-    if (init_frame_data(settings, rend) != VK_SUCCESS)
+    if (init_upload_ring(rend.allocator, rend.transfer_queue, rend.queue_families.transfer_granularity, rend.queue_families.graphics,
+                         settings.upload_ring_size, rend.uploads) != VK_SUCCESS)
         return -1;
-
-    // Check that shader compiler is available
-    if (system("slangc") != 0)
+    init_transient_pool(rend.allocator, rend.transients);
+    if (choose_depth_format(rend) != VK_SUCCESS)
+        return -1;
+    end_stage("allocator");
+    if (rend.headless)
+    {
+        if (init_offscreen_targets(settings, rend) != VK_SUCCESS)
+            return -1;
+    }
+    else
     {
-        fmt::print("slangc not found!");
+        if (init_swapchain(settings, rend) != VK_SUCCESS)
+            return -1;
+    }
+    if (init_frame_data(settings, rend) != VK_SUCCESS)
         return -1;
+    end_stage("swapchain");
+    if (settings.gpu_profiling)
+    {
+        if (settings.gpu_pipeline_statistics && !rend.pipeline_statistics_supported)
+        {
+            fmt::print("Physical device doesn't support pipeline statistics queries, only collecting timestamps\n");
+        }
+        if (init_gpu_profiler(rend.physical_device, rend.device, rend.queue_families.graphics, static_cast<uint32_t>(rend.submission_frames.size()),
+                              settings.gpu_pipeline_statistics && rend.pipeline_statistics_supported, settings.gpu_trace_path, rend.profiler) != VK_SUCCESS)
+            return -1;
     }
+    if (init_meshes(settings, rend) != VK_SUCCESS)
+        return -1;
+    end_stage("meshes");
+
+    init_worker_pool(settings.worker_thread_count, rend.workers);
+    if (init_draw_slices(settings, rend) != VK_SUCCESS)
+        return -1;
+    shader_compiler_options compiler_options{
+        .prefer_embedded_shaders = !settings.runtime_shader_compilation,
+        .optimization = settings.shader_optimization,
+        .strip_debug_info = settings.strip_shader_debug_info,
+    };
+    rend.measure_spirv_optimization = settings.measure_shader_optimization;
+    // Reading the pipeline cache from disk overlaps with setting up the shader compiler
+    job_counter pipeline_cache_loaded;
+    VkResult pipeline_cache_result = VK_SUCCESS;
+    submit_job(
+        rend.workers,
+        [&rend, &pipeline_cache_result]() {
+            pipeline_cache_result = init_pipeline_cache(rend.physical_device, rend.device, rend.cache_directory, rend.pipeline_cache);
+        },
+        &pipeline_cache_loaded);
+    VkResult compiler_result = init_shader_compiler(rend.cache_directory, compiler_options, rend.compiler);
+    wait_for_counter(rend.workers, pipeline_cache_loaded);
+    if (compiler_result != VK_SUCCESS || pipeline_cache_result != VK_SUCCESS)
+        return -1;
+    if (init_bindless_heap(rend.physical_device, rend.device, rend.bindless) != VK_SUCCESS)
+        return -1;
     if (init_pipeline_layout(rend) != VK_SUCCESS)
         return -1;
+    end_stage("shader setup");
     if (init_graphics_pipelines(settings, rend) != VK_SUCCESS)
         return -1;
-    if (init_descriptors(rend) != VK_SUCCESS)
+    rend.draws.push_back(scene_draw{rend.triangle_pipeline, rend.triangle_mesh});
+    if (init_compute_background(rend) != VK_SUCCESS)
         return -1;
+    end_stage("pipelines");
+    if (settings.hot_reload_shaders && !rend.compiler.use_embedded_shaders && init_shader_watcher(rend.compiler.shader_directory, rend.watcher) != VK_SUCCESS)
+    {
+        // Not fatal, the renderer works the same without reloading
+        fmt::print("Shader hot reload is disabled\n");
+    }
     return 0;
 }
 
 void shutdown_renderer(renderer &rend)
 {
     vkDeviceWaitIdle(rend.device);
-    vkDestroyDescriptorPool(rend.device, rend.gradient_descriptor_pool, nullptr);
-    vkDestroyPipeline(rend.device, rend.gradient_pipeline, nullptr);
-    vkDestroyPipelineLayout(rend.device, rend.gradient_pipeline_layout, nullptr);
-    vkDestroyDescriptorSetLayout(rend.device, rend.gradient_descriptor_set_layout, nullptr);
-    for (auto &swapchain_frame : rend.swapchain_frames)
+    flush_gpu_profiler(rend.profiler);
+    print_gpu_profiler_stats(rend.profiler);
+    destroy_gpu_profiler(rend.profiler);
+    print_render_graph_stats(rend.graph);
+    if (rend.sliced_frame_count > 0)
+    {
+        fmt::print("Recorded draws in parallel in {} of {} frames, {:.1f} slices per frame\n", rend.sliced_frame_count, rend.frame_count,
+                   static_cast<double>(rend.recorded_slice_count) / rend.sliced_frame_count);
+    }
+    print_transient_pool_stats(rend.allocator, rend.transients);
+    destroy_transient_pool(rend.allocator, rend.transients);
+    destroy_shader_watcher(rend.watcher);
+    shutdown_worker_pool(rend.workers);
+    print_worker_pool_stats(rend.workers);
+    for (auto &entry : rend.completed_pipelines)
     {
-        vkDestroyImageView(rend.device, swapchain_frame.image_view, nullptr);
+        vkDestroyPipeline(rend.device, entry.result.pipeline, nullptr);
+    }
+    for (auto &retired : rend.retired_pipelines)
+    {
+        vkDestroyPipeline(rend.device, retired.pipeline, nullptr);
+    }
+    for (auto &slot : rend.pipelines)
+    {
+        vkDestroyPipeline(rend.device, slot.pipeline, nullptr);
+    }
+    print_pipeline_cache_stats(rend.pipeline_cache);
+    save_pipeline_cache(rend.physical_device, rend.device, rend.pipeline_cache);
+    destroy_pipeline_cache(rend.device, rend.pipeline_cache);
+    vkDestroyPipelineLayout(rend.device, rend.pipeline_layout, nullptr);
+    destroy_bindless_heap(rend.device, rend.bindless);
+    destroy_mesh_pool(rend.allocator, rend.meshes);
+    destroy_compute_background(rend);
+    if (rend.headless)
+    {
+        for (auto &swapchain_frame : rend.swapchain_frames)
+        {
+            vkDestroyImageView(rend.device, swapchain_frame.image_view, nullptr);
+            destroy_image(rend.allocator, swapchain_frame.image, swapchain_frame.allocation);
+        }
+    }
+    else
+    {
+        for (auto &retired : rend.retired_swapchains)
+        {
+            destroy_swapchain_frames(rend, retired.frames);
+            vkDestroySwapchainKHR(rend.device, retired.swapchain, nullptr);
+        }
+        destroy_swapchain_frames(rend, rend.swapchain_frames);
     }
     for (auto &submission_frame : rend.submission_frames)
     {
         vkDestroySemaphore(rend.device, submission_frame.acquire_swapchain_semaphore, nullptr);
-        vkDestroySemaphore(rend.device, submission_frame.present_swapchain_semaphore, nullptr);
-        vkDestroyFence(rend.device, submission_frame.fence, nullptr);
+        vkDestroyCommandPool(rend.device, submission_frame.command_pool, nullptr);
+        for (VkCommandPool command_pool : submission_frame.slice_command_pools)
+        {
+            vkDestroyCommandPool(rend.device, command_pool, nullptr);
+        }
     }
-    vkDestroyCommandPool(rend.device, rend.submission_command_pool, nullptr);
+    vkDestroySemaphore(rend.device, rend.frame_timeline, nullptr);
 
-    vkDestroySwapchainKHR(rend.device, rend.swapchain, nullptr);
+    if (!rend.headless)
+    {
+        vkDestroySwapchainKHR(rend.device, rend.swapchain, nullptr);
+    }
+    print_upload_stats(rend.uploads);
+    destroy_upload_ring(rend.allocator, rend.uploads);
+    destroy_gpu_queue(rend.transfer_queue);
+    destroy_gpu_queue(rend.compute_queue);
+    print_gpu_allocator_stats(rend.allocator);
+    destroy_gpu_allocator(rend.allocator);
     vkDestroyDevice(rend.device, nullptr);
-    vkDestroySurfaceKHR(rend.inst, rend.surface, nullptr);
+    if (!rend.headless)
+    {
+        vkDestroySurfaceKHR(rend.inst, rend.surface, nullptr);
+    }
     vkDestroyInstance(rend.inst, nullptr);
 }
@@ -2,43 +2,232 @@
 
 #include <vector>
 #include <string>
+#include <mutex>
 
 #include <vulkan/vulkan_core.h>
 #include <GLFW/glfw3.h>
 
+#include "shader_compiler.hpp"
+#include "pipeline_cache.hpp"
+#include "worker_pool.hpp"
+#include "shader_watcher.hpp"
+#include "gpu_allocator.hpp"
+#include "device_queues.hpp"
+#include "bindless_heap.hpp"
+#include "upload_ring.hpp"
+#include "mesh_pool.hpp"
+#include "frame_pacer.hpp"
+#include "gpu_profiler.hpp"
+#include "render_graph.hpp"
+#include "transient_pool.hpp"
+
+// The minimum maxPushConstantsSize every device supports
+constexpr uint32_t max_push_constants_size = 128;
+
 struct init_settings
 {
     int window_width = 800;
     int window_height = 600;
+
+    // MAILBOX and IMMEDIATE don't block on vblank, cutting latency at the cost of wasted frames or tearing. Falls back
+    // to FIFO, which every surface supports, when the surface doesn't offer the requested mode.
+    VkPresentModeKHR present_mode = VK_PRESENT_MODE_FIFO_KHR;
+    uint32_t swapchain_image_count = 3; // Clamped to what the surface allows
+
+    // Render into a ring of device-local images instead of a swapchain. No GLFW window or VkSurfaceKHR is created.
+    bool headless = false;
+    uint32_t offscreen_image_count = 3;
+    uint64_t headless_frame_count = 1000;
+
+    // Frames the CPU may record ahead of the GPU. 1 gives the lowest latency, more keep the GPU busy under heavy loads.
+    // Clamped to offscreen_image_count when headless. Independent of the swapchain's image count, which can change
+    // whenever the swapchain is recreated, since acquiring already waits for an image to be free.
+    uint32_t frames_in_flight = 2;
+
+    // Sleep before polling input so it is sampled as late as the next present allows. Uses VK_KHR_present_wait when
+    // the device supports it. Only applies when presenting to a window.
+    bool frame_pacing = true;
+
+    // Root of the on-disk shader and pipeline caches. Defaults to $XDG_CACHE_HOME/wamodren when empty.
+    std::string cache_directory;
+
+    // Threads used to compile shaders, create pipelines, and record draws, 0 uses one per hardware thread
+    uint32_t worker_thread_count = 0;
+
+    // Draws are split into slices of at least this many, each recorded into a secondary command buffer by the worker
+    // threads and the main thread. Frames with fewer than two slices of draws, or all of them when 0, are recorded
+    // directly into the frame's command buffer.
+    uint32_t draws_per_recording_slice = 512;
+
+    // Compile shaders at runtime even when the build embedded their SPIR-V, for iterating on shaders
+    bool runtime_shader_compilation = false;
+
+    // Optimize the SPIR-V before handing it to the driver. Measuring creates every pipeline twice more without the
+    // pipeline cache, once from the compiled and once from the optimized SPIR-V, to report the creation time delta.
+    spirv_optimization shader_optimization = spirv_optimization::none;
+    bool strip_shader_debug_info = false;
+    bool measure_shader_optimization = false;
+
+    // Rebuild pipelines in the background whenever one of their shader sources changes on disk. Only takes effect
+    // when shaders are compiled at runtime.
+    bool hot_reload_shaders = true;
+
+    // Size of the buffer every mesh's vertices and indices are packed into
+    uint64_t mesh_pool_size = 64ull << 20;
+
+    // Staging space for uploads that are still in flight, larger uploads are split into pieces
+    uint64_t upload_ring_size = 32ull << 20;
+
+    // Time the frame's passes with GPU timestamps and print percentiles at shutdown. A gpu_trace_path also streams every
+    // pass to a Chrome trace JSON file. Pipeline statistics are skipped when the device lacks pipelineStatisticsQuery.
+    bool gpu_profiling = false;
+    bool gpu_pipeline_statistics = false;
+    std::string gpu_trace_path;
+
+    // Chrome trace of the CPU scopes, only written by builds with the CPU profiler enabled
+    std::string cpu_trace_path;
 };
 
 struct swapchain_frame
 {
     VkImage image{};
     VkImageView image_view{};
+    gpu_allocation allocation{}; // Only set for offscreen images, swapchain images are owned by the swapchain
+
+    // Signaled by rendering and waited on by the present. Kept per image rather than per frame since the image can't be
+    // acquired again until that present has consumed the semaphore.
+    VkSemaphore present_semaphore{};
+};
+
+// Replaced by oldSwapchain recreation, destroyed once the frames that could still be using it have completed
+struct retired_swapchain
+{
+    VkSwapchainKHR swapchain{};
+    std::vector<swapchain_frame> frames;
+    uint64_t timeline_value = 0;
 };
+
 struct submission_frame
 {
+    VkCommandPool command_pool{}; // Reset as a whole once the frame has completed
     VkCommandBuffer command_buffer{};
+    // One pool and secondary command buffer per recording slice, a slice is only ever recorded by one thread at a time
+    std::vector<VkCommandPool> slice_command_pools;
+    std::vector<VkCommandBuffer> slice_command_buffers;
     VkSemaphore acquire_swapchain_semaphore{};
-    VkSemaphore present_swapchain_semaphore{};
-    VkFence fence{};
+    uint64_t timeline_value = 0; // Value of renderer::frame_timeline once this frame's last submission has completed
+};
+
+// Gradient drawn once by the gradient compute shader on the async compute queue, then scaled into the backbuffer at the
+// start of every frame in place of a clear
+struct compute_background
+{
+    VkImage image{};
+    VkImageView image_view{};
+    gpu_allocation allocation{};
+    VkExtent2D extent{};
+    uint32_t storage_index = invalid_bindless_index;
+    VkCommandPool command_pool{}; // On queue_families.compute
+    VkImageMemoryBarrier2 acquire{};
+    bool acquire_pending = false; // Recorded by the first frame when the compute family differs from the graphics family
+};
+
+enum class pipeline_type
+{
+    graphics,
+    compute
+};
+
+struct pipeline_create_details
+{
+    pipeline_type type;
+    std::string shader_name;
+    uint32_t specialization = 0; // Value of the shader's constant_id 0, pipelines of one shader differ by it
+};
+
+struct pipeline_create_result
+{
+    VkResult result = VK_NOT_READY;
+    VkPipeline pipeline{};
+    uint64_t shader_load_ns = 0;     // Cache lookup, plus compilation on a miss
+    uint64_t pipeline_create_ns = 0; // vkCreate*Pipelines only
+};
+
+// Index into renderer::pipelines, stays valid for the lifetime of the renderer
+using pipeline_handle = uint32_t;
+constexpr pipeline_handle invalid_pipeline_handle = UINT32_MAX;
+
+enum class pipeline_status
+{
+    pending,
+    ready,
+    failed
+};
+
+struct pipeline_slot
+{
+    pipeline_create_details details;
+    pipeline_handle fallback = invalid_pipeline_handle; // Drawn with while this pipeline is pending or failed
+    pipeline_status status = pipeline_status::pending;
+    VkPipeline pipeline{};
+    uint32_t generation = 0; // Bumped for every rebuild, results from older builds are thrown away
+};
+
+struct completed_pipeline
+{
+    pipeline_handle handle = invalid_pipeline_handle;
+    uint32_t generation = 0;
+    pipeline_create_result result{};
+};
+
+struct retired_pipeline
+{
+    VkPipeline pipeline{};
+    uint64_t timeline_value = 0; // Destroyed once renderer::frame_timeline reaches this
+};
+
+// What the main pass draws, in order
+struct scene_draw
+{
+    pipeline_handle pipeline = invalid_pipeline_handle;
+    mesh geometry{};
+};
+
+struct startup_timing
+{
+    const char *stage;
+    uint64_t ns;
 };
 
 struct renderer
 {
+    bool headless = false;
     GLFWwindow *glfw_window{};
     VkInstance inst{};
     VkSurfaceKHR surface{};
     VkPhysicalDevice physical_device{};
+    std::vector<const char *> enabled_device_extensions;
+    bool present_wait_supported = false; // VK_KHR_present_id and VK_KHR_present_wait are enabled
+    bool pipeline_statistics_supported = false;
+    bool inherited_queries_supported = false; // Enabled along with pipeline statistics
     VkDevice device{};
-    VkQueue main_queue{};
+    queue_family_selection queue_families{};
+    VkQueue main_queue{};       // On queue_families.graphics, frames are rendered and presented here
+    gpu_queue compute_queue{};  // Async compute, see submit_async_compute
+    gpu_queue transfer_queue{}; // Uploads
+    gpu_allocator allocator{};
+    upload_ring uploads{};
     VkSurfaceCapabilitiesKHR surface_capabilities{};
     VkSwapchainKHR swapchain{};
+    VkPresentModeKHR present_mode = VK_PRESENT_MODE_FIFO_KHR;
+    uint32_t requested_swapchain_image_count = 0;
+    bool swapchain_out_of_date = false; // Set on resize, SUBOPTIMAL, or OUT_OF_DATE, the swapchain is recreated next frame
+    std::vector<retired_swapchain> retired_swapchains;
     VkFormat swapchain_image_format{};
+    VkFormat depth_format{};
     VkColorSpaceKHR swapchain_image_colorspace{};
     VkRect2D swapchain_image_render_area{};
-    VkCommandPool submission_command_pool{};
+    VkExtent2D swapchain_framebuffer_size{}; // Window size when the swapchain was created, a change means resizing
     uint32_t current_swapchain_frame_index = 0;
     std::vector<swapchain_frame> swapchain_frames;
 
@@ -46,27 +235,80 @@ struct renderer
     std::vector<submission_frame> submission_frames;
 
     uint64_t frame_count = 0;
+    uint64_t frame_cpu_ns = 0; // Time the last render() spent on the CPU, without waiting for the GPU or swapchain images
+    uint32_t draws_per_recording_slice = 0;
+    uint64_t sliced_frame_count = 0; // Frames whose draws were recorded in parallel
+    uint64_t recorded_slice_count = 0;
+    frame_pacer pacer{};
+    gpu_profiler profiler{};
+    render_graph graph{}; // Declared again every frame, recompiled only when its topology changes
+    transient_pool transients{};
 
-    // Simple Gradient pipeline
-    VkDescriptorSetLayout gradient_descriptor_set_layout{};
-    VkPipelineLayout gradient_pipeline_layout{};
-    VkPipeline gradient_pipeline{};
-    VkDescriptorPool gradient_descriptor_pool{};
-    VkDescriptorSet gradient_descriptor_set{};
-};
+    // Frame N signals N + 1 once all of its GPU work has completed, so a completed value of V means frames 0 through
+    // V - 1 are done. Deferred work stamps itself with a value and waits on or polls the semaphore.
+    VkSemaphore frame_timeline{};
+    std::vector<VkSemaphoreSubmitInfo> frame_waits; // Added to the next frame's submission, see wait_in_next_frame
 
-enum class pipeline_type
-{
-    graphics,
-    compute
-};
+    std::filesystem::path cache_directory;
+    shader_compiler compiler{};
+    persistent_pipeline_cache pipeline_cache{};
+    worker_pool workers{};
+    bool measure_spirv_optimization = false;
+    shader_watcher watcher{};
 
-struct pipeline_create_details
-{
-    pipeline_type type;
-    std::string shader_name;
+    // Slots are only touched by the render thread. Workers hand finished pipelines back through completed_pipelines,
+    // which are swapped into their slots at the start of the next frame.
+    std::vector<pipeline_slot> pipelines;
+    std::mutex completed_pipelines_mutex;
+    std::vector<completed_pipeline> completed_pipelines;
+    std::vector<retired_pipeline> retired_pipelines;
+
+    bindless_heap bindless{};
+    VkPipelineLayout pipeline_layout{}; // Shared by every pipeline, the bindless heap plus max_push_constants_size bytes
+
+    mesh_pool meshes{};
+    mesh triangle_mesh{};
+
+    pipeline_handle triangle_pipeline = invalid_pipeline_handle;
+    pipeline_handle gradient_pipeline = invalid_pipeline_handle; // Compute
+    compute_background background{}; // Not created when the backbuffer can't be blitted to
+
+    // init_renderer adds the triangle, replace the draws to render something else
+    std::vector<scene_draw> draws;
+
+    // Time init_renderer spent in each stage, in order
+    std::vector<startup_timing> startup_timings;
 };
 
+// Loads the shaders and creates the pipelines for every entry of details concurrently on the renderer's worker pool.
+// out_results lines up with details. Returns VK_SUCCESS only if every pipeline was created.
+VkResult create_pipelines(renderer &rend, std::vector<pipeline_create_details> const &details, std::vector<pipeline_create_result> &out_results);
+
+// Queues the pipeline to be built on the worker pool and returns immediately. Until it is ready get_pipeline returns
+// the fallback's pipeline instead, or VK_NULL_HANDLE when there is no usable fallback and the draw should be skipped.
+pipeline_handle request_pipeline(renderer &rend, pipeline_create_details const &details, pipeline_handle fallback = invalid_pipeline_handle);
+
+VkPipeline get_pipeline(renderer const &rend, pipeline_handle handle);
+
+// Hands an already created pipeline to the renderer, which destroys it at shutdown
+pipeline_handle add_ready_pipeline(renderer &rend, pipeline_create_details const &details, VkPipeline pipeline);
+
+// Like create_pipelines but the pipelines are added to the renderer, out_handles lines up with details
+VkResult create_ready_pipelines(renderer &rend, std::vector<pipeline_create_details> const &details, std::vector<pipeline_handle> &out_handles);
+
+// The frame_timeline value the frame currently being recorded signals
+uint64_t current_frame_value(renderer const &rend);
+uint64_t completed_frame_value(renderer const &rend);
+VkResult wait_for_frame_value(renderer const &rend, uint64_t value, uint64_t timeout);
+
+// Submits command buffers allocated from a pool on queue_families.compute. The work starts once frame_timeline reaches
+// after_frame_value, 0 starts it right away. Exclusive resources shared with the frame need ownership transfers when
+// the compute family differs from the graphics family, see transfer_image_ownership.
+VkResult submit_async_compute(renderer &rend, std::span<const VkCommandBuffer> command_buffers, uint64_t after_frame_value, uint64_t &out_value);
+
+// Makes the next frame's submission wait until queue's timeline reaches value before stage
+void wait_in_next_frame(renderer &rend, gpu_queue const &queue, uint64_t value, VkPipelineStageFlags2 stage);
+
 int init_renderer(init_settings &settings, renderer &rend);
 VkResult render(renderer &rend);
 
@@ -0,0 +1,452 @@
+#include "shader_compiler.hpp"
+#include "hash.hpp"
+#include "atomic_file.hpp"
+
+#include <fstream>
+#include <sstream>
+#include <cstdlib>
+#include <cstring>
+#include <atomic>
+#include <optional>
+#include <set>
+#include <span>
+
+#include <fmt/format.h>
+#include <magic_enum.hpp>
+#include <spirv-tools/optimizer.hpp>
+
+#if defined(EMBED_SHADERS)
+#include "embedded_shaders.hpp"
+#endif
+
+static constexpr uint32_t spirv_magic_number = 0x07230203;
+
+static const char *slang_target_profile = "sm_6_6";
+
+bool read_text_file(std::filesystem::path const &path, std::string &out_contents)
+{
+    std::ifstream file(path, std::ios::binary);
+    if (!file.is_open())
+    {
+        return false;
+    }
+    std::stringstream stream;
+    stream << file.rdbuf();
+    out_contents = stream.str();
+    return true;
+}
+
+bool read_spirv_file(std::filesystem::path const &path, std::vector<uint32_t> &out_spirv)
+{
+    std::ifstream file(path, std::ios::ate | std::ios::binary); // start at end
+    if (!file.is_open())
+    {
+        return false;
+    }
+    size_t file_size = (size_t)file.tellg();
+    if (file_size < sizeof(uint32_t) || file_size % sizeof(uint32_t) != 0)
+    {
+        return false;
+    }
+    out_spirv.resize(file_size / sizeof(uint32_t));
+    file.seekg(0); // go back to the beginning
+    file.read((char *)out_spirv.data(), file_size);
+    return file.good() && out_spirv.at(0) == spirv_magic_number;
+}
+
+std::optional<std::filesystem::path> resolve_shader_import(shader_compiler &compiler, std::filesystem::path const &including_directory,
+                                                           std::string const &name, bool is_module_name)
+{
+    std::vector<std::string> file_names;
+    if (is_module_name)
+    {
+        // Slang maps `import a.b_c;` to a/b-c.slang, but also accept the name verbatim
+        std::string file_name = name;
+        for (auto &c : file_name)
+        {
+            if (c == '.')
+                c = '/';
+        }
+        std::string dashed_file_name = file_name;
+        for (auto &c : dashed_file_name)
+        {
+            if (c == '_')
+                c = '-';
+        }
+        file_names.push_back(dashed_file_name + ".slang");
+        file_names.push_back(file_name + ".slang");
+    }
+    else
+    {
+        file_names.push_back(name);
+    }
+    for (auto const &directory : {including_directory, compiler.shader_directory})
+    {
+        for (auto const &file_name : file_names)
+        {
+            auto candidate = directory / file_name;
+            if (std::filesystem::exists(candidate))
+                return candidate.lexically_normal();
+        }
+    }
+    return std::nullopt;
+}
+
+// Hashes a shader and every file it imports or includes, in a stable depth first order
+bool hash_shader_sources(shader_compiler &compiler, std::filesystem::path const &path, std::set<std::filesystem::path> &visited, fnv1a_hasher &hasher)
+{
+    if (!visited.insert(path).second)
+    {
+        return true;
+    }
+    std::string contents;
+    if (!read_text_file(path, contents))
+    {
+        fmt::print("The shader source at path {} could not be read", path.string());
+        return false;
+    }
+    hasher.update(path.lexically_relative(compiler.shader_directory).string());
+    hasher.update(contents);
+
+    std::stringstream lines(contents);
+    std::string line;
+    while (std::getline(lines, line))
+    {
+        size_t start = line.find_first_not_of(" \t");
+        if (start == std::string::npos)
+            continue;
+        std::string_view view = std::string_view(line).substr(start);
+        std::string_view argument;
+        if (view.starts_with("import ") || view.starts_with("__include "))
+            argument = view.substr(view.find(' ') + 1);
+        else if (view.starts_with("#include"))
+            argument = view.substr(8);
+        else
+            continue;
+
+        size_t quote_begin = argument.find('"');
+        std::optional<std::filesystem::path> dependency;
+        if (quote_begin != std::string_view::npos)
+        {
+            size_t quote_end = argument.find('"', quote_begin + 1);
+            if (quote_end == std::string_view::npos)
+                continue;
+            dependency = resolve_shader_import(compiler, path.parent_path(), std::string(argument.substr(quote_begin + 1, quote_end - quote_begin - 1)), false);
+        }
+        else
+        {
+            size_t name_begin = argument.find_first_not_of(" \t");
+            size_t name_end = argument.find_first_of(" \t;", name_begin);
+            if (name_begin == std::string_view::npos)
+                continue;
+            dependency = resolve_shader_import(compiler, path.parent_path(), std::string(argument.substr(name_begin, name_end - name_begin)), true);
+        }
+        // Unresolved names are most likely modules built into slang, the compiler identity covers those
+        if (dependency && !hash_shader_sources(compiler, *dependency, visited, hasher))
+            return false;
+    }
+    return true;
+}
+
+VkResult init_shader_compiler(std::filesystem::path const &cache_directory, shader_compiler_options const &options, shader_compiler &compiler)
+{
+    compiler.options = options;
+#if defined(EMBED_SHADERS)
+    compiler.use_embedded_shaders = options.prefer_embedded_shaders;
+#else
+    compiler.use_embedded_shaders = false;
+#endif
+    compiler.shader_directory = std::filesystem::path(DATA_DIRECTORY "/shaders").lexically_normal();
+    compiler.compiler_identity = std::string("slang ") + spGetBuildTagString();
+    compiler.cache_directory = cache_directory / "spirv";
+
+    std::error_code ec;
+    std::filesystem::create_directories(compiler.cache_directory, ec);
+    if (ec)
+    {
+        fmt::print("Failed to create shader cache directory {} with error {}", compiler.cache_directory.string(), ec.message());
+        return VK_ERROR_INITIALIZATION_FAILED;
+    }
+    return VK_SUCCESS;
+}
+
+void print_slang_diagnostics(slang::IBlob *diagnostics)
+{
+    if (diagnostics != nullptr)
+    {
+        fmt::print("{}", std::string_view(static_cast<const char *>(diagnostics->getBufferPointer()), diagnostics->getBufferSize()));
+    }
+}
+
+VkResult create_slang_session(shader_compiler &compiler)
+{
+    if (!compiler.global_session)
+    {
+        if (SLANG_FAILED(slang::createGlobalSession(compiler.global_session.writeRef())))
+        {
+            fmt::print("Failed to create slang global session");
+            return VK_ERROR_INITIALIZATION_FAILED;
+        }
+    }
+
+    slang::TargetDesc target_desc{};
+    target_desc.format = SLANG_SPIRV;
+    target_desc.profile = compiler.global_session->findProfile(slang_target_profile);
+
+    std::string shader_directory = compiler.shader_directory.string();
+    const char *search_paths[] = {shader_directory.c_str()};
+
+    slang::SessionDesc session_desc{};
+    session_desc.targets = &target_desc;
+    session_desc.targetCount = 1;
+    session_desc.searchPaths = search_paths;
+    session_desc.searchPathCount = 1;
+
+    if (SLANG_FAILED(compiler.global_session->createSession(session_desc, compiler.session.writeRef())))
+    {
+        fmt::print("Failed to create slang session");
+        return VK_ERROR_INITIALIZATION_FAILED;
+    }
+    return VK_SUCCESS;
+}
+
+// Compiles every entry point defined in the module into one SPIR-V blob, entirely in memory
+VkResult compile_shader(shader_compiler &compiler, std::string const &shader_name, std::vector<uint32_t> &out_spirv)
+{
+    // The global session is expensive to create and holds no user modules, only the session needs replacing
+    if (compiler.session_stale.exchange(false))
+    {
+        compiler.session.setNull();
+    }
+    if (!compiler.session && create_slang_session(compiler) != VK_SUCCESS)
+    {
+        return VK_ERROR_INITIALIZATION_FAILED;
+    }
+
+    Slang::ComPtr<slang::IBlob> diagnostics;
+    slang::IModule *module = compiler.session->loadModule(shader_name.c_str(), diagnostics.writeRef());
+    print_slang_diagnostics(diagnostics);
+    if (module == nullptr)
+    {
+        fmt::print("Failed to load slang module {}", shader_name);
+        return VK_ERROR_INITIALIZATION_FAILED;
+    }
+
+    std::vector<Slang::ComPtr<slang::IEntryPoint>> entry_points(module->getDefinedEntryPointCount());
+    std::vector<slang::IComponentType *> components{module};
+    for (SlangInt32 i = 0; i < static_cast<SlangInt32>(entry_points.size()); i++)
+    {
+        if (SLANG_FAILED(module->getDefinedEntryPoint(i, entry_points.at(i).writeRef())))
+        {
+            fmt::print("Failed to get entry point {} of slang module {}", i, shader_name);
+            return VK_ERROR_INITIALIZATION_FAILED;
+        }
+        components.push_back(entry_points.at(i));
+    }
+
+    Slang::ComPtr<slang::IComponentType> program;
+    SlangResult result = compiler.session->createCompositeComponentType(components.data(), static_cast<SlangInt>(components.size()), program.writeRef(), diagnostics.writeRef());
+    print_slang_diagnostics(diagnostics);
+    if (SLANG_FAILED(result))
+    {
+        fmt::print("Failed to compose slang module {}", shader_name);
+        return VK_ERROR_INITIALIZATION_FAILED;
+    }
+
+    Slang::ComPtr<slang::IComponentType> linked_program;
+    result = program->link(linked_program.writeRef(), diagnostics.writeRef());
+    print_slang_diagnostics(diagnostics);
+    if (SLANG_FAILED(result))
+    {
+        fmt::print("Failed to link slang module {}", shader_name);
+        return VK_ERROR_INITIALIZATION_FAILED;
+    }
+
+    Slang::ComPtr<slang::IBlob> spirv_code;
+    result = linked_program->getTargetCode(0, spirv_code.writeRef(), diagnostics.writeRef());
+    print_slang_diagnostics(diagnostics);
+    if (SLANG_FAILED(result) || spirv_code->getBufferSize() % sizeof(uint32_t) != 0)
+    {
+        fmt::print("Failed to generate SPIR-V for slang module {}", shader_name);
+        return VK_ERROR_INITIALIZATION_FAILED;
+    }
+
+    out_spirv.resize(spirv_code->getBufferSize() / sizeof(uint32_t));
+    memcpy(out_spirv.data(), spirv_code->getBufferPointer(), spirv_code->getBufferSize());
+    return VK_SUCCESS;
+}
+
+// Concurrent processes sharing the cache only ever observe complete entries, the last writer wins with identical contents
+bool write_cache_entry(std::filesystem::path const &cache_entry, std::vector<uint32_t> const &spirv)
+{
+    return write_file_atomically(cache_entry, std::as_bytes(std::span(spirv)));
+}
+
+// Loads the slang output for the shader from the cache or by compiling it, out_cache_key identifies the result
+VkResult load_compiled_spirv(shader_compiler &compiler, std::string const &shader_name, std::vector<uint32_t> &out_spirv, uint64_t &out_cache_key)
+{
+    std::filesystem::path path_to_shader_source = compiler.shader_directory / (shader_name + ".slang");
+    if (!std::filesystem::exists(path_to_shader_source))
+    {
+        fmt::print("The file at path {} could not be found", path_to_shader_source.string());
+        return VK_ERROR_INITIALIZATION_FAILED;
+    }
+
+    fnv1a_hasher hasher{};
+    hasher.update(compiler.compiler_identity);
+    hasher.update(fmt::format("spirv {} -I {}", slang_target_profile, compiler.shader_directory.string()));
+    std::set<std::filesystem::path> visited;
+    if (!hash_shader_sources(compiler, path_to_shader_source, visited, hasher))
+    {
+        return VK_ERROR_INITIALIZATION_FAILED;
+    }
+
+    {
+        std::lock_guard lock(compiler.dependencies_mutex);
+        compiler.dependencies[shader_name] = visited;
+    }
+
+    out_cache_key = hasher.state;
+    std::filesystem::path cache_entry = compiler.cache_directory / fmt::format("{}-{:016x}.spv", shader_name, hasher.state);
+    if (read_spirv_file(cache_entry, out_spirv))
+    {
+        compiler.cache_hits++;
+        return VK_SUCCESS;
+    }
+    compiler.cache_misses++;
+
+    {
+        std::lock_guard lock(compiler.slang_mutex);
+        if (compile_shader(compiler, shader_name, out_spirv) != VK_SUCCESS)
+        {
+            return VK_ERROR_INITIALIZATION_FAILED;
+        }
+    }
+
+    if (!write_cache_entry(cache_entry, out_spirv))
+    {
+        // Not fatal, the shader compiled fine and the next launch will simply try again
+        fmt::print("Failed to store {} in the shader cache\n", cache_entry.string());
+    }
+    return VK_SUCCESS;
+}
+
+bool optimizer_enabled(shader_compiler_options const &options)
+{
+    return options.optimization != spirv_optimization::none || options.strip_debug_info;
+}
+
+bool optimize_spirv(shader_compiler_options const &options, std::string const &shader_name, std::vector<uint32_t> const &spirv, std::vector<uint32_t> &out_spirv)
+{
+    spvtools::Optimizer optimizer(SPV_ENV_VULKAN_1_3);
+    optimizer.SetMessageConsumer([&shader_name](spv_message_level_t level, const char *, const spv_position_t &position, const char *message) {
+        if (level <= SPV_MSG_WARNING)
+            fmt::print("spirv-opt {}: {} at word {}\n", shader_name, message, position.index);
+    });
+    if (options.strip_debug_info)
+    {
+        optimizer.RegisterPass(spvtools::CreateStripDebugInfoPass());
+        optimizer.RegisterPass(spvtools::CreateStripNonSemanticInfoPass());
+    }
+    switch (options.optimization)
+    {
+    case (spirv_optimization::performance):
+        optimizer.RegisterPerformancePasses();
+        break;
+    case (spirv_optimization::size):
+        optimizer.RegisterSizePasses();
+        break;
+    case (spirv_optimization::none):
+        // The recipes already end in dead code elimination, stripping alone needs it spelled out
+        optimizer.RegisterPass(spvtools::CreateEliminateDeadFunctionsPass());
+        optimizer.RegisterPass(spvtools::CreateAggressiveDCEPass());
+        optimizer.RegisterPass(spvtools::CreateDeadVariableEliminationPass());
+        break;
+    }
+    return optimizer.Run(spirv.data(), spirv.size(), &out_spirv);
+}
+
+VkResult load_shader_spirv(shader_compiler &compiler, std::string const &shader_name, std::vector<uint32_t> &out_spirv, std::vector<uint32_t> *out_unoptimized_spirv)
+{
+    std::vector<uint32_t> compiled_spirv;
+    uint64_t compiled_cache_key = 0;
+#if defined(EMBED_SHADERS)
+    if (compiler.use_embedded_shaders)
+    {
+        for (auto const &shader : get_embedded_shaders())
+        {
+            if (shader.name == shader_name)
+            {
+                // The words themselves stand in for the source hash, the optimizer still applies on top
+                compiled_spirv.assign(shader.spirv.begin(), shader.spirv.end());
+                fnv1a_hasher hasher{};
+                hasher.update(compiled_spirv.data(), compiled_spirv.size() * sizeof(uint32_t));
+                compiled_cache_key = hasher.state;
+                break;
+            }
+        }
+        // Shaders added since the last build still work, they just take the runtime path
+    }
+#endif
+    if (compiled_spirv.empty() && load_compiled_spirv(compiler, shader_name, compiled_spirv, compiled_cache_key) != VK_SUCCESS)
+    {
+        return VK_ERROR_INITIALIZATION_FAILED;
+    }
+    if (!optimizer_enabled(compiler.options))
+    {
+        out_spirv = std::move(compiled_spirv);
+        return VK_SUCCESS;
+    }
+
+    // The optimized entry builds on the compiled one, so changing the recipe doesn't require recompiling
+    fnv1a_hasher hasher{};
+    hasher.update(&compiled_cache_key, sizeof(compiled_cache_key));
+    hasher.update(std::string("spirv-opt ") + spvSoftwareVersionString());
+    hasher.update(fmt::format("{} strip={}", magic_enum::enum_name(compiler.options.optimization), compiler.options.strip_debug_info));
+    std::filesystem::path cache_entry = compiler.cache_directory / fmt::format("{}-{:016x}.opt.spv", shader_name, hasher.state);
+    if (!read_spirv_file(cache_entry, out_spirv))
+    {
+        if (!optimize_spirv(compiler.options, shader_name, compiled_spirv, out_spirv))
+        {
+            // The unoptimized shader is still perfectly usable
+            fmt::print("Failed to optimize shader {}, using it as compiled\n", shader_name);
+            out_spirv = compiled_spirv;
+        }
+        else if (!write_cache_entry(cache_entry, out_spirv))
+        {
+            fmt::print("Failed to store {} in the shader cache\n", cache_entry.string());
+        }
+    }
+
+    fmt::print("Shader {}: {} words compiled, {} words after {} optimization{} ({:+.1f}%)\n", shader_name, compiled_spirv.size(), out_spirv.size(),
+               magic_enum::enum_name(compiler.options.optimization), compiler.options.strip_debug_info ? " and stripping" : "",
+               100.0 * (static_cast<double>(out_spirv.size()) - compiled_spirv.size()) / compiled_spirv.size());
+    if (out_unoptimized_spirv != nullptr)
+    {
+        *out_unoptimized_spirv = std::move(compiled_spirv);
+    }
+    return VK_SUCCESS;
+}
+
+std::vector<std::string> find_dependent_shaders(shader_compiler &compiler, std::vector<std::filesystem::path> const &changed_files)
+{
+    std::vector<std::string> shader_names;
+    std::lock_guard lock(compiler.dependencies_mutex);
+    for (auto const &[shader_name, sources] : compiler.dependencies)
+    {
+        for (auto const &changed_file : changed_files)
+        {
+            if (sources.contains(changed_file))
+            {
+                shader_names.push_back(shader_name);
+                break;
+            }
+        }
+    }
+    return shader_names;
+}
+
+void invalidate_shader_modules(shader_compiler &compiler)
+{
+    compiler.session_stale = true;
+}
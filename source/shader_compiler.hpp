@@ -0,0 +1,77 @@
+#pragma once
+
+#include <vector>
+#include <string>
+#include <filesystem>
+#include <set>
+#include <unordered_map>
+#include <mutex>
+#include <atomic>
+
+#include <vulkan/vulkan_core.h>
+#include <slang.h>
+#include <slang-com-ptr.h>
+
+enum class spirv_optimization
+{
+    none,
+    performance,
+    size,
+};
+
+struct shader_compiler_options
+{
+    // Serve shaders from the SPIR-V linked in at build time, only possible when built with EMBED_SHADERS
+    bool prefer_embedded_shaders = true;
+
+    // Run spirv-opt on the compiler output before it reaches the driver. Any of these also eliminates dead code.
+    spirv_optimization optimization = spirv_optimization::none;
+    bool strip_debug_info = false;
+};
+
+struct shader_compiler
+{
+    std::filesystem::path shader_directory;
+    std::filesystem::path cache_directory;
+
+    // Identifies the slang version, part of every cache key
+    std::string compiler_identity;
+
+    shader_compiler_options options{};
+    bool use_embedded_shaders = false; // options.prefer_embedded_shaders, if the build embedded any
+
+    // Created on the first cache miss. The session is shared by every shader so that modules imported from
+    // shader_directory are only loaded and checked once. Slang sessions are not thread safe, so compilation is
+    // serialized with slang_mutex while cache lookups proceed in parallel.
+    std::mutex slang_mutex;
+    Slang::ComPtr<slang::IGlobalSession> global_session;
+    Slang::ComPtr<slang::ISession> session;
+    std::atomic<bool> session_stale = false; // Set when sources change, the next compile starts a fresh session
+
+    // Every source file each shader was built from, as of its last load, so edits can be mapped back to shaders
+    std::mutex dependencies_mutex;
+    std::unordered_map<std::string, std::set<std::filesystem::path>> dependencies;
+
+    std::atomic<uint32_t> cache_hits = 0;
+    std::atomic<uint32_t> cache_misses = 0;
+};
+
+VkResult init_shader_compiler(std::filesystem::path const &cache_directory, shader_compiler_options const &options, shader_compiler &compiler);
+
+// Returns the SPIR-V for data/shaders/<shader_name>.slang. Embedded shaders take the place of the compiler output,
+// otherwise it is compiled only when the on-disk cache has no entry for the current source, its transitive imports,
+// the compile flags, and the compiler version. Optimized SPIR-V is cached separately from either, keyed by a hash of
+// the embedded words or by the compiler output's cache key.
+// out_unoptimized_spirv receives the compiler output when the optimizer ran, for comparisons. Safe to call from multiple
+// threads.
+VkResult load_shader_spirv(shader_compiler &compiler, std::string const &shader_name, std::vector<uint32_t> &out_spirv,
+                           std::vector<uint32_t> *out_unoptimized_spirv = nullptr);
+
+// Returns the names of the shaders that were built from any of the given source files
+std::vector<std::string> find_dependent_shaders(shader_compiler &compiler, std::vector<std::filesystem::path> const &changed_files);
+
+// Drops the modules slang has already loaded so the next compile reads the changed sources from disk. Doesn't block
+// on a compile that is already running. This rebuilds the whole session because slang can't unload or replace a single
+// module once a session has loaded it. That is cheap: only the shaders find_dependent_shaders returns get recompiled,
+// they re-parse their imports in the new session, and every other shader is still served from the SPIR-V disk cache.
+void invalidate_shader_modules(shader_compiler &compiler);
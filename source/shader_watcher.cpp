@@ -0,0 +1,97 @@
+#include "shader_watcher.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+
+#include <unistd.h>
+#include <sys/inotify.h>
+
+#include <fmt/format.h>
+
+bool add_directory_watch(shader_watcher &watcher, std::filesystem::path const &directory)
+{
+    // Editors tend to save by writing a temporary file and renaming it over the original, so moves count as writes.
+    // IN_CREATE is only needed to pick up new subdirectories.
+    int wd = inotify_add_watch(watcher.inotify_fd, directory.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO | IN_CREATE);
+    if (wd < 0)
+    {
+        fmt::print("Failed to watch shader directory {}: {}\n", directory.string(), strerror(errno));
+        return false;
+    }
+    watcher.watched_directories[wd] = directory;
+    return true;
+}
+
+VkResult init_shader_watcher(std::filesystem::path const &shader_directory, shader_watcher &watcher)
+{
+    watcher.inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (watcher.inotify_fd < 0)
+    {
+        fmt::print("Failed to create inotify instance: {}\n", strerror(errno));
+        return VK_ERROR_INITIALIZATION_FAILED;
+    }
+    if (!add_directory_watch(watcher, shader_directory))
+    {
+        destroy_shader_watcher(watcher);
+        return VK_ERROR_INITIALIZATION_FAILED;
+    }
+    std::error_code ec;
+    for (auto const &entry : std::filesystem::recursive_directory_iterator(shader_directory, ec))
+    {
+        if (entry.is_directory())
+        {
+            add_directory_watch(watcher, entry.path().lexically_normal());
+        }
+    }
+    return VK_SUCCESS;
+}
+
+void poll_shader_changes(shader_watcher &watcher, std::vector<std::filesystem::path> &out_changed_files)
+{
+    if (watcher.inotify_fd < 0)
+    {
+        return;
+    }
+    alignas(inotify_event) char buffer[4096];
+    while (true)
+    {
+        ssize_t length = read(watcher.inotify_fd, buffer, sizeof(buffer));
+        if (length <= 0)
+        {
+            return; // EAGAIN once the queue is drained
+        }
+        for (ssize_t offset = 0; offset < length;)
+        {
+            auto const *event = reinterpret_cast<inotify_event const *>(buffer + offset);
+            offset += sizeof(inotify_event) + event->len;
+
+            auto directory = watcher.watched_directories.find(event->wd);
+            if (directory == watcher.watched_directories.end() || event->len == 0)
+                continue;
+            std::filesystem::path path = (directory->second / event->name).lexically_normal();
+
+            if (event->mask & IN_ISDIR)
+            {
+                if (event->mask & (IN_CREATE | IN_MOVED_TO))
+                    add_directory_watch(watcher, path);
+                continue;
+            }
+            // Creating an empty file isn't interesting, the IN_CLOSE_WRITE that follows is
+            if (event->mask & IN_CREATE)
+                continue;
+            if (std::find(out_changed_files.begin(), out_changed_files.end(), path) == out_changed_files.end())
+                out_changed_files.push_back(path);
+        }
+    }
+}
+
+void destroy_shader_watcher(shader_watcher &watcher)
+{
+    if (watcher.inotify_fd >= 0)
+    {
+        close(watcher.inotify_fd);
+    }
+    watcher.inotify_fd = -1;
+    watcher.watched_directories.clear();
+}
@@ -0,0 +1,21 @@
+#pragma once
+
+#include <vector>
+#include <unordered_map>
+#include <filesystem>
+
+#include <vulkan/vulkan_core.h>
+
+// Watches the shader directory and its subdirectories through inotify without ever blocking
+struct shader_watcher
+{
+    int inotify_fd = -1;
+    std::unordered_map<int, std::filesystem::path> watched_directories; // Watch descriptor to directory
+};
+
+VkResult init_shader_watcher(std::filesystem::path const &shader_directory, shader_watcher &watcher);
+
+// Appends every file written or moved into place since the last call, each path at most once
+void poll_shader_changes(shader_watcher &watcher, std::vector<std::filesystem::path> &out_changed_files);
+
+void destroy_shader_watcher(shader_watcher &watcher);
@@ -0,0 +1,284 @@
+#include "transient_pool.hpp"
+
+#include <algorithm>
+
+#include <fmt/format.h>
+#include <magic_enum.hpp>
+
+// The only usages TRANSIENT_ATTACHMENT may be combined with
+static constexpr VkImageUsageFlags attachment_usage =
+    VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT | VK_IMAGE_USAGE_INPUT_ATTACHMENT_BIT;
+
+void init_transient_pool(gpu_allocator const &allocator, transient_pool &pool)
+{
+    pool.device = allocator.device;
+    for (uint32_t i = 0; i < allocator.memory_properties.memoryTypeCount; i++)
+    {
+        if (allocator.memory_properties.memoryTypes[i].propertyFlags & VK_MEMORY_PROPERTY_LAZILY_ALLOCATED_BIT)
+        {
+            pool.lazily_allocated_memory = true;
+        }
+    }
+}
+
+void destroy_transient_images(gpu_allocator &allocator, std::vector<transient_image> &images, std::vector<gpu_allocation> &memory)
+{
+    for (auto &image : images)
+    {
+        vkDestroyImageView(allocator.device, image.view, nullptr);
+        vkDestroyImage(allocator.device, image.image, nullptr);
+    }
+    for (auto &allocation : memory)
+    {
+        free_gpu_memory(allocator, allocation);
+    }
+    images.clear();
+    memory.clear();
+}
+
+VkDeviceSize align_offset(VkDeviceSize offset, VkDeviceSize alignment)
+{
+    return (offset + alignment - 1) / alignment * alignment;
+}
+
+VkResult build_transient_images(gpu_allocator &allocator, transient_pool &pool, std::span<const transient_image_request> requests,
+                                uint64_t retire_value)
+{
+    if (!pool.images.empty() || !pool.memory.empty())
+    {
+        pool.retired.push_back(transient_pool::retired_images{std::move(pool.images), std::move(pool.memory), retire_value});
+    }
+    pool.images.assign(requests.size(), transient_image{});
+    pool.memory.clear();
+    pool.build_count++;
+    pool.aliased_bytes = 0;
+    pool.unaliased_bytes = 0;
+    pool.lazily_allocated_count = 0;
+
+    std::vector<VkMemoryRequirements> requirements(requests.size());
+    std::vector<bool> transient_attachment(requests.size());
+    std::vector<uint32_t> placement_order;
+    for (uint32_t i = 0; i < requests.size(); i++)
+    {
+        auto const &request = requests[i];
+        transient_attachment[i] = pool.lazily_allocated_memory && (request.usage & ~attachment_usage) == 0;
+        VkImageCreateInfo image_create_info{
+            .sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO,
+            .imageType = VK_IMAGE_TYPE_2D,
+            .format = request.desc.format,
+            .extent = VkExtent3D{request.desc.extent.width, request.desc.extent.height, 1},
+            .mipLevels = 1,
+            .arrayLayers = 1,
+            .samples = request.desc.samples,
+            .tiling = VK_IMAGE_TILING_OPTIMAL,
+            .usage = request.usage | (transient_attachment[i] ? VK_IMAGE_USAGE_TRANSIENT_ATTACHMENT_BIT : 0),
+            .sharingMode = VK_SHARING_MODE_EXCLUSIVE,
+            .initialLayout = VK_IMAGE_LAYOUT_UNDEFINED,
+        };
+        gpu_memory_request memory_request{
+            .required_flags = VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+            .preferred_flags = transient_attachment[i] ? VkMemoryPropertyFlags{VK_MEMORY_PROPERTY_LAZILY_ALLOCATED_BIT} : VkMemoryPropertyFlags{0},
+            .dedicated = true,
+        };
+        auto &image = pool.images[i];
+        VkResult err = vkCreateImage(pool.device, &image_create_info, nullptr, &image.image);
+        if (err != VK_SUCCESS)
+        {
+            fmt::print("Failed to create transient image with error code {}\n", magic_enum::enum_name(err));
+            return err;
+        }
+
+        VkImageMemoryRequirementsInfo2 requirements_info{
+            .sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_REQUIREMENTS_INFO_2,
+            .image = image.image,
+        };
+        VkMemoryDedicatedRequirements dedicated_requirements{
+            .sType = VK_STRUCTURE_TYPE_MEMORY_DEDICATED_REQUIREMENTS,
+        };
+        VkMemoryRequirements2 memory_requirements{
+            .sType = VK_STRUCTURE_TYPE_MEMORY_REQUIREMENTS_2,
+            .pNext = &dedicated_requirements,
+        };
+        vkGetImageMemoryRequirements2(pool.device, &requirements_info, &memory_requirements);
+        requirements[i] = memory_requirements.memoryRequirements;
+        pool.unaliased_bytes += requirements[i].size;
+        if (!dedicated_requirements.requiresDedicatedAllocation)
+        {
+            placement_order.push_back(i);
+            continue;
+        }
+
+        // Can't alias anything, the allocator binds it to memory of its own
+        vkDestroyImage(pool.device, image.image, nullptr);
+        image.image = VK_NULL_HANDLE;
+        image.memory_index = static_cast<uint32_t>(pool.memory.size());
+        image.size = requirements[i].size;
+        gpu_allocation &allocation = pool.memory.emplace_back();
+        err = create_image(allocator, image_create_info, memory_request, image.image, allocation);
+        if (err != VK_SUCCESS)
+        {
+            return err;
+        }
+    }
+
+    // Largest first, each at the lowest offset that doesn't overlap an image already placed in its group that is
+    // alive at the same time
+    std::sort(placement_order.begin(), placement_order.end(), [&requirements](uint32_t a, uint32_t b) { return requirements[a].size > requirements[b].size; });
+    struct memory_group
+    {
+        uint32_t memory_type_bits;
+        bool transient_attachment;
+        VkDeviceSize size = 0;
+        VkDeviceSize alignment = 1;
+        std::vector<uint32_t> images;
+    };
+    std::vector<memory_group> groups;
+    struct memory_range
+    {
+        VkDeviceSize begin;
+        VkDeviceSize end;
+    };
+    std::vector<memory_range> occupied;
+    for (uint32_t i : placement_order)
+    {
+        auto group = std::find_if(groups.begin(), groups.end(), [&](memory_group const &g) {
+            return g.memory_type_bits == requirements[i].memoryTypeBits && g.transient_attachment == transient_attachment[i];
+        });
+        if (group == groups.end())
+        {
+            group = groups.insert(groups.end(), memory_group{requirements[i].memoryTypeBits, transient_attachment[i]});
+        }
+
+        occupied.clear();
+        for (uint32_t other : group->images)
+        {
+            if (requests[other].first_pass <= requests[i].last_pass && requests[i].first_pass <= requests[other].last_pass)
+            {
+                occupied.push_back({pool.images[other].offset, pool.images[other].offset + pool.images[other].size});
+            }
+        }
+        std::sort(occupied.begin(), occupied.end(), [](memory_range const &a, memory_range const &b) { return a.begin < b.begin; });
+        VkDeviceSize offset = 0;
+        for (auto const &range : occupied)
+        {
+            if (align_offset(offset, requirements[i].alignment) + requirements[i].size <= range.begin)
+            {
+                break;
+            }
+            offset = std::max(offset, range.end);
+        }
+        auto &image = pool.images[i];
+        image.offset = align_offset(offset, requirements[i].alignment);
+        image.size = requirements[i].size;
+        group->size = std::max(group->size, image.offset + image.size);
+        group->alignment = std::max(group->alignment, requirements[i].alignment);
+        group->images.push_back(i);
+    }
+
+    for (auto const &group : groups)
+    {
+        uint32_t memory_index = static_cast<uint32_t>(pool.memory.size());
+        gpu_allocation &allocation = pool.memory.emplace_back();
+        VkMemoryRequirements group_requirements{
+            .size = group.size,
+            .alignment = group.alignment,
+            .memoryTypeBits = group.memory_type_bits,
+        };
+        gpu_memory_request memory_request{
+            .required_flags = VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+            .preferred_flags = group.transient_attachment ? VkMemoryPropertyFlags{VK_MEMORY_PROPERTY_LAZILY_ALLOCATED_BIT} : VkMemoryPropertyFlags{0},
+            .dedicated = true,
+        };
+        VkResult err = allocate_gpu_memory(allocator, group_requirements, gpu_resource_kind::optimal, memory_request, allocation);
+        if (err != VK_SUCCESS)
+        {
+            fmt::print("Failed to allocate {} bytes of transient memory with error code {}\n", group.size, magic_enum::enum_name(err));
+            return err;
+        }
+        for (uint32_t i : group.images)
+        {
+            auto &image = pool.images[i];
+            image.memory_index = memory_index;
+            err = vkBindImageMemory(pool.device, image.image, allocation.memory, allocation.offset + image.offset);
+            if (err != VK_SUCCESS)
+            {
+                fmt::print("Failed to bind transient image memory with error code {}\n", magic_enum::enum_name(err));
+                return err;
+            }
+        }
+    }
+
+    for (uint32_t i = 0; i < requests.size(); i++)
+    {
+        auto &image = pool.images[i];
+        VkImageViewCreateInfo image_view_create_info{
+            .sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO,
+            .image = image.image,
+            .viewType = VK_IMAGE_VIEW_TYPE_2D,
+            .format = requests[i].desc.format,
+            .subresourceRange = VkImageSubresourceRange{requests[i].desc.aspect, 0, 1, 0, 1},
+        };
+        VkResult err = vkCreateImageView(pool.device, &image_view_create_info, nullptr, &image.view);
+        if (err != VK_SUCCESS)
+        {
+            fmt::print("Failed to create transient image view with error code {}\n", magic_enum::enum_name(err));
+            return err;
+        }
+        auto const &allocation = pool.memory[image.memory_index];
+        if (allocator.memory_properties.memoryTypes[allocation.memory_type_index].propertyFlags & VK_MEMORY_PROPERTY_LAZILY_ALLOCATED_BIT)
+        {
+            pool.lazily_allocated_count++;
+        }
+    }
+    for (auto const &allocation : pool.memory)
+    {
+        pool.aliased_bytes += allocation.size;
+    }
+    pool.peak_bytes = std::max(pool.peak_bytes, pool.aliased_bytes);
+    return VK_SUCCESS;
+}
+
+void release_retired_transients(gpu_allocator &allocator, transient_pool &pool, uint64_t completed_value)
+{
+    std::erase_if(pool.retired, [&allocator, completed_value](transient_pool::retired_images &retired) {
+        if (retired.timeline_value > completed_value)
+            return false;
+        destroy_transient_images(allocator, retired.images, retired.memory);
+        return true;
+    });
+}
+
+void print_transient_pool_stats(gpu_allocator const &allocator, transient_pool const &pool)
+{
+    if (pool.build_count == 0)
+    {
+        return;
+    }
+    fmt::print("Transient images: {} in {:.2f} MiB per frame, {:.2f} MiB without aliasing, peak {:.2f} MiB over {} builds\n", pool.images.size(),
+               pool.aliased_bytes / 1048576.0, pool.unaliased_bytes / 1048576.0, pool.peak_bytes / 1048576.0, pool.build_count);
+    if (pool.lazily_allocated_count > 0)
+    {
+        // What the implementation actually backed, zero when everything stayed in tile memory
+        VkDeviceSize committed = 0;
+        for (auto const &allocation : pool.memory)
+        {
+            if (allocator.memory_properties.memoryTypes[allocation.memory_type_index].propertyFlags & VK_MEMORY_PROPERTY_LAZILY_ALLOCATED_BIT)
+            {
+                VkDeviceSize allocation_committed = 0;
+                vkGetDeviceMemoryCommitment(pool.device, allocation.memory, &allocation_committed);
+                committed += allocation_committed;
+            }
+        }
+        fmt::print("  {} in lazily allocated memory, {:.2f} MiB committed\n", pool.lazily_allocated_count, committed / 1048576.0);
+    }
+}
+
+void destroy_transient_pool(gpu_allocator &allocator, transient_pool &pool)
+{
+    for (auto &retired : pool.retired)
+    {
+        destroy_transient_images(allocator, retired.images, retired.memory);
+    }
+    pool.retired.clear();
+    destroy_transient_images(allocator, pool.images, pool.memory);
+}
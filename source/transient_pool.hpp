@@ -0,0 +1,78 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+#include <span>
+
+#include <vulkan/vulkan_core.h>
+
+#include "gpu_allocator.hpp"
+
+// An image that only lives within one frame, its contents are undefined at the start of every frame
+struct transient_image_desc
+{
+    VkFormat format = VK_FORMAT_UNDEFINED;
+    VkExtent2D extent{};
+    VkImageAspectFlags aspect = VK_IMAGE_ASPECT_COLOR_BIT;
+    VkSampleCountFlagBits samples = VK_SAMPLE_COUNT_1_BIT;
+};
+
+struct transient_image_request
+{
+    transient_image_desc desc;
+    VkImageUsageFlags usage = 0;
+    uint32_t first_pass = 0; // Lifetime in execution order, inclusive
+    uint32_t last_pass = 0;
+};
+
+struct transient_image
+{
+    VkImage image{};
+    VkImageView view{};
+    uint32_t memory_index = 0; // Into transient_pool::memory
+    VkDeviceSize offset = 0;
+    VkDeviceSize size = 0;
+};
+
+// Creates a frame's transient images and packs the ones whose lifetimes don't overlap into the same memory. Images are
+// grouped by the memory types they allow, and each group gets one allocation sized to the peak of its overlapping
+// lifetimes. Images only ever used as attachments get TRANSIENT_ATTACHMENT usage and lazily allocated memory when the
+// device has it, which tilers can keep in tile memory without backing it at all. The images are reused every frame
+// until the next build.
+struct transient_pool
+{
+    VkDevice device{};
+    bool lazily_allocated_memory = false; // Some memory type is LAZILY_ALLOCATED
+
+    std::vector<transient_image> images; // Lines up with the requests of the last build
+    std::vector<gpu_allocation> memory;
+
+    // Replaced by a later build, destroyed once the frames that could still be using them have completed
+    struct retired_images
+    {
+        std::vector<transient_image> images;
+        std::vector<gpu_allocation> memory;
+        uint64_t timeline_value = 0;
+    };
+    std::vector<retired_images> retired;
+
+    uint32_t build_count = 0;
+    VkDeviceSize aliased_bytes = 0;   // Allocated by the last build, the transient memory of every frame
+    VkDeviceSize unaliased_bytes = 0; // What the last build's images would take without aliasing
+    VkDeviceSize peak_bytes = 0;      // Largest aliased_bytes of any build
+    uint32_t lazily_allocated_count = 0;
+};
+
+void init_transient_pool(gpu_allocator const &allocator, transient_pool &pool);
+
+// Replaces the pool's images with ones for requests. The previous images are retired until the frame timeline
+// reaches retire_value.
+VkResult build_transient_images(gpu_allocator &allocator, transient_pool &pool, std::span<const transient_image_request> requests,
+                                uint64_t retire_value);
+
+void release_retired_transients(gpu_allocator &allocator, transient_pool &pool, uint64_t completed_value);
+
+void print_transient_pool_stats(gpu_allocator const &allocator, transient_pool const &pool);
+
+// Nothing may be using any of the images, retired or not
+void destroy_transient_pool(gpu_allocator &allocator, transient_pool &pool);
@@ -0,0 +1,510 @@
+#include "upload_ring.hpp"
+
+#include <cstring>
+#include <algorithm>
+
+#include <fmt/format.h>
+#include <magic_enum.hpp>
+
+// Covers the 4 byte alignment of buffer copies and the texel size of every uncompressed format and compressed block
+static constexpr VkDeviceSize staging_alignment = 16;
+
+// Without resizable BAR only a 256 MiB window of VRAM is host visible, which is better left to the driver
+static constexpr VkDeviceSize min_direct_write_heap_size = VkDeviceSize{256} << 20;
+
+VkResult init_upload_ring(gpu_allocator &allocator, gpu_queue &queue, VkExtent3D image_granularity, uint32_t consumer_queue_family_index,
+                          VkDeviceSize capacity, upload_ring &ring)
+{
+    ring.device = allocator.device;
+    ring.queue = &queue;
+    ring.image_granularity = image_granularity;
+    ring.consumer_queue_family_index = consumer_queue_family_index;
+
+    // Write combined memory is fine for staging since the CPU only ever writes to it
+    VkResult err = create_ring_buffer(allocator, capacity, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, {}, ring.ring);
+    if (err != VK_SUCCESS)
+    {
+        fmt::print("Failed to create upload ring with error code {}\n", magic_enum::enum_name(err));
+        return VK_ERROR_INITIALIZATION_FAILED;
+    }
+
+    VkCommandPoolCreateInfo command_pool_create_info{
+        .sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO,
+        .flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT | VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT,
+        .queueFamilyIndex = queue.family_index,
+    };
+    err = vkCreateCommandPool(ring.device, &command_pool_create_info, nullptr, &ring.command_pool);
+    if (err != VK_SUCCESS)
+    {
+        fmt::print("Failed to create upload command pool with error code {}\n", magic_enum::enum_name(err));
+        return VK_ERROR_INITIALIZATION_FAILED;
+    }
+
+    auto const &memory_properties = allocator.memory_properties;
+    for (uint32_t i = 0; i < memory_properties.memoryTypeCount; i++)
+    {
+        VkMemoryPropertyFlags flags = memory_properties.memoryTypes[i].propertyFlags;
+        VkMemoryHeap const &heap = memory_properties.memoryHeaps[memory_properties.memoryTypes[i].heapIndex];
+        if ((flags & VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT) && (flags & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT) &&
+            (heap.flags & VK_MEMORY_HEAP_DEVICE_LOCAL_BIT) && heap.size > min_direct_write_heap_size)
+        {
+            ring.direct_writes = true;
+            break;
+        }
+    }
+    return VK_SUCCESS;
+}
+
+gpu_memory_request upload_destination_request(upload_ring const &ring)
+{
+    return gpu_memory_request{
+        .required_flags = VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+        .preferred_flags = ring.direct_writes ? VkMemoryPropertyFlags{VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT} : VkMemoryPropertyFlags{0},
+    };
+}
+
+VkResult begin_batch(upload_ring &ring)
+{
+    if (ring.recording != VK_NULL_HANDLE)
+    {
+        return VK_SUCCESS;
+    }
+    VkCommandBuffer command_buffer{};
+    if (!ring.free_command_buffers.empty())
+    {
+        command_buffer = ring.free_command_buffers.back();
+        ring.free_command_buffers.pop_back();
+    }
+    else
+    {
+        VkCommandBufferAllocateInfo command_buffer_allocate_info{
+            .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO,
+            .commandPool = ring.command_pool,
+            .level = VK_COMMAND_BUFFER_LEVEL_PRIMARY,
+            .commandBufferCount = 1,
+        };
+        VkResult err = vkAllocateCommandBuffers(ring.device, &command_buffer_allocate_info, &command_buffer);
+        if (err != VK_SUCCESS)
+        {
+            fmt::print("Failed to allocate upload command buffer with error code {}\n", magic_enum::enum_name(err));
+            return err;
+        }
+    }
+    // Beginning implicitly resets command buffers from a pool with RESET_COMMAND_BUFFER
+    VkCommandBufferBeginInfo command_buffer_begin_info{
+        .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
+        .flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT,
+    };
+    VkResult err = vkBeginCommandBuffer(command_buffer, &command_buffer_begin_info);
+    if (err != VK_SUCCESS)
+    {
+        fmt::print("Failed to begin upload command buffer with error code {}\n", magic_enum::enum_name(err));
+        ring.free_command_buffers.push_back(command_buffer);
+        return err;
+    }
+    ring.recording = command_buffer;
+    return VK_SUCCESS;
+}
+
+// Where uploaded data is written, and where the consumer first uses it
+queue_usage upload_source_usage(upload_ring const &ring)
+{
+    return queue_usage{
+        .family_index = ring.queue->family_index,
+        .stage_mask = VK_PIPELINE_STAGE_2_COPY_BIT,
+        .access_mask = VK_ACCESS_2_TRANSFER_WRITE_BIT,
+    };
+}
+
+queue_usage upload_consumer_usage(upload_ring const &ring)
+{
+    return queue_usage{
+        .family_index = ring.consumer_queue_family_index,
+        .stage_mask = VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT,
+        .access_mask = VK_ACCESS_2_MEMORY_READ_BIT | VK_ACCESS_2_MEMORY_WRITE_BIT,
+    };
+}
+
+// A batch is done once the upload queue has finished it and the consumer has finished any copies it was left
+void reclaim_batches(upload_ring &ring)
+{
+    uint64_t completed_value = completed_queue_value(*ring.queue);
+    uint64_t released_value = 0;
+    while (!ring.in_flight.empty() && ring.in_flight.front().value <= completed_value &&
+           ring.in_flight.front().consumer_value <= ring.consumer_completed_value)
+    {
+        released_value = ring.in_flight.front().value;
+        ring.free_command_buffers.push_back(ring.in_flight.front().command_buffer);
+        ring.in_flight.pop_front();
+    }
+    ring_release_frames(ring.ring, released_value);
+}
+
+// Must be called before begin_batch, running out of space submits the batch being recorded
+VkResult stage(upload_ring &ring, void const *data, VkDeviceSize size, gpu_ring_allocation &out_allocation)
+{
+    bool staged = ring_allocate(ring.ring, size, staging_alignment, out_allocation);
+    if (!staged)
+    {
+        reclaim_batches(ring);
+        staged = ring_allocate(ring.ring, size, staging_alignment, out_allocation);
+    }
+    if (!staged)
+    {
+        // Everything in the ring is still in flight or only recorded. Submit what was recorded and wait for batches
+        // oldest first until enough space comes back.
+        ring.stats.stall_count++;
+        uint64_t value = 0;
+        VkResult err = submit_uploads(ring, value);
+        if (err != VK_SUCCESS)
+        {
+            return err;
+        }
+        while (!staged && !ring.in_flight.empty())
+        {
+            err = wait_for_uploads(ring, ring.in_flight.front().value);
+            if (err != VK_SUCCESS)
+            {
+                return err;
+            }
+            size_t in_flight_count = ring.in_flight.size();
+            reclaim_batches(ring);
+            if (ring.in_flight.size() == in_flight_count)
+            {
+                break; // The oldest batch is waiting on the consumer, which can't make progress from here
+            }
+            staged = ring_allocate(ring.ring, size, staging_alignment, out_allocation);
+        }
+    }
+    if (!staged)
+    {
+        fmt::print("Upload of {} bytes doesn't fit in the {} byte upload ring\n", size, ring.ring.capacity);
+        return VK_ERROR_OUT_OF_DEVICE_MEMORY;
+    }
+    memcpy(out_allocation.mapped, data, size);
+    ring.stats.staged_bytes += size;
+    return VK_SUCCESS;
+}
+
+VkResult upload_buffer(gpu_allocator &allocator, upload_ring &ring, VkBuffer buffer, gpu_allocation const &allocation, VkDeviceSize offset,
+                       void const *data, VkDeviceSize size)
+{
+    // Flushing an empty range isn't allowed, and an empty mesh has no indices
+    if (size == 0)
+    {
+        return VK_SUCCESS;
+    }
+    if (allocation.mapped != nullptr)
+    {
+        memcpy(static_cast<char *>(allocation.mapped) + offset, data, size);
+        ring.stats.direct_bytes += size;
+        return flush_allocation(allocator, allocation, offset, size);
+    }
+
+    // Large uploads are split so they never need the whole ring at once
+    VkDeviceSize max_chunk_size = std::max<VkDeviceSize>(ring.ring.capacity / 4, staging_alignment);
+    for (VkDeviceSize done = 0; done < size;)
+    {
+        VkDeviceSize chunk_size = std::min(size - done, max_chunk_size);
+        gpu_ring_allocation staging{};
+        VkResult err = stage(ring, static_cast<char const *>(data) + done, chunk_size, staging);
+        if (err == VK_SUCCESS)
+        {
+            err = begin_batch(ring);
+        }
+        if (err != VK_SUCCESS)
+        {
+            return err;
+        }
+        VkBufferCopy copy{
+            .srcOffset = staging.offset,
+            .dstOffset = offset + done,
+            .size = chunk_size,
+        };
+        vkCmdCopyBuffer(ring.recording, staging.buffer, buffer, 1, &copy);
+        ring.stats.copy_count++;
+
+        // Within one family the memory barrier at the end of the batch covers buffers. Chunks get their own transfer
+        // since running out of ring space can split them across batches.
+        queue_usage src = upload_source_usage(ring);
+        queue_usage dst = upload_consumer_usage(ring);
+        if (needs_ownership_transfer(src, dst))
+        {
+            auto transfer = transfer_buffer_ownership(buffer, offset + done, chunk_size, src, dst);
+            ring.final_buffer_barriers.push_back(transfer.release);
+            ring.batch_buffer_acquires.push_back(transfer.acquire);
+        }
+        done += chunk_size;
+    }
+    return VK_SUCCESS;
+}
+
+// A granularity of 0 only allows whole mip levels, which is what upload_image copies. Copies that end at the edge of the
+// level are allowed at any size too, but the ring doesn't know the image's size, so otherwise the extent has to be a
+// multiple of the granularity.
+bool fits_image_granularity(VkExtent3D granularity, VkExtent3D extent)
+{
+    auto fits = [](uint32_t size, uint32_t granule) { return granule == 0 || size % granule == 0; };
+    return fits(extent.width, granularity.width) && fits(extent.height, granularity.height) && fits(extent.depth, granularity.depth);
+}
+
+VkResult upload_image(upload_ring &ring, VkImage image, VkImageSubresourceLayers const &subresource, VkExtent3D extent, void const *data,
+                      VkDeviceSize size, VkImageLayout final_layout)
+{
+    gpu_ring_allocation staging{};
+    VkResult err = stage(ring, data, size, staging);
+    if (err == VK_SUCCESS)
+    {
+        err = begin_batch(ring);
+    }
+    if (err != VK_SUCCESS)
+    {
+        return err;
+    }
+
+    VkImageSubresourceRange subresource_range{
+        .aspectMask = subresource.aspectMask,
+        .baseMipLevel = subresource.mipLevel,
+        .levelCount = 1,
+        .baseArrayLayer = subresource.baseArrayLayer,
+        .layerCount = subresource.layerCount,
+    };
+    VkBufferImageCopy copy{
+        .bufferOffset = staging.offset,
+        .imageSubresource = subresource,
+        .imageExtent = extent,
+    };
+    if (!fits_image_granularity(ring.image_granularity, extent))
+    {
+        // The old contents are discarded, so the consumer can take the image without an ownership transfer. The
+        // staging memory stays with the batch until the consumer reports its copy as done.
+        ring.batch_consumer_copies.push_back({image, subresource_range, copy, final_layout});
+        ring.stats.consumer_copy_count++;
+        return VK_SUCCESS;
+    }
+
+    // The old contents are replaced entirely, so they can be discarded
+    VkImageMemoryBarrier2 to_transfer_dst_barrier{
+        .sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER_2,
+        .srcStageMask = VK_PIPELINE_STAGE_2_NONE,
+        .srcAccessMask = VK_ACCESS_2_NONE,
+        .dstStageMask = VK_PIPELINE_STAGE_2_COPY_BIT,
+        .dstAccessMask = VK_ACCESS_2_TRANSFER_WRITE_BIT,
+        .oldLayout = VK_IMAGE_LAYOUT_UNDEFINED,
+        .newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+        .srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+        .dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+        .image = image,
+        .subresourceRange = subresource_range,
+    };
+    VkDependencyInfo dependency_info{
+        .sType = VK_STRUCTURE_TYPE_DEPENDENCY_INFO,
+        .imageMemoryBarrierCount = 1,
+        .pImageMemoryBarriers = &to_transfer_dst_barrier,
+    };
+    vkCmdPipelineBarrier2(ring.recording, &dependency_info);
+
+    vkCmdCopyBufferToImage(ring.recording, staging.buffer, image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &copy);
+    ring.stats.copy_count++;
+
+    // Issued together with the rest of the batch's barriers when it is submitted
+    queue_usage src = upload_source_usage(ring);
+    queue_usage dst = upload_consumer_usage(ring);
+    auto transfer = transfer_image_ownership(image, subresource_range, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, final_layout, src, dst);
+    ring.final_image_barriers.push_back(transfer.release);
+    if (needs_ownership_transfer(src, dst))
+    {
+        ring.batch_image_acquires.push_back(transfer.acquire);
+    }
+    return VK_SUCCESS;
+}
+
+VkResult submit_uploads(upload_ring &ring, uint64_t &out_value)
+{
+    if (ring.recording == VK_NULL_HANDLE)
+    {
+        out_value = ring.submitted_value;
+        return VK_SUCCESS;
+    }
+
+    // Within one family the second scope of the memory barrier reaches into later submissions on the same queue, and
+    // across queues into submissions waiting on the timeline. Across families the releases take its place.
+    VkMemoryBarrier2 memory_barrier{
+        .sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER_2,
+        .srcStageMask = VK_PIPELINE_STAGE_2_COPY_BIT,
+        .srcAccessMask = VK_ACCESS_2_TRANSFER_WRITE_BIT,
+        .dstStageMask = VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT,
+        .dstAccessMask = VK_ACCESS_2_MEMORY_READ_BIT | VK_ACCESS_2_MEMORY_WRITE_BIT,
+    };
+    bool same_family = ring.queue->family_index == ring.consumer_queue_family_index;
+    VkDependencyInfo dependency_info{
+        .sType = VK_STRUCTURE_TYPE_DEPENDENCY_INFO,
+        .memoryBarrierCount = same_family ? 1u : 0u,
+        .pMemoryBarriers = &memory_barrier,
+        .bufferMemoryBarrierCount = static_cast<uint32_t>(ring.final_buffer_barriers.size()),
+        .pBufferMemoryBarriers = ring.final_buffer_barriers.data(),
+        .imageMemoryBarrierCount = static_cast<uint32_t>(ring.final_image_barriers.size()),
+        .pImageMemoryBarriers = ring.final_image_barriers.data(),
+    };
+    vkCmdPipelineBarrier2(ring.recording, &dependency_info);
+    ring.final_buffer_barriers.clear();
+    ring.final_image_barriers.clear();
+
+    VkCommandBuffer command_buffer = ring.recording;
+    ring.recording = VK_NULL_HANDLE;
+    VkResult err = vkEndCommandBuffer(command_buffer);
+    if (err != VK_SUCCESS)
+    {
+        fmt::print("Failed to end upload command buffer with error code {}\n", magic_enum::enum_name(err));
+        ring.free_command_buffers.push_back(command_buffer);
+        return err;
+    }
+
+    uint64_t value = 0;
+    err = submit_to_queue(*ring.queue, {&command_buffer, 1}, {}, {}, value);
+    if (err != VK_SUCCESS)
+    {
+        fmt::print("Failed to submit uploads with error code {}\n", magic_enum::enum_name(err));
+        ring.free_command_buffers.push_back(command_buffer);
+        return err;
+    }
+    ring.submitted_value = value;
+    ring.submitted_buffer_acquires.insert(ring.submitted_buffer_acquires.end(), ring.batch_buffer_acquires.begin(), ring.batch_buffer_acquires.end());
+    ring.submitted_image_acquires.insert(ring.submitted_image_acquires.end(), ring.batch_image_acquires.begin(), ring.batch_image_acquires.end());
+    ring.batch_buffer_acquires.clear();
+    ring.batch_image_acquires.clear();
+    ring_end_frame(ring.ring, value);
+    uint64_t consumer_value = ring.batch_consumer_copies.empty() ? 0 : UINT64_MAX;
+    ring.submitted_consumer_copies.insert(ring.submitted_consumer_copies.end(), ring.batch_consumer_copies.begin(), ring.batch_consumer_copies.end());
+    ring.batch_consumer_copies.clear();
+    ring.in_flight.push_back({command_buffer, value, consumer_value});
+    ring.stats.batch_count++;
+    out_value = value;
+    return VK_SUCCESS;
+}
+
+void record_consumer_copies(upload_ring &ring, VkCommandBuffer command_buffer, uint64_t consumer_value)
+{
+    std::vector<VkImageMemoryBarrier2> barriers;
+    for (auto const &consumer_copy : ring.submitted_consumer_copies)
+    {
+        barriers.push_back(VkImageMemoryBarrier2{
+            .sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER_2,
+            .srcStageMask = VK_PIPELINE_STAGE_2_NONE,
+            .srcAccessMask = VK_ACCESS_2_NONE,
+            .dstStageMask = VK_PIPELINE_STAGE_2_COPY_BIT,
+            .dstAccessMask = VK_ACCESS_2_TRANSFER_WRITE_BIT,
+            .oldLayout = VK_IMAGE_LAYOUT_UNDEFINED,
+            .newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+            .srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+            .dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+            .image = consumer_copy.image,
+            .subresourceRange = consumer_copy.subresource_range,
+        });
+    }
+    VkDependencyInfo dependency_info{
+        .sType = VK_STRUCTURE_TYPE_DEPENDENCY_INFO,
+        .imageMemoryBarrierCount = static_cast<uint32_t>(barriers.size()),
+        .pImageMemoryBarriers = barriers.data(),
+    };
+    vkCmdPipelineBarrier2(command_buffer, &dependency_info);
+
+    for (auto const &consumer_copy : ring.submitted_consumer_copies)
+    {
+        vkCmdCopyBufferToImage(command_buffer, ring.ring.buffer, consumer_copy.image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &consumer_copy.copy);
+    }
+
+    barriers.clear();
+    for (auto const &consumer_copy : ring.submitted_consumer_copies)
+    {
+        barriers.push_back(VkImageMemoryBarrier2{
+            .sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER_2,
+            .srcStageMask = VK_PIPELINE_STAGE_2_COPY_BIT,
+            .srcAccessMask = VK_ACCESS_2_TRANSFER_WRITE_BIT,
+            .dstStageMask = VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT,
+            .dstAccessMask = VK_ACCESS_2_MEMORY_READ_BIT | VK_ACCESS_2_MEMORY_WRITE_BIT,
+            .oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+            .newLayout = consumer_copy.final_layout,
+            .srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+            .dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+            .image = consumer_copy.image,
+            .subresourceRange = consumer_copy.subresource_range,
+        });
+    }
+    dependency_info.imageMemoryBarrierCount = static_cast<uint32_t>(barriers.size());
+    dependency_info.pImageMemoryBarriers = barriers.data();
+    vkCmdPipelineBarrier2(command_buffer, &dependency_info);
+    ring.submitted_consumer_copies.clear();
+
+    for (auto &batch : ring.in_flight)
+    {
+        if (batch.consumer_value == UINT64_MAX)
+        {
+            batch.consumer_value = consumer_value;
+        }
+    }
+}
+
+void record_upload_acquires(upload_ring &ring, VkCommandBuffer command_buffer, uint64_t consumer_value)
+{
+    if (!ring.submitted_consumer_copies.empty())
+    {
+        record_consumer_copies(ring, command_buffer, consumer_value);
+    }
+    if (ring.submitted_buffer_acquires.empty() && ring.submitted_image_acquires.empty())
+    {
+        return;
+    }
+    VkDependencyInfo dependency_info{
+        .sType = VK_STRUCTURE_TYPE_DEPENDENCY_INFO,
+        .bufferMemoryBarrierCount = static_cast<uint32_t>(ring.submitted_buffer_acquires.size()),
+        .pBufferMemoryBarriers = ring.submitted_buffer_acquires.data(),
+        .imageMemoryBarrierCount = static_cast<uint32_t>(ring.submitted_image_acquires.size()),
+        .pImageMemoryBarriers = ring.submitted_image_acquires.data(),
+    };
+    vkCmdPipelineBarrier2(command_buffer, &dependency_info);
+    ring.submitted_buffer_acquires.clear();
+    ring.submitted_image_acquires.clear();
+}
+
+VkSemaphoreSubmitInfo upload_wait_info(upload_ring const &ring)
+{
+    return queue_wait_info(*ring.queue, ring.submitted_value, VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT);
+}
+
+void reclaim_uploads(upload_ring &ring, uint64_t consumer_completed_value)
+{
+    ring.consumer_completed_value = consumer_completed_value;
+    reclaim_batches(ring);
+}
+
+VkResult wait_for_uploads(upload_ring &ring, uint64_t value)
+{
+    return wait_for_queue_value(*ring.queue, value, UINT64_MAX);
+}
+
+void print_upload_stats(upload_ring const &ring)
+{
+    auto const &stats = ring.stats;
+    fmt::print("Uploads: {:.2f} MiB staged in {} copies over {} batches, {:.2f} MiB written directly, {} stalls on a full ring\n",
+               stats.staged_bytes / 1048576.0, stats.copy_count, stats.batch_count, stats.direct_bytes / 1048576.0, stats.stall_count);
+    if (stats.consumer_copy_count > 0)
+    {
+        fmt::print("  {} image copies recorded by the consumer, not aligned to the upload queue's transfer granularity\n", stats.consumer_copy_count);
+    }
+}
+
+void destroy_upload_ring(gpu_allocator &allocator, upload_ring &ring)
+{
+    uint64_t value = 0;
+    if (ring.queue != nullptr && submit_uploads(ring, value) == VK_SUCCESS)
+    {
+        wait_for_uploads(ring, value);
+    }
+    vkDestroyCommandPool(ring.device, ring.command_pool, nullptr);
+    if (ring.ring.buffer != VK_NULL_HANDLE)
+    {
+        destroy_ring_buffer(allocator, ring.ring);
+    }
+    ring = upload_ring{};
+}
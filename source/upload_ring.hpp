@@ -0,0 +1,113 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+#include <deque>
+
+#include <vulkan/vulkan_core.h>
+
+#include "gpu_allocator.hpp"
+#include "device_queues.hpp"
+
+struct upload_stats
+{
+    uint64_t staged_bytes = 0;
+    uint64_t direct_bytes = 0; // Written straight into host visible device local memory
+    uint32_t copy_count = 0;
+    uint32_t batch_count = 0;
+    uint32_t stall_count = 0;         // Times the ring was full and had to wait on the GPU
+    uint32_t consumer_copy_count = 0; // Image copies left to the consumer, see upload_image
+};
+
+// Uploads go through a persistently mapped staging ring. The copies recorded during a frame are batched into one
+// command buffer and submitted together to the upload queue, each batch is tracked by the value it signals on that
+// queue's timeline, and the ring space and command buffer of a batch are reused once the timeline has reached it.
+// When the upload queue is on a different family than the queue consuming the data, every destination is released to
+// the consumer's family at the end of its batch, and the consumer records the matching acquires. Not thread safe.
+struct upload_ring
+{
+    VkDevice device{};
+    gpu_queue *queue{};
+    VkExtent3D image_granularity{1, 1, 1}; // minImageTransferGranularity of queue's family
+    uint32_t consumer_queue_family_index = 0;
+    uint64_t consumer_completed_value = 0; // Last value passed to reclaim_uploads
+    gpu_ring_buffer ring{};
+    VkCommandPool command_pool{};
+    uint64_t submitted_value = 0; // Of the last batch, on queue's timeline
+
+    // Set when a large device local heap is host visible (resizable BAR or unified memory), uploads to buffers
+    // allocated with upload_destination_request then skip the staging copy
+    bool direct_writes = false;
+
+    VkCommandBuffer recording{}; // Null until the first copy of the batch is recorded
+    std::vector<VkBufferMemoryBarrier2> final_buffer_barriers;
+    std::vector<VkImageMemoryBarrier2> final_image_barriers;
+
+    // Acquire halves of the ownership transfers, moved from batch_ to submitted_ once their releases are submitted
+    std::vector<VkBufferMemoryBarrier2> batch_buffer_acquires;
+    std::vector<VkImageMemoryBarrier2> batch_image_acquires;
+    std::vector<VkBufferMemoryBarrier2> submitted_buffer_acquires;
+    std::vector<VkImageMemoryBarrier2> submitted_image_acquires;
+
+    // Image copies the upload queue's granularity doesn't allow, staged in the ring and recorded by the consumer
+    struct consumer_copy
+    {
+        VkImage image;
+        VkImageSubresourceRange subresource_range;
+        VkBufferImageCopy copy;
+        VkImageLayout final_layout;
+    };
+    std::vector<consumer_copy> batch_consumer_copies;
+    std::vector<consumer_copy> submitted_consumer_copies;
+
+    struct batch
+    {
+        VkCommandBuffer command_buffer;
+        uint64_t value;
+        uint64_t consumer_value = 0; // Of the consumer's work reading its staging memory, UINT64_MAX until recorded
+    };
+    std::deque<batch> in_flight;
+    std::vector<VkCommandBuffer> free_command_buffers;
+
+    upload_stats stats{};
+};
+
+// Uploads are submitted to queue, which must outlive the ring. The uploaded data is used on consumer_queue_family_index,
+// which has to support graphics or compute.
+VkResult init_upload_ring(gpu_allocator &allocator, gpu_queue &queue, VkExtent3D image_granularity, uint32_t consumer_queue_family_index,
+                          VkDeviceSize capacity, upload_ring &ring);
+
+// Device local memory, host visible as well when direct writes are available
+gpu_memory_request upload_destination_request(upload_ring const &ring);
+
+// Writes size bytes at offset into buffer. When the memory is mapped the data lands immediately, so the range must not
+// be in use by the GPU. Otherwise it is staged and copied when the batch is submitted.
+VkResult upload_buffer(gpu_allocator &allocator, upload_ring &ring, VkBuffer buffer, gpu_allocation const &allocation, VkDeviceSize offset,
+                       void const *data, VkDeviceSize size);
+
+// Replaces the whole subresource with tightly packed texels and leaves it in final_layout. Copies the upload queue's
+// family can't do because of its minImageTransferGranularity are recorded by the consumer instead, whose family has
+// no granularity restrictions.
+VkResult upload_image(upload_ring &ring, VkImage image, VkImageSubresourceLayers const &subresource, VkExtent3D extent, void const *data,
+                      VkDeviceSize size, VkImageLayout final_layout);
+
+// Submits the copies recorded since the last call, if any. out_value is the value the upload queue's timeline reaches
+// once the batch has completed.
+VkResult submit_uploads(upload_ring &ring, uint64_t &out_value);
+
+// Consumers see everything submitted so far by recording the acquires into a command buffer on the consumer family,
+// ahead of any use, and waiting on upload_wait_info in that command buffer's submission. consumer_value is what
+// reclaim_uploads is later passed once that command buffer has completed.
+void record_upload_acquires(upload_ring &ring, VkCommandBuffer command_buffer, uint64_t consumer_value);
+VkSemaphoreSubmitInfo upload_wait_info(upload_ring const &ring);
+
+// Returns the ring space and command buffers of completed batches, call once per frame. consumer_completed_value is the
+// last consumer_value whose work has completed.
+void reclaim_uploads(upload_ring &ring, uint64_t consumer_completed_value);
+
+VkResult wait_for_uploads(upload_ring &ring, uint64_t value);
+
+void print_upload_stats(upload_ring const &ring);
+
+// Waits for every batch in flight first
+void destroy_upload_ring(gpu_allocator &allocator, upload_ring &ring);
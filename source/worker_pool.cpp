@@ -0,0 +1,332 @@
+#include "worker_pool.hpp"
+#include "cpu_profiler.hpp"
+
+#include <algorithm>
+
+#include <fmt/format.h>
+
+struct worker_job
+{
+    std::function<void()> function;
+    job_counter *counter = nullptr;
+};
+
+// The pool and worker index of the calling thread, UINT32_MAX outside of workers
+thread_local worker_pool *current_pool = nullptr;
+thread_local uint32_t current_worker = UINT32_MAX;
+
+static constexpr int64_t deque_mask = job_deque::capacity - 1;
+static_assert((job_deque::capacity & deque_mask) == 0, "capacity must be a power of two");
+
+// Only called by the owner
+bool push_job(job_deque &deque, worker_job *job)
+{
+    int64_t bottom = deque.bottom.load(std::memory_order_relaxed);
+    int64_t top = deque.top.load(std::memory_order_acquire);
+    if (bottom - top >= job_deque::capacity)
+    {
+        return false;
+    }
+    deque.jobs[bottom & deque_mask].store(job, std::memory_order_relaxed);
+    deque.bottom.store(bottom + 1, std::memory_order_release);
+    return true;
+}
+
+// Only called by the owner. Taking the bottom has to be ordered before reading top, which the seq_cst store and load
+// do, or a thief and the owner can both take the last job.
+worker_job *pop_job(job_deque &deque)
+{
+    int64_t bottom = deque.bottom.load(std::memory_order_relaxed) - 1;
+    deque.bottom.store(bottom, std::memory_order_seq_cst);
+    int64_t top = deque.top.load(std::memory_order_seq_cst);
+    if (top > bottom)
+    {
+        deque.bottom.store(bottom + 1, std::memory_order_relaxed);
+        return nullptr;
+    }
+    worker_job *job = deque.jobs[bottom & deque_mask].load(std::memory_order_relaxed);
+    if (top == bottom)
+    {
+        // The last job, whoever moves top first gets it
+        if (!deque.top.compare_exchange_strong(top, top + 1, std::memory_order_seq_cst, std::memory_order_relaxed))
+        {
+            job = nullptr;
+        }
+        deque.bottom.store(bottom + 1, std::memory_order_relaxed);
+    }
+    return job;
+}
+
+// Any thread, fails when the deque is empty or another thread took the job first
+worker_job *steal_job(job_deque &deque)
+{
+    int64_t top = deque.top.load(std::memory_order_seq_cst);
+    int64_t bottom = deque.bottom.load(std::memory_order_seq_cst);
+    if (top >= bottom)
+    {
+        return nullptr;
+    }
+    worker_job *job = deque.jobs[top & deque_mask].load(std::memory_order_relaxed);
+    if (!deque.top.compare_exchange_strong(top, top + 1, std::memory_order_seq_cst, std::memory_order_relaxed))
+    {
+        return nullptr;
+    }
+    return job;
+}
+
+// Own deque first, then the shared queue, then the other workers starting after this one so thieves spread out
+worker_job *take_job(worker_pool &pool, uint32_t worker_index)
+{
+    worker_job *job = nullptr;
+    if (worker_index != UINT32_MAX)
+    {
+        job = pop_job(pool.workers[worker_index]->deque);
+    }
+    if (job == nullptr && pool.injected_count > 0)
+    {
+        std::lock_guard lock(pool.mutex);
+        if (!pool.injected.empty())
+        {
+            job = pool.injected.front();
+            pool.injected.pop_front();
+            pool.injected_count--;
+        }
+    }
+    uint32_t worker_count = static_cast<uint32_t>(pool.workers.size());
+    uint32_t start = worker_index == UINT32_MAX ? 0 : worker_index + 1;
+    for (uint32_t i = 0; job == nullptr && i < worker_count; i++)
+    {
+        uint32_t victim = (start + i) % worker_count;
+        if (victim == worker_index)
+        {
+            continue;
+        }
+        job = steal_job(pool.workers[victim]->deque);
+        if (job != nullptr && worker_index != UINT32_MAX)
+        {
+            pool.workers[worker_index]->stolen_count++;
+        }
+    }
+    if (job != nullptr)
+    {
+        pool.queued_count--;
+    }
+    return job;
+}
+
+void run_job(worker_pool &pool, worker_job *job)
+{
+    {
+        CPU_SCOPE("worker job");
+        job->function();
+    }
+    job_counter *counter = job->counter;
+    delete job;
+    // Same pairing as sleeping_count, waiters count themselves before checking the counter
+    if (counter != nullptr && --counter->pending == 0 && pool.waiting_count > 0)
+    {
+        std::lock_guard lock(pool.mutex);
+        pool.counter_changed.notify_all();
+    }
+    if (--pool.unfinished_count == 0)
+    {
+        std::lock_guard lock(pool.mutex);
+        pool.jobs_finished.notify_all();
+    }
+}
+
+void worker_thread_main(worker_pool &pool, uint32_t worker_index)
+{
+    set_cpu_profiler_thread_name("worker");
+    current_pool = &pool;
+    current_worker = worker_index;
+    while (true)
+    {
+        if (worker_job *job = take_job(pool, worker_index))
+        {
+            run_job(pool, job);
+            pool.workers[worker_index]->executed_count++;
+            continue;
+        }
+        // Submitters check sleeping_count after counting their job as queued, and sleepers check queued_count after
+        // counting themselves as sleeping, so one of them always sees the other
+        std::unique_lock lock(pool.mutex);
+        if (pool.stopping && pool.queued_count == 0)
+        {
+            return; // stopping, and everything queued has been drained
+        }
+        pool.sleeping_count++;
+        pool.job_available.wait(lock, [&pool] { return pool.stopping || pool.queued_count > 0; });
+        pool.sleeping_count--;
+    }
+}
+
+void init_worker_pool(uint32_t thread_count, worker_pool &pool)
+{
+    if (thread_count == 0)
+    {
+        thread_count = std::thread::hardware_concurrency();
+    }
+    if (thread_count == 0)
+    {
+        thread_count = 1; // hardware_concurrency is allowed to return 0 when it can't tell
+    }
+    pool.stopping = false;
+    // Every deque exists before any thread can steal from it
+    for (uint32_t i = 0; i < thread_count; i++)
+    {
+        pool.workers.push_back(std::make_unique<worker_state>());
+    }
+    for (uint32_t i = 0; i < thread_count; i++)
+    {
+        pool.threads.emplace_back(worker_thread_main, std::ref(pool), i);
+    }
+}
+
+void submit_job(worker_pool &pool, std::function<void()> job, job_counter *counter)
+{
+    auto *queued_job = new worker_job{std::move(job), counter};
+    if (counter != nullptr)
+    {
+        counter->pending++;
+    }
+    pool.unfinished_count++;
+    // Counted before it is visible so the count never drops below the jobs that can be taken
+    pool.queued_count++;
+    bool pushed = current_pool == &pool && current_worker != UINT32_MAX && push_job(pool.workers[current_worker]->deque, queued_job);
+    if (!pushed)
+    {
+        std::lock_guard lock(pool.mutex);
+        pool.injected.push_back(queued_job);
+        pool.injected_count++;
+    }
+    if (pool.sleeping_count > 0 || pool.waiting_count > 0)
+    {
+        std::lock_guard lock(pool.mutex);
+        pool.job_available.notify_one();
+        pool.counter_changed.notify_all();
+    }
+}
+
+void wait_for_counter(worker_pool &pool, job_counter &counter)
+{
+    uint32_t worker_index = current_pool == &pool ? current_worker : UINT32_MAX;
+    while (counter.pending > 0)
+    {
+        worker_job *job = take_job(pool, worker_index);
+        if (job == nullptr)
+        {
+            // What's left is running on other threads, sleep until it finishes or queues more work
+            std::unique_lock lock(pool.mutex);
+            pool.waiting_count++;
+            pool.counter_changed.wait(lock, [&pool, &counter] { return counter.pending == 0 || pool.queued_count > 0; });
+            pool.waiting_count--;
+            continue;
+        }
+        run_job(pool, job);
+        if (worker_index != UINT32_MAX)
+        {
+            pool.workers[worker_index]->executed_count++;
+        }
+        else
+        {
+            pool.helped_count++;
+        }
+    }
+}
+
+void wait_for_jobs(worker_pool &pool)
+{
+    std::unique_lock lock(pool.mutex);
+    pool.jobs_finished.wait(lock, [&pool] { return pool.unfinished_count == 0; });
+}
+
+void run_parallel(worker_pool &pool, uint32_t count, std::function<void(uint32_t)> const &job)
+{
+    if (count == 0)
+    {
+        return;
+    }
+    // Without threads (or with a single item) the overhead of the queue isn't worth it
+    if (pool.threads.empty() || count == 1)
+    {
+        for (uint32_t i = 0; i < count; i++)
+        {
+            job(i);
+        }
+        return;
+    }
+
+    // The calling thread pulls indices alongside the workers, so the items still finish when every worker is busy with
+    // long jobs like pipeline builds. Uneven items balance themselves. Only the shared state outlives the call, a job
+    // that starts after every item is taken returns without touching anything else.
+    struct parallel_state
+    {
+        std::atomic<uint32_t> next_index = 0;
+        uint32_t completed = 0;
+        std::mutex mutex;
+        std::condition_variable done;
+    };
+    auto state = std::make_shared<parallel_state>();
+    auto run_items = [state, count, &job]() {
+        uint32_t completed = 0;
+        for (uint32_t i = state->next_index++; i < count; i = state->next_index++)
+        {
+            job(i);
+            completed++;
+        }
+        if (completed > 0)
+        {
+            std::lock_guard lock(state->mutex);
+            state->completed += completed;
+            if (state->completed == count)
+            {
+                state->done.notify_one();
+            }
+        }
+    };
+
+    uint32_t helper_count = std::min(count - 1, static_cast<uint32_t>(pool.threads.size()));
+    for (uint32_t w = 0; w < helper_count; w++)
+    {
+        submit_job(pool, run_items);
+    }
+    run_items();
+    std::unique_lock lock(state->mutex);
+    state->done.wait(lock, [&state, count] { return state->completed == count; });
+}
+
+void print_worker_pool_stats(worker_pool const &pool)
+{
+    uint64_t executed_count = pool.helped_count;
+    uint64_t stolen_count = 0;
+    for (auto const &worker : pool.workers)
+    {
+        executed_count += worker->executed_count;
+        stolen_count += worker->stolen_count;
+    }
+    fmt::print("Worker pool: {} threads ran {} jobs, {} stolen from other workers and {} run by waiting threads\n", pool.workers.size(),
+               executed_count, stolen_count, pool.helped_count.load());
+}
+
+void shutdown_worker_pool(worker_pool &pool)
+{
+    {
+        std::lock_guard lock(pool.mutex);
+        pool.stopping = true;
+    }
+    pool.job_available.notify_all();
+    for (auto &thread : pool.threads)
+    {
+        thread.join();
+    }
+    pool.threads.clear();
+}
+
+worker_pool::~worker_pool()
+{
+    if (!threads.empty())
+    {
+        shutdown_worker_pool(*this);
+    }
+}
@@ -0,0 +1,84 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+#include <deque>
+#include <array>
+#include <memory>
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+
+struct worker_job;
+
+// Counts the jobs submitted with it that haven't finished yet, see wait_for_counter
+struct job_counter
+{
+    std::atomic<uint32_t> pending = 0;
+};
+
+// Chase-Lev deque, the owning worker pushes and pops at the bottom while other threads steal from the top. Fixed size,
+// a worker whose deque is full submits to the shared queue instead.
+struct job_deque
+{
+    static constexpr int64_t capacity = 1024;
+    std::atomic<int64_t> top = 0;
+    std::atomic<int64_t> bottom = 0;
+    std::array<std::atomic<worker_job *>, capacity> jobs{};
+};
+
+struct worker_state
+{
+    job_deque deque;
+    uint64_t executed_count = 0;
+    uint64_t stolen_count = 0;
+};
+
+// A fixed set of threads running jobs with work stealing. Jobs submitted from a worker go to its own deque, newest
+// first, so related work stays on one core, and idle workers steal the oldest jobs of the others. Jobs submitted from
+// any other thread go through a shared queue. Waiting on a counter runs other jobs instead of blocking the thread, so
+// jobs can wait for the jobs they depend on without tying up a worker.
+struct worker_pool
+{
+    std::vector<std::thread> threads;
+    std::vector<std::unique_ptr<worker_state>> workers; // Lines up with threads
+
+    std::mutex mutex; // Guards injected, sleeping with job_available, and waiting with counter_changed
+    std::condition_variable job_available;
+    std::condition_variable jobs_finished;
+    std::condition_variable counter_changed; // A counter reached zero or a job was queued
+    std::deque<worker_job *> injected;
+    std::atomic<uint32_t> injected_count = 0;
+    std::atomic<uint32_t> queued_count = 0;     // Submitted and not yet taken by a thread
+    std::atomic<uint32_t> unfinished_count = 0; // Submitted and not yet finished
+    std::atomic<uint32_t> sleeping_count = 0;
+    std::atomic<uint32_t> waiting_count = 0; // Threads blocked in wait_for_counter with nothing to run
+    std::atomic<bool> stopping = false;
+    std::atomic<uint64_t> helped_count = 0; // Run by threads outside the pool while they waited on a counter
+
+    // Joins any threads still running, so an early return during init doesn't terminate the process
+    ~worker_pool();
+};
+
+// A thread_count of 0 uses one thread per hardware thread
+void init_worker_pool(uint32_t thread_count, worker_pool &pool);
+
+// counter, when given, counts the job as pending until it has finished
+void submit_job(worker_pool &pool, std::function<void()> job, job_counter *counter = nullptr);
+
+// Runs other jobs until every job submitted with counter has finished, and sleeps while the rest are running on other
+// threads. Works from inside a job, the waiting job stays on the stack while the worker runs others, so keep long waits
+// out of jobs that hold locks.
+void wait_for_counter(worker_pool &pool, job_counter &counter);
+
+// Blocks until no job is queued or running, not from inside a job
+void wait_for_jobs(worker_pool &pool);
+
+// Calls job(i) for every i in [0, count) across the pool and the calling thread, returns once all of them have finished
+void run_parallel(worker_pool &pool, uint32_t count, std::function<void(uint32_t)> const &job);
+
+void print_worker_pool_stats(worker_pool const &pool);
+
+void shutdown_worker_pool(worker_pool &pool);